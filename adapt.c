@@ -0,0 +1,338 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "adapt.h"
+#include "config.h"
+
+// One line per mouse:
+//   <id> <count> <height>x5 <pos>x5 <count> <height>x5 <pos>x5
+// keyed by the mouse's id string
+// the hold estimator first, then the jitter one. The thresholds are not
+// stored; they follow from the estimators and the current bounds.
+#define ADAPT_FILE_BYTES 4096
+#define ADAPT_LINE_BYTES 512
+#define ADAPT_FIELDS 22 // after the id
+#define ADAPT_TIMEOUT_STEP_MS 10 // learned values move in steps, not on every press
+#define ADAPT_ARM_STEP_MM 0.1
+
+void p2_init(struct p2_quantile *q, double p) {
+    int i;
+
+    memset(q, 0, sizeof(*q));
+    q->p = p;
+    for (i = 0; i < 5; i++) {
+        q->pos[i] = i + 1;
+    }
+}
+
+// Where marker i belongs after q->count samples
+static double desired(const struct p2_quantile *q, int i) {
+    const double frac[5] = { 0, q->p / 2, q->p, (1 + q->p) / 2, 1 };
+    return 1 + (q->count - 1) * frac[i];
+}
+
+static double parabolic(const struct p2_quantile *q, int i, int d) {
+    const double *h = q->height;
+    const double *n = q->pos;
+
+    return h[i] + d / (n[i + 1] - n[i - 1]) *
+                  ((n[i] - n[i - 1] + d) * (h[i + 1] - h[i]) / (n[i + 1] - n[i]) +
+                   (n[i + 1] - n[i] - d) * (h[i] - h[i - 1]) / (n[i] - n[i - 1]));
+}
+
+void p2_add(struct p2_quantile *q, double x) {
+    double *h = q->height;
+    int i, k;
+
+    if (q->count < 5) {
+        // The first five samples are the markers, kept sorted
+        for (i = q->count++; i > 0 && h[i - 1] > x; i--) {
+            h[i] = h[i - 1];
+        }
+        h[i] = x;
+        return;
+    }
+
+    q->count++;
+    if (x < h[0]) {
+        h[0] = x;
+        k = 0;
+    } else if (x >= h[4]) {
+        h[4] = x;
+        k = 3;
+    } else {
+        for (k = 0; x >= h[k + 1]; k++) {
+        }
+    }
+    for (i = k + 1; i < 5; i++) {
+        q->pos[i]++;
+    }
+
+    // Move the middle markers at most one rank toward where they belong
+    for (i = 1; i <= 3; i++) {
+        double off = desired(q, i) - q->pos[i];
+
+        if ((off >= 1 && q->pos[i + 1] - q->pos[i] > 1) ||
+            (off <= -1 && q->pos[i - 1] - q->pos[i] < -1)) {
+            int d = off > 0 ? 1 : -1;
+            double next = parabolic(q, i, d);
+
+            if (h[i - 1] < next && next < h[i + 1]) {
+                h[i] = next;
+            } else {
+                h[i] += d * (h[i + d] - h[i]) / (q->pos[i + d] - q->pos[i]);
+            }
+            q->pos[i] += d;
+        }
+    }
+}
+
+double p2_value(const struct p2_quantile *q) {
+    if (q->count == 0) {
+        return 0;
+    }
+    if (q->count < 5) {
+        return q->height[(int)(q->p * (q->count - 1) + 0.5)];
+    }
+    return q->height[2];
+}
+
+void adapt_init(struct adapt *a, const char *id) {
+    char copy[ADAPT_ID_BYTES];
+
+    snprintf(copy, sizeof(copy), "%s", id); // id may be a->id
+    memset(a, 0, sizeof(*a));
+    memcpy(a->id, copy, sizeof(a->id));
+    p2_init(&a->hold, ADAPT_QUANTILE);
+    p2_init(&a->jitter, ADAPT_QUANTILE);
+    gesture_params_default(&a->params);
+}
+
+static double clamp(double v, double lo, double hi) {
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+// Thresholds from the estimators. Returns true if they changed.
+static bool update(struct adapt *a) {
+    struct gesture_params next = a->params;
+    double headroom = (100 + ADAPT_HEADROOM_PCT) / 100.0;
+    double timeout, arm;
+
+    if (a->hold.count < ADAPT_MIN_SAMPLES || a->jitter.count < ADAPT_MIN_SAMPLES) {
+        return false;
+    }
+    timeout = p2_value(&a->hold) * headroom;
+    timeout = ADAPT_TIMEOUT_STEP_MS * (int)(timeout / ADAPT_TIMEOUT_STEP_MS + 0.5);
+    next.tap_timeout_ms = (int)clamp(timeout, ADAPT_TIMEOUT_MIN_MS, ADAPT_TIMEOUT_MAX_MS);
+
+    arm = p2_value(&a->jitter) * headroom;
+    arm = ADAPT_ARM_STEP_MM * (int)(arm / ADAPT_ARM_STEP_MM + 0.5);
+    next.arm_mm = clamp(arm, ADAPT_ARM_MIN_MM, ADAPT_ARM_MAX_MM);
+    next.cancel_mm = next.arm_mm * MOTION_CANCEL_MM / MOTION_ARM_MM;
+
+    if (next.tap_timeout_ms == a->params.tap_timeout_ms && next.arm_mm == a->params.arm_mm) {
+        return false;
+    }
+    a->params = next;
+    return true;
+}
+
+bool adapt_press(struct adapt *a, const struct gesture_press *press) {
+    bool learned = false;
+
+    // Hold times come only from taps: a press let go after the timeout is
+    // a hold or an aborted gesture, and counting it would push the timeout
+    // up until more holds counted
+    if (press->dir == DIR_TAP) {
+        p2_add(&a->hold, press->hold_ms);
+        learned = true;
+    }
+    // Drift from quick presses that armed no swipe, measured against the
+    // fixed ceiling: the current arm distance would cut off the very
+    // samples that should move it. A swipe under the ceiling is still a
+    // deliberate move, and counting it would push the distance up until
+    // more swipes fell under it.
+    if ((press->dir == DIR_TAP || press->dir == DIR_COUNT) &&
+        press->hold_ms <= a->params.tap_timeout_ms && press->peak_mm <= ADAPT_ARM_MAX_MM) {
+        p2_add(&a->jitter, press->peak_mm);
+        learned = true;
+    }
+    if (!learned) {
+        return false;
+    }
+    a->dirty = true;
+    return update(a);
+}
+
+static int parse_quantile(struct p2_quantile *q, const double *f) {
+    int i;
+
+    if (f[0] < 0) {
+        return -1;
+    }
+    q->count = (uint64_t)f[0];
+    for (i = 0; i < 5; i++) {
+        q->height[i] = f[1 + i];
+        q->pos[i] = f[6 + i];
+        if (i > 0 && (q->pos[i] <= q->pos[i - 1] || (q->count >= 5 && q->height[i] < q->height[i - 1]))) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int adapt_load(struct adapt *a, const char *path) {
+    char line[ADAPT_LINE_BYTES];
+    double f[ADAPT_FIELDS];
+    FILE *file = fopen(path, "r");
+    int ret = -1;
+
+    if (!file) {
+        return -1;
+    }
+    while (ret < 0 && fgets(line, sizeof(line), file)) {
+        char *save = NULL;
+        char *tok = strtok_r(line, " \n", &save);
+        int n = 0;
+
+        if (!tok || strcmp(tok, a->id) != 0) {
+            continue;
+        }
+        for (tok = strtok_r(NULL, " \n", &save); tok && n < ADAPT_FIELDS;
+             tok = strtok_r(NULL, " \n", &save)) {
+            f[n++] = strtod(tok, NULL);
+        }
+        if (n != ADAPT_FIELDS || tok) {
+            continue;
+        }
+        if (parse_quantile(&a->hold, f) < 0 || parse_quantile(&a->jitter, f + 11) < 0) {
+            break;
+        }
+        ret = 0;
+    }
+    fclose(file);
+
+    if (ret < 0) {
+        adapt_init(a, a->id);
+        return -1;
+    }
+    update(a);
+    a->dirty = false;
+    return 0;
+}
+
+static int format_quantile(char *buf, size_t len, const struct p2_quantile *q) {
+    return snprintf(buf, len, " %llu %.6g %.6g %.6g %.6g %.6g %.0f %.0f %.0f %.0f %.0f",
+                    (unsigned long long)q->count, q->height[0], q->height[1], q->height[2],
+                    q->height[3], q->height[4], q->pos[0], q->pos[1], q->pos[2], q->pos[3],
+                    q->pos[4]);
+}
+
+static void mkdir_parent(const char *path) {
+    char dir[ADAPT_LINE_BYTES];
+    char *slash;
+
+    snprintf(dir, sizeof(dir), "%s", path);
+    slash = strrchr(dir, '/');
+    if (slash && slash != dir) {
+        *slash = '\0';
+        mkdir(dir, 0755);
+    }
+}
+
+static bool ours(const char *line, struct adapt *const *adapts, int count) {
+    size_t len = strcspn(line, " \n");
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (strlen(adapts[i]->id) == len && strncmp(adapts[i]->id, line, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int adapt_save(const char *path, struct adapt *const *adapts, int count) {
+    char old[ADAPT_FILE_BYTES];
+    char out[ADAPT_FILE_BYTES];
+    char tmp_path[ADAPT_LINE_BYTES];
+    size_t used = 0;
+    ssize_t n = 0;
+    char *line, *end;
+    int fd, i;
+
+    // Keep entries for mice not attached this time. Whatever of them is
+    // not read in would be lost with the rename, so a file too big to read
+    // whole is left as it is.
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        n = read(fd, old, sizeof(old));
+        close(fd);
+        if (n < 0) {
+            fprintf(stderr, "Cannot read learned thresholds %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+        if (n == sizeof(old)) {
+            fprintf(stderr, "Learned thresholds %s do not fit in %d bytes\n", path,
+                    ADAPT_FILE_BYTES - 1);
+            return -1;
+        }
+    }
+    old[n] = '\0';
+    for (line = old; *line; line = end) {
+        end = strchr(line, '\n');
+        if (!end) {
+            break; // not a whole entry
+        }
+        end++;
+        if (ours(line, adapts, count)) {
+            continue;
+        }
+        if (used + (end - line) >= sizeof(out)) {
+            used = sizeof(out);
+            break;
+        }
+        memcpy(out + used, line, end - line);
+        used += end - line;
+    }
+
+    for (i = 0; i < count && used < sizeof(out); i++) {
+        used += snprintf(out + used, sizeof(out) - used, "%s", adapts[i]->id);
+        if (used < sizeof(out)) {
+            used += format_quantile(out + used, sizeof(out) - used, &adapts[i]->hold);
+        }
+        if (used < sizeof(out)) {
+            used += format_quantile(out + used, sizeof(out) - used, &adapts[i]->jitter);
+        }
+        if (used < sizeof(out)) {
+            out[used++] = '\n';
+        }
+    }
+    if (used >= sizeof(out)) {
+        fprintf(stderr, "Learned thresholds do not fit in %d bytes\n", ADAPT_FILE_BYTES);
+        return -1;
+    }
+
+    mkdir_parent(path);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot write learned thresholds %s: %s\n", tmp_path, strerror(errno));
+        return -1;
+    }
+    n = write(fd, out, used);
+    if (close(fd) != 0 || n != (ssize_t)used || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Cannot update learned thresholds %s: %s\n", path, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        adapts[i]->dirty = false;
+    }
+    return 0;
+}
@@ -0,0 +1,54 @@
+#ifndef ADAPT_H
+#define ADAPT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gesture.h"
+
+#define ADAPT_ID_BYTES 64
+
+// P² (Jain & Chlamtac): one quantile of a stream in five markers, no
+// samples kept. The markers move toward where the quantile should sit as
+// each sample arrives, adjusted along a parabola through their neighbours.
+struct p2_quantile {
+    double p;          // quantile tracked, 0-1
+    uint64_t count;
+    double height[5];  // marker values; height[2] is the estimate
+    double pos[5];     // marker positions, 1-based ranks
+};
+
+void p2_init(struct p2_quantile *q, double p);
+void p2_add(struct p2_quantile *q, double x);
+
+// The estimate so far; 0 before any sample
+double p2_value(const struct p2_quantile *q);
+
+// Tap timeout and arm distance learned from one mouse's own presses:
+// taps give how long this user holds one, quick presses that swipe
+// nowhere how far the pointer drifts meanwhile, and the thresholds follow a high quantile of
+// each with some headroom, within the ADAPT_* bounds of config.h.
+struct adapt {
+    char id[ADAPT_ID_BYTES];   // which mouse, the key in the state file; one word
+    struct p2_quantile hold;   // ms
+    struct p2_quantile jitter; // mm, farthest excursion on either axis
+    struct gesture_params params; // what the engine should use now
+    bool dirty;                // learned something since the last save
+};
+
+void adapt_init(struct adapt *a, const char *id);
+
+// Learn from a finished press. Returns true if a->params changed.
+bool adapt_press(struct adapt *a, const struct gesture_press *press);
+
+// Restore what was learned before. Returns 0, or -1 with a->params left
+// at the defaults if there is no entry for a->id.
+int adapt_load(struct adapt *a, const char *path);
+
+// Replace path with one entry per mouse, keeping the entries of other
+// mice already there. Buffers on the stack and writes with plain
+// syscalls, so it is safe to call from the event loop. Returns 0 or -1;
+// an old file too big to keep whole is left untouched.
+int adapt_save(const char *path, struct adapt *const *adapts, int count);
+
+#endif
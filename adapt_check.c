@@ -0,0 +1,269 @@
+// Checks for adapt.c: the P² estimator against distributions whose
+// quantiles are known, the press filter that keeps the thresholds from
+// feeding on themselves, and a save and load of the state file.
+//
+// ./adapt_check
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "adapt.h"
+#include "config.h"
+
+#define SAMPLES 100000
+
+static int checks;
+static int failed;
+
+static void expect(bool ok, const char *what) {
+    checks++;
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        failed++;
+    }
+}
+
+static void expect_near(double got, double want, double tolerance, const char *what) {
+    checks++;
+    if (fabs(got - want) > tolerance) {
+        fprintf(stderr, "FAIL: %s: %g, expected %g +- %g\n", what, got, want, tolerance);
+        failed++;
+    }
+}
+
+// Same sequence on every run and libc
+static double uniform(void) {
+    static uint64_t state = 0x9e3779b97f4a7c15ULL;
+
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return (state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double exponential(void) {
+    return -log(1 - uniform());
+}
+
+// Sum of twelve uniforms: mean 6, standard deviation 1
+static double normal(void) {
+    double sum = 0;
+    int i;
+
+    for (i = 0; i < 12; i++) {
+        sum += uniform();
+    }
+    return sum;
+}
+
+static double p2_of(double p, double (*sample)(void)) {
+    struct p2_quantile q;
+    int i;
+
+    p2_init(&q, p);
+    for (i = 0; i < SAMPLES; i++) {
+        p2_add(&q, sample());
+    }
+    return p2_value(&q);
+}
+
+static void check_p2(void) {
+    struct p2_quantile q;
+    const double few[3] = { 30, 10, 20 };
+    int i;
+
+    expect_near(p2_of(0.5, uniform), 0.5, 0.01, "uniform p50");
+    expect_near(p2_of(0.95, uniform), 0.95, 0.01, "uniform p95");
+    expect_near(p2_of(0.5, exponential), log(2), 0.03, "exponential p50");
+    expect_near(p2_of(0.95, exponential), log(20), 0.1, "exponential p95");
+    expect_near(p2_of(0.5, normal), 6, 0.03, "normal p50");
+    expect_near(p2_of(0.95, normal), 6 + 1.6449, 0.05, "normal p95");
+
+    // Under five samples the estimate is the nearest one in sorted order
+    p2_init(&q, 0.5);
+    expect(p2_value(&q) == 0, "no samples");
+    for (i = 0; i < 3; i++) {
+        p2_add(&q, few[i]);
+    }
+    expect(p2_value(&q) == 20, "three samples p50");
+}
+
+static struct gesture_press press_of(enum gesture_dir dir, int hold_ms, double peak_mm) {
+    struct gesture_press p = {
+        .button = BTN_FORWARD,
+        .dir = dir,
+        .hold_ms = hold_ms,
+        .peak_mm = peak_mm,
+    };
+    return p;
+}
+
+static void check_filter(void) {
+    struct gesture_press hold = press_of(DIR_COUNT, ADAPT_TIMEOUT_MAX_MS - 10, 0.1);
+    struct gesture_press tap = press_of(DIR_TAP, 100, 0.5);
+    struct gesture_press swipe = press_of(DIR_LEFT, 100, ADAPT_ARM_MAX_MM + 1);
+    struct gesture_press short_swipe = press_of(DIR_LEFT, 100, 2.0);
+    struct adapt a;
+    int i;
+
+    // Holds released after the timer fired teach nothing about taps
+    adapt_init(&a, "filter");
+    for (i = 0; i < 10 * ADAPT_MIN_SAMPLES; i++) {
+        adapt_press(&a, &hold);
+        adapt_press(&a, &swipe);
+        adapt_press(&a, &short_swipe);
+    }
+    expect(a.hold.count == 0, "holds and swipes kept out of the hold estimate");
+    expect(a.jitter.count == 0, "holds and swipes kept out of the drift estimate");
+    expect(a.params.arm_mm == MOTION_ARM_MM, "arm distance left alone by swipes under the ceiling");
+    expect(a.params.tap_timeout_ms == TAP_TIMEOUT_MS, "timeout left alone by holds");
+
+    // Taps do: short and still ones take both thresholds to their lower bounds
+    for (i = 0; i < ADAPT_MIN_SAMPLES; i++) {
+        adapt_press(&a, &tap);
+    }
+    expect(a.params.tap_timeout_ms == ADAPT_TIMEOUT_MIN_MS, "timeout from 100 ms taps");
+    expect(a.params.arm_mm == ADAPT_ARM_MIN_MM, "arm distance from 0.5 mm drift");
+}
+
+static void fill(struct adapt *a, const char *id, int hold_ms, double peak_mm) {
+    struct gesture_press p;
+    int i;
+
+    adapt_init(a, id);
+    for (i = 0; i < 2 * ADAPT_MIN_SAMPLES; i++) {
+        p = press_of(DIR_TAP, hold_ms + i % 40, peak_mm + (i % 10) * 0.05);
+        adapt_press(a, &p);
+    }
+}
+
+static bool same_params(const struct adapt *a, const struct adapt *b) {
+    return a->params.tap_timeout_ms == b->params.tap_timeout_ms &&
+           a->params.arm_mm == b->params.arm_mm && a->params.cancel_mm == b->params.cancel_mm &&
+           a->hold.count == b->hold.count && a->jitter.count == b->jitter.count;
+}
+
+static void check_round_trip(void) {
+    char dir[] = "/tmp/adapt_check.XXXXXX";
+    char path[sizeof(dir) + 16];
+    char tmp_path[sizeof(path) + 8];
+    struct adapt first, second, loaded;
+    struct adapt *both[2] = { &first, &second };
+    struct adapt *one[1] = { &first };
+
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        failed++;
+        return;
+    }
+    snprintf(path, sizeof(path), "%s/adapt", dir);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    fill(&first, "usb-0000:00:14.0-2/input2:1", 180, 0.4);
+    fill(&second, "4a5b6c7d", 230, 1.1);
+    expect(adapt_save(path, both, 2) == 0, "save");
+    expect(!first.dirty && !second.dirty, "save leaves nothing dirty");
+
+    adapt_init(&loaded, second.id);
+    expect(adapt_load(&loaded, path) == 0, "load by id");
+    expect(same_params(&loaded, &second), "load gives back the saved params");
+    expect(!loaded.dirty, "load leaves nothing dirty");
+
+    // Saving one mouse keeps the other's entry
+    fill(&first, first.id, 120, 0.2);
+    expect(adapt_save(path, one, 1) == 0, "save one");
+    adapt_init(&loaded, second.id);
+    expect(adapt_load(&loaded, path) == 0 && same_params(&loaded, &second),
+           "other mouse kept");
+    adapt_init(&loaded, first.id);
+    expect(adapt_load(&loaded, path) == 0 && same_params(&loaded, &first), "entry replaced");
+
+    // An unknown id, and a prefix of a known one, get the defaults
+    adapt_init(&loaded, "4a5b");
+    expect(adapt_load(&loaded, path) < 0, "no entry for a prefix");
+    expect(loaded.params.tap_timeout_ms == TAP_TIMEOUT_MS && strcmp(loaded.id, "4a5b") == 0,
+           "defaults and id kept without an entry");
+
+    unlink(path);
+    unlink(tmp_path);
+    rmdir(dir);
+}
+
+static bool write_file(const char *path, const char *text, size_t len) {
+    FILE *f = fopen(path, "w");
+    bool ok;
+
+    if (!f) {
+        return false;
+    }
+    ok = fwrite(text, 1, len, f) == len;
+    return fclose(f) == 0 && ok;
+}
+
+static size_t read_file(const char *path, char *buf, size_t size) {
+    FILE *f = fopen(path, "r");
+    size_t n;
+
+    if (!f) {
+        return 0;
+    }
+    n = fread(buf, 1, size - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    return n;
+}
+
+// Entries of other mice are copied over whole or not at all
+static void check_old_file(void) {
+    char dir[] = "/tmp/adapt_check.XXXXXX";
+    char path[sizeof(dir) + 16];
+    char tmp_path[sizeof(path) + 8];
+    char big[2 * 4096];
+    char after[sizeof(big)];
+    struct adapt a;
+    struct adapt *one[1] = { &a };
+    size_t len;
+
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        failed++;
+        return;
+    }
+    snprintf(path, sizeof(path), "%s/adapt", dir);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    fill(&a, "4a5b6c7d", 200, 0.6);
+
+    // Too big to read whole, even with room for the new entry once the
+    // old one is replaced: nothing may be dropped
+    memset(big, 0, sizeof(big));
+    snprintf(big, 513, "%-511s\n", a.id);
+    for (len = 512; len < 4096 + 64; len += 64) {
+        snprintf(big + len, 65, "%-63.8zx\n", len);
+    }
+    expect(write_file(path, big, len), "write big file");
+    expect(adapt_save(path, one, 1) < 0, "save refused over a file too big to keep");
+    expect(read_file(path, after, sizeof(after)) == len && memcmp(big, after, len) == 0,
+           "file too big to keep left untouched");
+
+    // A last line without its newline is not an entry
+    expect(write_file(path, "other 1\nhalf", 13), "write file with a partial line");
+    expect(adapt_save(path, one, 1) == 0, "save over a partial line");
+    read_file(path, after, sizeof(after));
+    expect(strncmp(after, "other 1\n4a5b6c7d ", 17) == 0 && !strstr(after, "half"),
+           "partial line dropped, whole one kept");
+
+    unlink(path);
+    unlink(tmp_path);
+    rmdir(dir);
+}
+
+int main(void) {
+    check_p2();
+    check_filter();
+    check_round_trip();
+    check_old_file();
+    printf("%d adapt checks, %d failed\n", checks, failed);
+    return failed ? 1 : 0;
+}
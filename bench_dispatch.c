@@ -0,0 +1,382 @@
+// Compare the event loop backends: the single-threaded poll() loop,
+// reader threads + dispatcher, and io_uring. Synthetic mice are pipes fed
+// by generator threads; every frame carries its write time, so latency is
+// measured from write to the engine seeing its SYN_REPORT. Each mouse
+// repeats one gesture (press, motion, a wheel detent, release) whose
+// chord goes to /dev/null, which gives syscalls per gesture.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "dispatch.h"
+#include "gesture.h"
+#include "output.h"
+#include "sink.h"
+#include "uring.h"
+
+#define LATENCY_BUCKETS 100000 // 1 us each, the last one collects the rest
+#define GESTURE_FRAMES 11      // press, 8 motion, wheel, release
+
+enum backend {
+    BACKEND_POLL,
+    BACKEND_THREADS,
+    BACKEND_URING,
+};
+
+static const char *backend_names[] = { "poll", "threads", "io_uring" };
+
+struct generator {
+    pthread_t thread;
+    int fd;
+    long frames;
+    long rate; // frames per second, 0 for as fast as possible
+};
+
+struct bench {
+    struct gesture_engine engines[MAX_READERS];
+    uint32_t latency[LATENCY_BUCKETS];
+    long events;
+    long frames;
+    long syscalls; // made by the consuming thread; not counted for threads
+    int open;
+};
+
+static const struct gesture_binding bindings[] = {
+    {
+        .button = BTN_FORWARD,
+        .mode = GESTURE_SWIPE,
+        .action = {
+            [DIR_TAP] = { { KEY_LEFTMETA }, 1 },
+            [DIR_LEFT] = { { KEY_LEFTMETA, KEY_RIGHTBRACE }, 2 },
+            [DIR_RIGHT] = { { KEY_LEFTMETA, KEY_LEFTBRACE }, 2 },
+        },
+        .wheel_up = { { KEY_VOLUMEUP }, 1 },
+        .wheel_down = { { KEY_VOLUMEDOWN }, 1 },
+    },
+};
+
+static long now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static void *generate(void *arg) {
+    struct generator *g = arg;
+    struct input_event frame[3];
+    long start = now_us();
+    long i;
+
+    for (i = 0; i < g->frames; i++) {
+        int phase = i % GESTURE_FRAMES;
+        int n = 0;
+        long t;
+        int j;
+
+        if (g->rate > 0) {
+            long due = start + i * 1000000L / g->rate;
+            while ((t = now_us()) < due) {
+                if (due - t > 200) {
+                    usleep(due - t - 100);
+                }
+            }
+        } else {
+            t = now_us();
+        }
+
+        memset(frame, 0, sizeof(frame));
+        if (phase == 0 || phase == GESTURE_FRAMES - 1) {
+            frame[n].type = EV_KEY;
+            frame[n].code = BTN_FORWARD;
+            frame[n++].value = phase == 0;
+        } else if (phase == GESTURE_FRAMES - 2) {
+            // The chord: one detent while the button is held
+            frame[n].type = EV_REL;
+            frame[n].code = REL_WHEEL_HI_RES;
+            frame[n++].value = 120;
+        } else {
+            frame[n].type = EV_REL;
+            frame[n].code = REL_X;
+            frame[n++].value = (phase & 2) ? 3 : -3;
+            frame[n].type = EV_REL;
+            frame[n].code = REL_Y;
+            frame[n++].value = (phase & 4) ? 2 : -2;
+        }
+        frame[n].type = EV_SYN;
+        frame[n++].code = SYN_REPORT;
+        for (j = 0; j < n; j++) {
+            frame[j].time.tv_sec = t / 1000000;
+            frame[j].time.tv_usec = t % 1000000;
+        }
+        if (write(g->fd, frame, n * sizeof(frame[0])) != (ssize_t)(n * sizeof(frame[0]))) {
+            perror("generator write");
+            break;
+        }
+    }
+    close(g->fd);
+    return NULL;
+}
+
+// Output writer for the poll and thread backends: count, then write()
+static void counting_write(void *ctx, int fd, const struct input_event *ev, int count) {
+    struct bench *b = ctx;
+
+    b->syscalls++;
+    write(fd, ev, count * sizeof(*ev));
+}
+
+static void consume(struct bench *b, int source, const struct input_event *events, int count) {
+    long t = now_us();
+    int i;
+
+    for (i = 0; i < count; i++) {
+        gesture_engine_event(&b->engines[source], &events[i]);
+        if (events[i].type == EV_SYN) {
+            long lat = t - (events[i].time.tv_sec * 1000000L + events[i].time.tv_usec);
+            b->latency[lat < 0 ? 0 : lat >= LATENCY_BUCKETS ? LATENCY_BUCKETS - 1 : lat]++;
+            b->frames++;
+        }
+    }
+    b->events += count;
+}
+
+static void frame_arrived(void *ctx, int source, struct frame *frame) {
+    struct bench *b = ctx;
+
+    if (frame->count < 0) {
+        b->open--;
+    } else {
+        consume(b, source, frame->events, frame->count);
+    }
+}
+
+static void run_single(struct bench *b, int *fds, int devices) {
+    struct pollfd pfds[MAX_READERS];
+    struct input_event events[FRAME_EVENTS];
+    int i;
+
+    for (i = 0; i < devices; i++) {
+        pfds[i].fd = fds[i];
+        pfds[i].events = POLLIN;
+    }
+    output_set_writer(counting_write, NULL, b);
+    while (b->open > 0) {
+        b->syscalls++;
+        if (poll(pfds, devices, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return;
+        }
+        for (i = 0; i < devices; i++) {
+            ssize_t n;
+
+            if (!(pfds[i].revents & (POLLIN | POLLHUP))) {
+                continue;
+            }
+            n = read(pfds[i].fd, events, sizeof(events));
+            b->syscalls++;
+            if (n <= 0) {
+                if (n < 0 && errno == EAGAIN) {
+                    continue;
+                }
+                pfds[i].fd = -1;
+                b->open--;
+                continue;
+            }
+            consume(b, i, events, (int)(n / sizeof(struct input_event)));
+        }
+    }
+}
+
+static void run_uring(struct bench *b, int *fds, int devices) {
+    static struct uring_loop uring;
+    int i;
+
+    if (uring_loop_init(&uring) < 0) {
+        return;
+    }
+    for (i = 0; i < devices; i++) {
+        uring_loop_add_reader(&uring, fds[i], i);
+    }
+    uring_loop_take_output(&uring);
+    while (b->open > 0) {
+        if (uring_loop_wait(&uring, -1, frame_arrived, b) < 0 && errno != EINTR) {
+            perror("io_uring_enter");
+            break;
+        }
+    }
+    uring_loop_flush(&uring);
+    b->syscalls = uring.enters;
+    uring_loop_exit(&uring);
+}
+
+static void run_threaded(struct bench *b, int *fds, int devices) {
+    static struct dispatcher disp;
+    int i;
+
+    output_set_writer(counting_write, NULL, b);
+    if (dispatcher_init(&disp) < 0) {
+        return;
+    }
+    for (i = 0; i < devices; i++) {
+        if (dispatcher_add_reader(&disp, fds[i], i, false) < 0) {
+            dispatcher_stop(&disp);
+            return;
+        }
+    }
+    while (b->open > 0) {
+        if (dispatcher_prepare_sleep(&disp)) {
+            struct pollfd pfd = { .fd = disp.wake_fd, .events = POLLIN };
+            poll(&pfd, 1, -1);
+        }
+        dispatcher_woken(&disp);
+        dispatcher_drain(&disp, frame_arrived, b);
+    }
+    for (i = 0; i < devices; i++) {
+        if (disp.readers[i].dropped) {
+            printf("  reader %d dropped %llu frames\n", i,
+                   (unsigned long long)disp.readers[i].dropped);
+        }
+    }
+    dispatcher_stop(&disp);
+}
+
+static long percentile(const struct bench *b, double p) {
+    long want = (long)((b->frames - 1) * p);
+    long seen = 0;
+    long i;
+
+    for (i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += b->latency[i];
+        if (seen > want) {
+            return i;
+        }
+    }
+    return LATENCY_BUCKETS - 1;
+}
+
+static void run(enum backend backend, int devices, long frames, long rate, struct output_sink *out) {
+    static struct bench b;
+    struct generator gens[MAX_READERS];
+    int fds[MAX_READERS];
+    long start, elapsed, gestures;
+    int i;
+
+    memset(&b, 0, sizeof(b));
+    for (i = 0; i < devices; i++) {
+        int pipefd[2];
+
+        if (pipe(pipefd) < 0) {
+            perror("pipe");
+            exit(1);
+        }
+        // Posted io_uring reads need a blocking fd
+        if (backend != BACKEND_URING) {
+            fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
+        }
+        fds[i] = pipefd[0];
+        gens[i].fd = pipefd[1];
+        gens[i].frames = frames;
+        gens[i].rate = rate;
+
+        gesture_engine_init(&b.engines[i], out, bindings, 1);
+        gesture_engine_set_dpi(&b.engines[i], 1000);
+    }
+    b.open = devices;
+
+    start = now_us();
+    for (i = 0; i < devices; i++) {
+        pthread_create(&gens[i].thread, NULL, generate, &gens[i]);
+    }
+    switch (backend) {
+    case BACKEND_POLL:
+        run_single(&b, fds, devices);
+        break;
+    case BACKEND_THREADS:
+        run_threaded(&b, fds, devices);
+        break;
+    case BACKEND_URING:
+        run_uring(&b, fds, devices);
+        break;
+    }
+    elapsed = now_us() - start;
+    output_set_writer(NULL, NULL, NULL);
+    for (i = 0; i < devices; i++) {
+        pthread_join(gens[i].thread, NULL);
+        close(fds[i]);
+        gesture_engine_release_all(&b.engines[i]);
+    }
+
+    gestures = b.frames / GESTURE_FRAMES;
+    printf("%-9s %2d dev %8ld frames %10.0f events/s  latency us p50 %ld p99 %ld p99.9 %ld max %ld",
+           backend_names[backend], devices, b.frames, b.events * 1e6 / (elapsed > 0 ? elapsed : 1),
+           percentile(&b, 0.5), percentile(&b, 0.99), percentile(&b, 0.999), percentile(&b, 1.0));
+    if (backend != BACKEND_THREADS && gestures > 0) {
+        printf("  syscalls/gesture %.2f", (double)b.syscalls / gestures);
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    int devices = 4;
+    long frames = 220000;
+    long rate = 1000; // a 1 kHz mouse
+    static struct output_sink out;
+    int null_fd;
+    int backend;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:n:r:h")) != -1) {
+        switch (opt) {
+        case 'd':
+            devices = atoi(optarg);
+            break;
+        case 'n':
+            frames = atol(optarg);
+            break;
+        case 'r':
+            rate = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-d DEVICES] [-n FRAMES] [-r RATE]\n", argv[0]);
+            fprintf(stderr, "  -d  synthetic mice, 1-%d (default 4)\n", MAX_READERS);
+            fprintf(stderr, "  -n  frames per mouse (default 220000)\n");
+            fprintf(stderr, "  -r  frames per second per mouse for the latency run (default 1000)\n");
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (devices < 1 || devices > MAX_READERS || frames <= 0 || rate < 0) {
+        fprintf(stderr, "Invalid arguments\n");
+        return 1;
+    }
+
+    // Real writes, so the syscall counts include the output
+    null_fd = open("/dev/null", O_WRONLY);
+    sink_open_fd(&out, null_fd, 0);
+
+    // Throughput: generators write as fast as they can
+    for (backend = BACKEND_POLL; backend <= BACKEND_URING; backend++) {
+        run(backend, devices, frames, 0, &out);
+    }
+
+    // Latency: paced like real mice, fewer frames so the run stays short
+    if (rate > 0) {
+        long paced = frames < rate * 5 ? frames : rate * 5;
+
+        for (backend = BACKEND_POLL; backend <= BACKEND_URING; backend++) {
+            run(backend, devices, paced, rate, &out);
+        }
+    }
+
+    close(null_fd);
+    return 0;
+}
@@ -0,0 +1,27 @@
+#include <linux/input.h>
+
+#include "bindings.h"
+
+// Buttons that can drive gestures. BTN_FORWARD is the thumb button as
+// exposed by the receiver; set a mode on the others to use them as well.
+const struct gesture_binding default_bindings[DEFAULT_BINDING_COUNT] = {
+    {
+        .button = BTN_FORWARD,
+        .mode = GESTURE_SWIPE,
+        .action = {
+            [DIR_TAP] = { { KEY_LEFTMETA }, 1 },
+            [DIR_LEFT] = { { KEY_LEFTMETA, KEY_RIGHTBRACE }, 2 },
+            [DIR_RIGHT] = { { KEY_LEFTMETA, KEY_LEFTBRACE }, 2 },
+        },
+        .wheel_up = { { KEY_VOLUMEUP }, 1 },
+        .wheel_down = { { KEY_VOLUMEDOWN }, 1 },
+    },
+    { .button = BTN_SIDE, .mode = GESTURE_NONE },
+    { .button = BTN_EXTRA, .mode = GESTURE_NONE },
+    { .button = BTN_MIDDLE, .mode = GESTURE_NONE },
+};
+
+const struct thumbwheel_binding thumbwheel_tabs = {
+    .left = { { KEY_LEFTCTRL, KEY_LEFTSHIFT, KEY_TAB }, 3 },
+    .right = { { KEY_LEFTCTRL, KEY_TAB }, 2 },
+};
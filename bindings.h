@@ -0,0 +1,16 @@
+#ifndef BINDINGS_H
+#define BINDINGS_H
+
+#include "gesture.h"
+
+#define DEFAULT_BINDING_COUNT 4
+
+// What ships: the daemon starts every mouse from these (options then
+// change modes on its own copy), and the golden traces replay against
+// them, so the suite tests the bindings users actually get
+extern const struct gesture_binding default_bindings[DEFAULT_BINDING_COUNT];
+
+// Thumb wheel as tab switcher, enabled with -t
+extern const struct thumbwheel_binding thumbwheel_tabs;
+
+#endif
@@ -0,0 +1,450 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "capture.h"
+
+#define MAGIC_BYTES 8
+
+static uint64_t event_us(const struct input_event *ev) {
+    return (uint64_t)ev->time.tv_sec * 1000000 + ev->time.tv_usec;
+}
+
+static int64_t clock_us(clockid_t clock) {
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Events stamped by whichever clock is nearer now: monotonic ones get
+// the current offset to the wall clock, wall-clock ones (a raw recording
+// played back) none
+static int64_t wall_offset(uint64_t t) {
+    int64_t mono = clock_us(CLOCK_MONOTONIC);
+    int64_t real = clock_us(CLOCK_REALTIME);
+
+    return llabs((int64_t)t - mono) < llabs((int64_t)t - real) ? real - mono : 0;
+}
+
+static uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static uint8_t *put_varint(uint8_t *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+// Bounded by end; a varint running past it reads as 0 and ends the block
+static const uint8_t *get_varint_long(const uint8_t *p, const uint8_t *end, uint64_t *v) {
+    uint64_t out = 0;
+    int shift = 0;
+
+    while (p < end && shift < 64) {
+        uint8_t b = *p++;
+
+        out |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = out;
+            return p;
+        }
+        shift += 7;
+    }
+    *v = 0;
+    return NULL;
+}
+
+// Most fields are one byte: deltas within a frame, small codes and motion
+static inline const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint64_t *v) {
+    if (p < end && *p < 0x80) {
+        *v = *p;
+        return p + 1;
+    }
+    return get_varint_long(p, end, v);
+}
+
+// Where the value of an EV_REL or EV_ABS code is remembered, else NULL
+static int32_t *delta_slot(struct capture_state *st, int type, int code) {
+    if (type == EV_REL && code < CAPTURE_DELTA_REL) {
+        return &st->rel[code];
+    }
+    if (type == EV_ABS && code < CAPTURE_DELTA_ABS) {
+        return &st->abs[code];
+    }
+    return NULL;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("capture write");
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int capture_create(struct capture_writer *w, const char *path) {
+    memset(w, 0, sizeof(*w));
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (w->fd < 0) {
+        perror(path);
+        return -1;
+    }
+    if (write_all(w->fd, CAPTURE_MAGIC, MAGIC_BYTES) < 0) {
+        close(w->fd);
+        w->fd = -1;
+        return -1;
+    }
+    w->offset = MAGIC_BYTES;
+    // Room for a day of light use up front, so a loop writing through
+    // this does not allocate for a good while
+    w->index_room = 1024;
+    w->index = malloc(w->index_room * sizeof(*w->index));
+    if (!w->index) {
+        w->index_room = 0;
+    }
+    return 0;
+}
+
+void capture_flush(struct capture_writer *w) {
+    struct capture_block hdr = {
+        .magic = CAPTURE_BLOCK_MAGIC,
+        .bytes = (uint32_t)w->used,
+        .events = w->block_events,
+        .first_us = w->block_first_us,
+        .wall_offset_us = w->block_wall_offset_us,
+    };
+
+    if (w->block_events == 0) {
+        return;
+    }
+    if (w->blocks == w->index_room) {
+        uint32_t want = w->index_room ? w->index_room * 2 : 1024;
+        struct capture_index *grown = realloc(w->index, want * sizeof(*w->index));
+
+        if (!grown) {
+            perror("realloc");
+            w->used = 0; // dropped: better than growing past the buffer
+            w->block_events = 0;
+            return;
+        }
+        w->index = grown;
+        w->index_room = want;
+    }
+    w->index[w->blocks].offset = w->offset;
+    w->index[w->blocks].first_us = w->block_first_us;
+    w->index[w->blocks].events = w->events - w->block_events;
+    w->blocks++;
+
+    // A failed write leaves a short block that readers stop at
+    write_all(w->fd, &hdr, sizeof(hdr));
+    write_all(w->fd, w->block, w->used);
+    w->offset += sizeof(hdr) + w->used;
+    w->used = 0;
+    w->block_events = 0;
+}
+
+void capture_write(struct capture_writer *w, const struct input_event *ev, int count) {
+    int i;
+
+    for (i = 0; i < count; i++) {
+        uint64_t t = event_us(&ev[i]);
+        int32_t *last;
+        uint8_t *p;
+
+        if (w->block_events > 0 && t - w->block_first_us >= CAPTURE_BLOCK_MS * 1000ULL) {
+            capture_flush(w);
+        }
+        if (w->block_events == 0) {
+            memset(&w->state, 0, sizeof(w->state));
+            w->state.time_us = t;
+            w->block_first_us = t;
+            w->block_wall_offset_us = wall_offset(t);
+        }
+
+        p = w->block + w->used;
+        p = put_varint(p, zigzag((int64_t)(t - w->state.time_us)));
+        p = put_varint(p, (uint64_t)ev[i].code << 5 | (ev[i].type & 0x1f));
+        last = delta_slot(&w->state, ev[i].type, ev[i].code);
+        if (last) {
+            p = put_varint(p, zigzag((int64_t)ev[i].value - *last));
+            *last = ev[i].value;
+        } else {
+            p = put_varint(p, zigzag(ev[i].value));
+        }
+        w->state.time_us = t;
+        w->used = p - w->block;
+        w->block_events++;
+        w->events++;
+
+        if (w->used >= CAPTURE_BLOCK_BYTES) {
+            capture_flush(w);
+        }
+    }
+}
+
+int capture_close(struct capture_writer *w) {
+    static const uint8_t pad[8];
+    struct capture_trailer trailer = { .magic = CAPTURE_TRAILER_MAGIC };
+    int err = 0;
+
+    if (w->fd < 0) {
+        return 0;
+    }
+    capture_flush(w);
+
+    // Aligned, so a reader can use the index in place
+    if (w->offset % 8) {
+        err |= write_all(w->fd, pad, 8 - w->offset % 8);
+        w->offset += 8 - w->offset % 8;
+    }
+    trailer.blocks = w->blocks;
+    trailer.index_offset = w->offset;
+    trailer.events = w->events;
+    err |= write_all(w->fd, w->index, w->blocks * sizeof(*w->index));
+    err |= write_all(w->fd, &trailer, sizeof(trailer));
+    w->offset += w->blocks * sizeof(*w->index) + sizeof(trailer);
+    if (close(w->fd) < 0) {
+        perror("capture close");
+        err = -1;
+    }
+    w->fd = -1;
+    free(w->index);
+    w->index = NULL;
+    return err ? -1 : 0;
+}
+
+// Block header size for the version magic names, 0 if it is none
+static size_t header_bytes(const void *magic) {
+    if (memcmp(magic, CAPTURE_MAGIC, MAGIC_BYTES) == 0) {
+        return sizeof(struct capture_block);
+    }
+    if (memcmp(magic, CAPTURE_MAGIC_V1, MAGIC_BYTES) == 0) {
+        return offsetof(struct capture_block, wall_offset_us);
+    }
+    return 0;
+}
+
+// Older headers are a prefix of the current one; what they lack reads as 0
+static void read_header(const struct capture *c, size_t off, struct capture_block *hdr) {
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr, c->map + off, c->block_header);
+}
+
+bool capture_is_capture(int fd) {
+    char magic[MAGIC_BYTES];
+
+    return pread(fd, magic, sizeof(magic), 0) == sizeof(magic) && header_bytes(magic) > 0;
+}
+
+// No usable trailer: walk the block headers, stopping at the first one
+// that is not whole
+static int rebuild_index(struct capture *c) {
+    size_t off = MAGIC_BYTES;
+    uint32_t room = 0;
+
+    c->blocks = 0;
+    c->events = 0;
+    while (off + c->block_header <= c->size) {
+        struct capture_block hdr;
+
+        read_header(c, off, &hdr);
+        if (hdr.magic != CAPTURE_BLOCK_MAGIC || hdr.bytes > c->size - off - c->block_header) {
+            break;
+        }
+        if (c->blocks == room) {
+            struct capture_index *grown;
+
+            room = room ? room * 2 : 1024;
+            grown = realloc(c->rebuilt, room * sizeof(*c->rebuilt));
+            if (!grown) {
+                perror("realloc");
+                return -1;
+            }
+            c->rebuilt = grown;
+        }
+        c->rebuilt[c->blocks].offset = off;
+        c->rebuilt[c->blocks].first_us = hdr.first_us;
+        c->rebuilt[c->blocks].events = c->events;
+        c->blocks++;
+        c->events += hdr.events;
+        off += c->block_header + hdr.bytes;
+    }
+    c->index = c->rebuilt;
+    return 0;
+}
+
+int capture_open(struct capture *c, const char *path) {
+    struct capture_trailer trailer;
+    struct stat st;
+    void *map;
+    int fd;
+
+    memset(c, 0, sizeof(*c));
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < MAGIC_BYTES) {
+        fprintf(stderr, "%s: not a capture\n", path);
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    c->map = map;
+    c->size = st.st_size;
+    c->block_header = header_bytes(c->map);
+    if (c->block_header == 0) {
+        fprintf(stderr, "%s: not a capture\n", path);
+        capture_free(c);
+        return -1;
+    }
+    c->wall_clock = c->block_header == sizeof(struct capture_block);
+    madvise(map, c->size, MADV_SEQUENTIAL);
+
+    if (c->size >= MAGIC_BYTES + sizeof(trailer)) {
+        memcpy(&trailer, c->map + c->size - sizeof(trailer), sizeof(trailer));
+        if (trailer.magic == CAPTURE_TRAILER_MAGIC && trailer.index_offset % 8 == 0 &&
+            trailer.index_offset + (uint64_t)trailer.blocks * sizeof(struct capture_index) ==
+                c->size - sizeof(trailer)) {
+            c->index = (const struct capture_index *)(c->map + trailer.index_offset);
+            c->blocks = trailer.blocks;
+            c->events = trailer.events;
+            return 0;
+        }
+    }
+    fprintf(stderr, "%s: no index (capture cut short?), scanning blocks\n", path);
+    if (rebuild_index(c) < 0) {
+        capture_free(c);
+        return -1;
+    }
+    return 0;
+}
+
+void capture_free(struct capture *c) {
+    if (c->map) {
+        munmap((void *)c->map, c->size);
+    }
+    free(c->rebuilt);
+    memset(c, 0, sizeof(*c));
+}
+
+// Make block b current; false past the last one
+static bool open_block(struct capture_cursor *cur, uint32_t b) {
+    const struct capture *c = cur->cap;
+    struct capture_block hdr;
+
+    if (b >= c->blocks) {
+        cur->left = 0;
+        return false;
+    }
+    read_header(c, c->index[b].offset, &hdr);
+    cur->block = b + 1;
+    cur->p = c->map + c->index[b].offset + c->block_header;
+    cur->end = cur->p + hdr.bytes;
+    cur->left = hdr.events;
+    cur->wall_offset_us = hdr.wall_offset_us;
+    memset(&cur->state, 0, sizeof(cur->state));
+    cur->state.time_us = hdr.first_us;
+    return true;
+}
+
+int capture_read(struct capture_cursor *cur, struct input_event *ev, int max) {
+    int n = 0, start;
+
+    while (n < max) {
+        const uint8_t *p;
+        uint64_t dt, key, value;
+
+        while (cur->left == 0) {
+            if (n > 0 || !open_block(cur, cur->block)) {
+                return n;
+            }
+        }
+        p = cur->p;
+        start = n;
+        for (; n < max && cur->left > 0; n++, cur->left--) {
+            struct input_event *out = &ev[n];
+            int32_t *last;
+
+            if (!(p = get_varint(p, cur->end, &dt)) || !(p = get_varint(p, cur->end, &key)) ||
+                !(p = get_varint(p, cur->end, &value))) {
+                cur->left = 0; // damaged block: skip the rest of it
+                break;
+            }
+            if (dt != 0 || n == start) { // events of one frame share a time
+                cur->state.time_us += unzigzag(dt);
+                out->time.tv_sec = cur->state.time_us / 1000000;
+                out->time.tv_usec = cur->state.time_us % 1000000;
+            } else {
+                out->time = out[-1].time;
+            }
+            out->type = key & 0x1f;
+            out->code = key >> 5;
+            last = delta_slot(&cur->state, out->type, out->code);
+            if (last) {
+                *last += (int32_t)unzigzag(value);
+                out->value = *last;
+            } else {
+                out->value = (int32_t)unzigzag(value);
+            }
+        }
+        cur->p = p;
+    }
+    return n;
+}
+
+void capture_seek(struct capture_cursor *cur, const struct capture *c, uint64_t time_us) {
+    struct capture_cursor before;
+    struct input_event ev;
+    uint32_t lo = 0, hi = c->blocks;
+
+    // Last block starting at or before time_us
+    while (hi - lo > 1) {
+        uint32_t mid = (lo + hi) / 2;
+
+        if (c->index[mid].first_us <= time_us) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    memset(cur, 0, sizeof(*cur));
+    cur->cap = c;
+    cur->block = lo;
+    do {
+        before = *cur;
+    } while (capture_read(cur, &ev, 1) == 1 && event_us(&ev) < time_us);
+    *cur = before;
+}
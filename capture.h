@@ -0,0 +1,139 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/input.h>
+
+// Compact capture of raw mouse input for long recordings. A raw
+// struct input_event stream costs 24 bytes an event; here a motion event
+// is typically 3:
+//
+//   file    := header block* index trailer
+//   header  := CAPTURE_MAGIC (8 bytes)
+//   block   := struct capture_block payload
+//   payload := event*, each three varints:
+//                time since the previous event in us (zigzag; the first
+//                  is relative to the block's first_us)
+//                code << 5 | type
+//                value (zigzag); EV_REL and EV_ABS as the change from the
+//                  last value of the same code in the block
+//   index   := struct capture_index[blocks]
+//   trailer := struct capture_trailer
+//
+// Blocks decode on their own, so a reader can start at any of them; the
+// index at the end says where they are and when they start. Event times
+// are kept as read (CLOCK_MONOTONIC from evdev here); each block notes
+// the offset to wall-clock time when it was written, which moves with
+// suspend and clock changes. A capture cut short (crash, power loss) has
+// no index and is read by walking the block headers instead: everything
+// up to the last sealed block survives.
+#define CAPTURE_MAGIC "MX3CAP2\n"
+#define CAPTURE_MAGIC_V1 "MX3CAP1\n" // block headers without wall_offset_us; read only
+#define CAPTURE_BLOCK_MAGIC 0x4b4c4243  // "CBLK"
+#define CAPTURE_TRAILER_MAGIC 0x58444943 // "CIDX"
+#define CAPTURE_BLOCK_BYTES 65536 // payload before a block is sealed
+#define CAPTURE_BLOCK_MS 60000    // or once its first event is this old
+#define CAPTURE_EVENT_MAX 20      // encoded size of the largest event
+#define CAPTURE_DELTA_REL (REL_MAX + 1)
+#define CAPTURE_DELTA_ABS (ABS_MAX + 1)
+
+struct capture_block {
+    uint32_t magic;    // CAPTURE_BLOCK_MAGIC
+    uint32_t bytes;    // payload size
+    uint32_t events;
+    uint32_t reserved;
+    uint64_t first_us; // time of the first event
+    int64_t wall_offset_us; // add to event times for CLOCK_REALTIME, 0 if already
+                            // (not in MX3CAP1 captures)
+};
+
+struct capture_index {
+    uint64_t offset;   // of the block header
+    uint64_t first_us;
+    uint64_t events;   // in all blocks before this one
+};
+
+struct capture_trailer {
+    uint32_t magic;    // CAPTURE_TRAILER_MAGIC
+    uint32_t blocks;
+    uint64_t index_offset;
+    uint64_t events;
+};
+
+// Delta state; reset at every block boundary
+struct capture_state {
+    uint64_t time_us;
+    int32_t rel[CAPTURE_DELTA_REL];
+    int32_t abs[CAPTURE_DELTA_ABS];
+};
+
+struct capture_writer {
+    int fd;
+    uint8_t block[CAPTURE_BLOCK_BYTES + CAPTURE_EVENT_MAX];
+    size_t used;
+    uint32_t block_events;
+    uint64_t block_first_us;
+    int64_t block_wall_offset_us;
+    struct capture_state state;
+    struct capture_index *index;
+    uint32_t blocks;
+    uint32_t index_room;
+    uint64_t offset; // file size so far
+    uint64_t events;
+};
+
+// Start a new capture at path. Returns 0 or -1.
+int capture_create(struct capture_writer *w, const char *path);
+
+// Append events. Blocks are written out as they fill or age, so with
+// capture_flush() called every CAPTURE_BLOCK_MS a crash loses at most
+// that much input.
+void capture_write(struct capture_writer *w, const struct input_event *ev, int count);
+
+// Seal the current block now, e.g. from a timer while input is idle
+void capture_flush(struct capture_writer *w);
+
+// Seal the last block and write the index. Returns 0 or -1.
+int capture_close(struct capture_writer *w);
+
+// A capture mapped read-only
+struct capture {
+    const uint8_t *map;
+    size_t size;
+    const struct capture_index *index; // into map, or the rebuilt one
+    struct capture_index *rebuilt;     // no trailer: found by walking the blocks
+    uint32_t blocks;
+    uint64_t events;
+    size_t block_header; // bytes of a block header in this file
+    bool wall_clock;     // blocks carry wall_offset_us (not MX3CAP1)
+};
+
+struct capture_cursor {
+    const struct capture *cap;
+    uint32_t block;         // next block to open
+    const uint8_t *p;       // into the current block's payload
+    const uint8_t *end;     // and where it stops
+    uint32_t left;          // events left in it
+    int64_t wall_offset_us; // its events' offset to wall-clock time, 0 if unknown
+    struct capture_state state;
+};
+
+// True if the file at fd starts like a capture of any version; fd's
+// offset is untouched
+bool capture_is_capture(int fd);
+
+// Map path. Returns 0 or -1.
+int capture_open(struct capture *c, const char *path);
+void capture_free(struct capture *c);
+
+// Position cur at the first event at or after time_us (0: the start)
+void capture_seek(struct capture_cursor *cur, const struct capture *c, uint64_t time_us);
+
+// Decode up to max events straight from the mapping, all from one block
+// (so cur->wall_offset_us holds for every one). Returns the number
+// decoded, 0 at the end.
+int capture_read(struct capture_cursor *cur, struct input_event *ev, int max);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#define MOUSE_NAME "Logitech USB Receiver Mouse"
+#define DEFAULT_DPI 1000 // sensor resolution assumed unless -d is given
+#define MOTION_ARM_MM 1.27   // travel that turns a press into a swipe (50 counts at 1000 DPI)
+#define MOTION_CANCEL_MM 0.8 // falling back below this turns it into a tap again
+#define TAP_TIMEOUT_MS 200 // longest motionless press that still counts as a tap
+#define DIR_MARGIN_PCT 0   // lead the dominant axis needs for a swipe to count (0: ties go vertical)
+#define SWITCHER_STEP_MM 3.8 // horizontal travel per window-switcher step
+#define FEATURE_CACHE_PATH "/var/cache/mx3_driver/features" // HID++ feature indices
+#define CACHE_SYNC_DELAY_MS 1000 // idle time before cached features are verified
+#define THUMBWHEEL_STEP_HI_RES 120 // hi-res units per thumb wheel action (120 = one notch)
+#define THUMBWHEEL_MAX_PER_FRAME 2 // thumb wheel actions per SYN_REPORT, rest dropped
+#define ADAPT_STATE_PATH "/var/lib/mx3_driver/adapt" // learned thresholds (-a)
+#define ADAPT_QUANTILE 0.95     // share of this user's taps the learned thresholds let through
+#define ADAPT_HEADROOM_PCT 20   // added on top of that quantile
+#define ADAPT_MIN_SAMPLES 50    // taps (and quick unswiped presses) seen before adjusting anything
+#define ADAPT_TIMEOUT_MIN_MS 150 // bounds for the learned tap timeout
+#define ADAPT_TIMEOUT_MAX_MS 400 // (longer presses are deliberate holds, not taps)
+#define ADAPT_ARM_MIN_MM 0.8    // bounds for the learned arm distance
+#define ADAPT_ARM_MAX_MM 2.5    // (and the most drift a quick press may show to count)
+#define ADAPT_SAVE_MS 600000    // how often learned thresholds are written out
+
+#endif
@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+
+#include "dispatch.h"
+
+static void wake(struct dispatcher *d) {
+    uint64_t one = 1;
+
+    // Pairs with the fence in dispatcher_prepare_sleep(): either we see
+    // sleeping set, or the dispatcher sees our new tail before it sleeps
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_exchange(&d->sleeping, false)) {
+        write(d->wake_fd, &one, sizeof(one));
+    }
+}
+
+// Backpressure: leave the events in the pipe, which in turn stalls its
+// feeder, until the dispatcher frees a slot. Returns false on stop.
+static bool wait_for_room(struct reader *r) {
+    struct spsc_ring *ring = &r->ring;
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t count;
+
+    for (;;) {
+        struct pollfd fds[2] = {
+            { .fd = r->room_fd, .events = POLLIN },
+            { .fd = r->disp->stop_fd, .events = POLLIN },
+        };
+
+        if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) < RING_SLOTS) {
+            return true;
+        }
+        // Pairs with the fence in dispatcher_drain(): either we see the
+        // new head, or the dispatcher sees waiting set and signals room_fd
+        atomic_store(&r->waiting, true);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) < RING_SLOTS) {
+            atomic_store(&r->waiting, false);
+            return true;
+        }
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+            perror("reader poll");
+            return false;
+        }
+        if (fds[1].revents & POLLIN) {
+            return false;
+        }
+        if (fds[0].revents & POLLIN) {
+            read(r->room_fd, &count, sizeof(count));
+        }
+    }
+}
+
+static void *reader_main(void *arg) {
+    struct reader *r = arg;
+    struct spsc_ring *ring = &r->ring;
+    struct frame scratch;
+
+    for (;;) {
+        struct pollfd fds[2] = {
+            { .fd = r->fd, .events = POLLIN },
+            { .fd = r->disp->stop_fd, .events = POLLIN },
+        };
+        unsigned tail, head;
+        struct frame *f;
+        int skip = 0;
+        ssize_t n;
+
+        if (r->backpressure && !wait_for_room(r)) {
+            break;
+        }
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("reader poll");
+            fds[0].revents = POLLERR;
+        }
+        if (fds[1].revents & POLLIN) {
+            break;
+        }
+
+        // Read straight into the next free slot; with the ring full the
+        // frame is read anyway (the kernel buffer must not overflow) and
+        // lost. With backpressure there is always a free slot here.
+        tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        f = tail - head < RING_SLOTS ? &ring->slots[tail & (RING_SLOTS - 1)] : &scratch;
+        if (f != &scratch && r->lost) {
+            memset(&f->events[0], 0, sizeof(f->events[0]));
+            f->events[0].type = EV_SYN;
+            f->events[0].code = SYN_DROPPED;
+            skip = 1;
+        }
+
+        n = read(r->fd, f->events + skip, sizeof(f->events) - skip * sizeof(f->events[0]));
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        }
+        f->count = n > 0 ? (int)(n / sizeof(struct input_event)) + skip : -1;
+
+        if (f == &scratch) {
+            if (f->count >= 0) {
+                r->dropped++;
+                r->lost = true;
+                continue;
+            }
+            // The end-of-device marker must get through
+            while (tail - atomic_load_explicit(&ring->head, memory_order_acquire) >= RING_SLOTS) {
+                sched_yield();
+            }
+            ring->slots[tail & (RING_SLOTS - 1)].count = -1;
+        }
+        if (skip) {
+            r->lost = false;
+        }
+        atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+        wake(r->disp);
+
+        if (f->count < 0) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+int dispatcher_init(struct dispatcher *d) {
+    memset(d, 0, sizeof(*d));
+    d->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    d->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (d->wake_fd < 0 || d->stop_fd < 0) {
+        perror("eventfd");
+        if (d->wake_fd >= 0) {
+            close(d->wake_fd);
+        }
+        if (d->stop_fd >= 0) {
+            close(d->stop_fd);
+        }
+        return -1;
+    }
+    atomic_init(&d->sleeping, false);
+    return 0;
+}
+
+int dispatcher_add_reader(struct dispatcher *d, int fd, int source, bool backpressure) {
+    pthread_attr_t attr;
+    struct reader *r;
+    int err;
+
+    if (d->count >= MAX_READERS) {
+        return -1;
+    }
+    r = &d->readers[d->count];
+    r->fd = fd;
+    r->source = source;
+    r->disp = d;
+    r->dropped = 0;
+    r->lost = false;
+    r->backpressure = backpressure;
+    r->room_fd = -1;
+    atomic_init(&r->waiting, false);
+    atomic_init(&r->ring.head, 0);
+    atomic_init(&r->ring.tail, 0);
+    if (backpressure) {
+        r->room_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (r->room_fd < 0) {
+            perror("eventfd");
+            return -1;
+        }
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, READER_STACK_SIZE);
+    err = pthread_create(&r->thread, &attr, reader_main, r);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        fprintf(stderr, "Cannot start reader thread: %s\n", strerror(err));
+        if (r->room_fd >= 0) {
+            close(r->room_fd);
+        }
+        return -1;
+    }
+    r->started = true;
+    d->count++;
+    return 0;
+}
+
+static bool frames_waiting(struct dispatcher *d) {
+    int i;
+
+    for (i = 0; i < d->count; i++) {
+        struct spsc_ring *ring = &d->readers[i].ring;
+
+        if (atomic_load_explicit(&ring->head, memory_order_relaxed) !=
+            atomic_load_explicit(&ring->tail, memory_order_acquire)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool dispatcher_prepare_sleep(struct dispatcher *d) {
+    atomic_store(&d->sleeping, true);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (frames_waiting(d)) {
+        atomic_store(&d->sleeping, false);
+        return false;
+    }
+    return true;
+}
+
+void dispatcher_woken(struct dispatcher *d) {
+    uint64_t count;
+
+    atomic_store(&d->sleeping, false);
+    read(d->wake_fd, &count, sizeof(count));
+}
+
+int dispatcher_drain(struct dispatcher *d, frame_handler handler, void *ctx) {
+    int handled = 0;
+    bool progress = true;
+
+    // One frame per reader per pass, so a chatty device cannot starve the rest
+    while (progress) {
+        int i;
+
+        progress = false;
+        for (i = 0; i < d->count; i++) {
+            struct reader *r = &d->readers[i];
+            unsigned head = atomic_load_explicit(&r->ring.head, memory_order_relaxed);
+
+            if (head == atomic_load_explicit(&r->ring.tail, memory_order_acquire)) {
+                continue;
+            }
+            handler(ctx, r->source, &r->ring.slots[head & (RING_SLOTS - 1)]);
+            atomic_store_explicit(&r->ring.head, head + 1, memory_order_release);
+            if (r->backpressure) {
+                uint64_t one = 1;
+
+                // Pairs with the fence in wait_for_room()
+                atomic_thread_fence(memory_order_seq_cst);
+                if (atomic_exchange(&r->waiting, false)) {
+                    write(r->room_fd, &one, sizeof(one));
+                }
+            }
+            handled++;
+            progress = true;
+        }
+    }
+    return handled;
+}
+
+void dispatcher_stop(struct dispatcher *d) {
+    uint64_t one = 1;
+    int i;
+
+    write(d->stop_fd, &one, sizeof(one));
+    for (i = 0; i < d->count; i++) {
+        if (d->readers[i].started) {
+            pthread_join(d->readers[i].thread, NULL);
+            d->readers[i].started = false;
+        }
+        if (d->readers[i].room_fd >= 0) {
+            close(d->readers[i].room_fd);
+            d->readers[i].room_fd = -1;
+        }
+    }
+    close(d->wake_fd);
+    close(d->stop_fd);
+}
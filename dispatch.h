@@ -0,0 +1,88 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <linux/input.h>
+
+#define CACHE_LINE 64
+#define RING_SLOTS 256    // frames per ring, power of two
+#define FRAME_EVENTS 32   // evdev events per read()
+#define MAX_READERS 8
+#define READER_STACK_SIZE (256 * 1024) // readers need little; keeps mlockall cheap
+
+// One read() worth of evdev events. count < 0 marks a device that went
+// away; it is the reader's last frame. A frame after ones the ring had
+// no room for starts with SYN_DROPPED, as if the kernel buffer overflowed
+// (evdev only: other sources wait for room instead).
+struct frame {
+    int count;
+    struct input_event events[FRAME_EVENTS];
+};
+
+// Single-producer single-consumer ring. head is only written by the
+// consumer and tail only by the producer; each sits on its own cache
+// line so the two threads never share one they write to.
+struct spsc_ring {
+    _Alignas(CACHE_LINE) atomic_uint head;
+    _Alignas(CACHE_LINE) atomic_uint tail;
+    _Alignas(CACHE_LINE) struct frame slots[RING_SLOTS];
+};
+
+struct dispatcher;
+
+// A thread that does nothing but read one evdev node into its ring
+struct reader {
+    pthread_t thread;
+    int fd;
+    int source;         // passed back to the frame handler
+    struct spsc_ring ring;
+    struct dispatcher *disp;
+    uint64_t dropped;   // frames lost to a full ring
+    bool lost;          // the next frame must start with SYN_DROPPED
+    bool started;
+    bool backpressure;  // wait for room rather than drop: the source can wait
+    int room_fd;        // backpressure: eventfd the dispatcher signals on freeing a slot
+    _Alignas(CACHE_LINE) atomic_bool waiting; // backpressure: reader is asleep on room_fd
+};
+
+// Called on the dispatcher thread for every frame, in order per source. The
+// frame belongs to the handler until it returns and may be rewritten.
+typedef void (*frame_handler)(void *ctx, int source, struct frame *frame);
+
+// Owns the consumer side of every ring. Readers wake it through wake_fd
+// (an eventfd) only while it is about to sleep, so a busy dispatcher
+// costs the readers no extra syscalls.
+struct dispatcher {
+    struct reader readers[MAX_READERS];
+    int count;
+    int wake_fd;
+    int stop_fd;           // eventfd the readers poll to learn about shutdown
+    _Alignas(CACHE_LINE) atomic_bool sleeping;
+};
+
+int dispatcher_init(struct dispatcher *d);
+
+// Start a reader thread on fd. A device must be read as fast as it
+// reports, so with its ring full frames are dropped; a source that can
+// wait (a pipe) gets backpressure instead: the reader stops reading until
+// the dispatcher frees a slot and nothing is lost. Returns 0 or -1.
+int dispatcher_add_reader(struct dispatcher *d, int fd, int source, bool backpressure);
+
+// Before polling wake_fd: returns false if frames are already waiting,
+// in which case the caller should not sleep
+bool dispatcher_prepare_sleep(struct dispatcher *d);
+
+// After polling wake_fd, whether or not it fired
+void dispatcher_woken(struct dispatcher *d);
+
+// Hand every waiting frame to handler, round-robin across readers.
+// Returns the number of frames handled.
+int dispatcher_drain(struct dispatcher *d, frame_handler handler, void *ctx);
+
+// Stop and join the readers and close the eventfds; the device fds stay open
+void dispatcher_stop(struct dispatcher *d);
+
+#endif
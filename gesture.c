@@ -0,0 +1,461 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "config.h"
+#include "gesture.h"
+#include "output.h"
+
+#define WHEEL_HI_RES_DETENT 120 // REL_WHEEL_HI_RES units per notch
+#define MM_PER_INCH 25.4
+
+static void tap_timeout(struct timer *t, void *ctx) {
+    struct gesture_engine *eng = ctx;
+
+    eng->tap_expired |= 1u << (t - eng->tap_timer);
+}
+
+int gesture_engine_init(struct gesture_engine *eng, struct output_sink *out,
+                        const struct gesture_binding *bindings, int count) {
+    int i;
+
+    memset(eng, 0, sizeof(*eng));
+    memset(eng->slot_of, -1, sizeof(eng->slot_of));
+    eng->out = out;
+    gesture_params_default(&eng->params);
+    gesture_engine_set_dpi(eng, DEFAULT_DPI);
+    for (i = 0; i < MAX_GESTURE_BUTTONS; i++) {
+        timer_init(&eng->tap_timer[i], tap_timeout, eng);
+    }
+
+    for (i = 0; i < count && eng->count < MAX_GESTURE_BUTTONS; i++) {
+        int button = bindings[i].button;
+
+        if (bindings[i].mode == GESTURE_NONE || button < 0 || button >= KEY_CNT) {
+            continue;
+        }
+        if (eng->slot_of[button] >= 0) {
+            continue; // first binding for a button wins
+        }
+        eng->slot_of[button] = eng->count;
+        eng->mode[eng->count] = bindings[i].mode;
+        eng->binding[eng->count] = &bindings[i];
+        eng->count++;
+    }
+
+    return eng->count;
+}
+
+static int32_t mm_to_counts(double mm, int dpi) {
+    int32_t counts = (int32_t)(mm * dpi / MM_PER_INCH + 0.5);
+    return counts > 0 ? counts : 1;
+}
+
+void gesture_engine_set_dpi(struct gesture_engine *eng, int dpi) {
+    if (dpi <= 0) {
+        return;
+    }
+    eng->dpi = dpi;
+    eng->arm_counts = mm_to_counts(eng->params.arm_mm, dpi);
+    eng->cancel_counts = mm_to_counts(eng->params.cancel_mm, dpi);
+    eng->step_counts = mm_to_counts(SWITCHER_STEP_MM, dpi);
+    if (eng->cancel_counts > eng->arm_counts) {
+        eng->cancel_counts = eng->arm_counts;
+    }
+}
+
+void gesture_params_default(struct gesture_params *params) {
+    params->tap_timeout_ms = TAP_TIMEOUT_MS;
+    params->arm_mm = MOTION_ARM_MM;
+    params->cancel_mm = MOTION_CANCEL_MM;
+    params->dir_margin_pct = DIR_MARGIN_PCT;
+}
+
+void gesture_engine_set_params(struct gesture_engine *eng, const struct gesture_params *params) {
+    eng->params = *params;
+    gesture_engine_set_dpi(eng, eng->dpi);
+}
+
+void gesture_engine_set_dpi_handler(struct gesture_engine *eng,
+                                    gesture_dpi_handler handler, void *ctx) {
+    eng->dpi_handler = handler;
+    eng->dpi_ctx = ctx;
+}
+
+void gesture_engine_set_press_handler(struct gesture_engine *eng,
+                                      gesture_press_handler handler, void *ctx) {
+    eng->press_handler = handler;
+    eng->press_ctx = ctx;
+}
+
+void gesture_engine_set_timers(struct gesture_engine *eng, struct timer_wheel *timers) {
+    eng->timers = timers;
+}
+
+void gesture_engine_set_thumbwheel(struct gesture_engine *eng,
+                                   const struct thumbwheel_binding *thumb) {
+    eng->thumb = thumb;
+    eng->hwheel = 0;
+    eng->hwheel_steps = 0;
+}
+
+static void press(struct gesture_engine *eng, int slot, const struct input_event *ev) {
+    uint32_t bit = 1u << slot;
+
+    eng->held |= bit;
+    eng->moved_x &= ~bit;
+    eng->moved_y &= ~bit;
+    eng->chorded &= ~bit;
+    eng->tap_expired &= ~bit;
+    eng->dx[slot] = 0;
+    eng->dy[slot] = 0;
+    eng->wheel[slot] = 0;
+    eng->peak[slot] = 0;
+    eng->press_time[slot] = ev->time;
+    if (eng->timers) {
+        timer_add(eng->timers, &eng->tap_timer[slot], eng->params.tap_timeout_ms);
+    }
+
+    if (eng->mode[slot] == GESTURE_SWITCHER) {
+        // Hold Alt for the whole session; the first Tab opens the switcher
+        send_key_frame(eng->out, KEY_LEFTALT, 1);
+        tap_key(eng->out, KEY_TAB);
+    } else if (eng->mode[slot] == GESTURE_SNIPER && eng->dpi_handler) {
+        eng->dpi_handler(eng->dpi_ctx, eng->binding[slot]->dpi);
+    }
+}
+
+// Held past the tap timeout. At release this is measured between the
+// two events' timestamps, so neither loop latency nor replay speed moves
+// the line, and it holds with or without a wheel. While still held, the
+// tap timer is the best guess; an engine without a wheel has none, so
+// until the release a held button still counts as a tap.
+static bool held_too_long(const struct gesture_engine *eng, int slot,
+                          const struct input_event *release_ev) {
+    struct timeval held;
+
+    if (!release_ev) {
+        return eng->tap_expired & (1u << slot);
+    }
+    timersub(&release_ev->time, &eng->press_time[slot], &held);
+    return held.tv_sec * 1000000LL + held.tv_usec > eng->params.tap_timeout_ms * 1000LL;
+}
+
+// release_ev is the release being classified, or NULL while still held
+static enum gesture_dir classify(const struct gesture_engine *eng, int slot,
+                                 const struct input_event *release_ev) {
+    int x = eng->dx[slot];
+    int y = eng->dy[slot];
+    int lead = 100 + eng->params.dir_margin_pct;
+
+    if (!((eng->moved_x | eng->moved_y) & (1u << slot))) {
+        // No motion detected - a tap unless held too long
+        return held_too_long(eng, slot, release_ev) ? DIR_COUNT : DIR_TAP;
+    }
+    if ((int64_t)abs(x) * 100 > (int64_t)abs(y) * lead) {
+        return x > 0 ? DIR_RIGHT : DIR_LEFT;
+    }
+    if ((int64_t)abs(y) * 100 >= (int64_t)abs(x) * lead) {
+        return y > 0 ? DIR_DOWN : DIR_UP;
+    }
+    return DIR_COUNT; // too diagonal to call either way
+}
+
+static void report_press(struct gesture_engine *eng, int slot, enum gesture_dir dir,
+                         const struct input_event *ev) {
+    struct gesture_press p = {
+        .button = eng->binding[slot]->button,
+        .dir = dir,
+    };
+    struct timeval held;
+
+    timersub(&ev->time, &eng->press_time[slot], &held);
+    p.hold_ms = (int)(held.tv_sec * 1000 + held.tv_usec / 1000);
+    p.peak_mm = eng->peak[slot] * MM_PER_INCH / eng->dpi;
+    eng->press_handler(eng->press_ctx, &p);
+}
+
+static void release(struct gesture_engine *eng, int slot, const struct input_event *ev) {
+    uint32_t bit = 1u << slot;
+
+    if (!(eng->held & bit)) {
+        return;
+    }
+
+    if (eng->mode[slot] == GESTURE_SWITCHER) {
+        // Releasing Alt commits the selected window
+        send_key_frame(eng->out, KEY_LEFTALT, 0);
+    } else if (eng->mode[slot] == GESTURE_SNIPER) {
+        if (eng->dpi_handler) {
+            eng->dpi_handler(eng->dpi_ctx, 0);
+        }
+    } else if (eng->chorded & bit) {
+        // The press was used for a wheel chord, not a tap or swipe
+    } else {
+        // Apply actions ONLY on release, based on accumulated motion
+        enum gesture_dir dir = classify(eng, slot, ev);
+
+        if (dir != DIR_COUNT) {
+            const struct key_chord *chord = &eng->binding[slot]->action[dir];
+            if (chord->count > 0) {
+                send_keys(eng->out, chord->keys, chord->count);
+            }
+        }
+        if (eng->press_handler) {
+            report_press(eng, slot, dir, ev);
+        }
+    }
+
+    // Reset for next gesture
+    timer_cancel(&eng->tap_timer[slot]);
+    eng->held &= ~bit;
+    eng->moved_x &= ~bit;
+    eng->moved_y &= ~bit;
+    eng->chorded &= ~bit;
+    eng->tap_expired &= ~bit;
+    eng->dx[slot] = 0;
+    eng->dy[slot] = 0;
+    eng->wheel[slot] = 0;
+}
+
+static void switcher_step(struct gesture_engine *eng, int slot) {
+    // One navigation key per full step of horizontal travel; the remainder
+    // carries over so slow drags still step evenly
+    while (eng->dx[slot] >= eng->step_counts) {
+        tap_key(eng->out, KEY_RIGHT);
+        eng->dx[slot] -= eng->step_counts;
+    }
+    while (eng->dx[slot] <= -eng->step_counts) {
+        tap_key(eng->out, KEY_LEFT);
+        eng->dx[slot] += eng->step_counts;
+    }
+}
+
+// Schmitt trigger on one axis: arm above arm_counts, disarm only once the
+// travel drops back below cancel_counts, so jitter around a single
+// threshold cannot toggle the outcome. Also keeps the press's farthest
+// excursion for the press handler.
+static void update_armed(struct gesture_engine *eng, int slot, uint32_t *armed, int32_t d) {
+    uint32_t bit = 1u << slot;
+    int32_t mag = abs(d);
+
+    if (mag > eng->peak[slot]) {
+        eng->peak[slot] = mag;
+    }
+    if (*armed & bit) {
+        if (mag < eng->cancel_counts) {
+            *armed &= ~bit;
+        }
+    } else if (mag > eng->arm_counts) {
+        *armed |= bit;
+    }
+}
+
+static void motion(struct gesture_engine *eng, const struct input_event *ev) {
+    uint32_t pending = eng->held;
+
+    // Overlapping holds each see the same motion
+    while (pending) {
+        int slot = __builtin_ctz(pending);
+        pending &= pending - 1;
+
+        if (eng->mode[slot] == GESTURE_SNIPER) {
+            continue;
+        }
+        if (ev->code == REL_X) {
+            eng->dx[slot] += ev->value;
+            if (eng->mode[slot] == GESTURE_SWITCHER) {
+                switcher_step(eng, slot);
+            } else {
+                update_armed(eng, slot, &eng->moved_x, eng->dx[slot]);
+            }
+        } else {
+            eng->dy[slot] += ev->value;
+            update_armed(eng, slot, &eng->moved_y, eng->dy[slot]);
+        }
+    }
+}
+
+// The most recently pressed held button with a wheel binding owns the chord
+static int wheel_slot(struct gesture_engine *eng) {
+    uint32_t pending = eng->held;
+    int best = -1;
+
+    while (pending) {
+        int slot = __builtin_ctz(pending);
+        const struct gesture_binding *b = eng->binding[slot];
+        pending &= pending - 1;
+
+        if (b->wheel_up.count == 0 && b->wheel_down.count == 0) {
+            continue;
+        }
+        if (best < 0 || timercmp(&eng->press_time[slot], &eng->press_time[best], >=)) {
+            best = slot;
+        }
+    }
+    return best;
+}
+
+static void wheel(struct gesture_engine *eng, const struct input_event *ev) {
+    int units;
+    int slot;
+
+    if (ev->code == REL_WHEEL_HI_RES) {
+        eng->wheel_hires = true;
+        units = ev->value;
+    } else if (eng->wheel_hires) {
+        return; // already counted through the hi-res event of this frame
+    } else {
+        units = ev->value * WHEEL_HI_RES_DETENT;
+    }
+
+    slot = wheel_slot(eng);
+    if (slot < 0) {
+        return;
+    }
+
+    const struct gesture_binding *b = eng->binding[slot];
+    eng->wheel[slot] += units;
+    eng->chorded |= 1u << slot;
+
+    while (eng->wheel[slot] >= WHEEL_HI_RES_DETENT) {
+        if (b->wheel_up.count > 0) {
+            tap_keys(eng->out, b->wheel_up.keys, b->wheel_up.count);
+        }
+        eng->wheel[slot] -= WHEEL_HI_RES_DETENT;
+    }
+    while (eng->wheel[slot] <= -WHEEL_HI_RES_DETENT) {
+        if (b->wheel_down.count > 0) {
+            tap_keys(eng->out, b->wheel_down.keys, b->wheel_down.count);
+        }
+        eng->wheel[slot] += WHEEL_HI_RES_DETENT;
+    }
+}
+
+static void thumbwheel(struct gesture_engine *eng, const struct input_event *ev) {
+    if (ev->code == REL_HWHEEL_HI_RES) {
+        eng->hwheel_hires = true;
+        eng->hwheel += ev->value;
+    } else if (!eng->hwheel_hires) {
+        eng->hwheel += ev->value * WHEEL_HI_RES_DETENT;
+    }
+
+    // Only count steps here; actions are emitted once per frame
+    eng->hwheel_steps += eng->hwheel / THUMBWHEEL_STEP_HI_RES;
+    eng->hwheel %= THUMBWHEEL_STEP_HI_RES;
+}
+
+// A fast flick can deliver dozens of steps per frame. Emit at most
+// THUMBWHEEL_MAX_PER_FRAME actions and drop the rest, so injected chords
+// never pile up behind the spin.
+static void thumbwheel_flush(struct gesture_engine *eng) {
+    const struct key_chord *chord;
+    int n = eng->hwheel_steps;
+
+    eng->hwheel_steps = 0;
+    if (n == 0) {
+        return;
+    }
+
+    chord = n > 0 ? &eng->thumb->right : &eng->thumb->left;
+    n = abs(n);
+    if (n > THUMBWHEEL_MAX_PER_FRAME) {
+        n = THUMBWHEEL_MAX_PER_FRAME;
+    }
+    if (chord->count == 0) {
+        return;
+    }
+    while (n-- > 0) {
+        tap_keys(eng->out, chord->keys, chord->count);
+    }
+}
+
+void gesture_engine_event(struct gesture_engine *eng, const struct input_event *ev) {
+    if (ev->type == EV_KEY) {
+        int slot;
+
+        if (ev->code == BTN_TOUCH && ev->value == 0) {
+            // Finger left the thumb wheel (HID++ only): drop the partial
+            // step so it cannot combine with the next, unrelated spin
+            eng->hwheel = 0;
+            return;
+        }
+        if (ev->code >= KEY_CNT) {
+            return;
+        }
+        slot = eng->slot_of[ev->code];
+        if (slot < 0) {
+            return;
+        }
+        if (ev->value == 1) {
+            press(eng, slot, ev);
+        } else if (ev->value == 0) {
+            release(eng, slot, ev);
+        }
+    } else if (ev->type == EV_REL && eng->thumb &&
+               (ev->code == REL_HWHEEL || ev->code == REL_HWHEEL_HI_RES)) {
+        thumbwheel(eng, ev);
+    } else if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+        if (eng->hwheel_steps) {
+            thumbwheel_flush(eng);
+        }
+    } else if (ev->type == EV_REL && eng->held) {
+        if (ev->code == REL_X || ev->code == REL_Y) {
+            motion(eng, ev);
+        } else if (ev->code == REL_WHEEL || ev->code == REL_WHEEL_HI_RES) {
+            wheel(eng, ev);
+        }
+    }
+}
+
+enum gesture_dir gesture_engine_pending(const struct gesture_engine *eng, int button) {
+    int slot = button >= 0 && button < KEY_CNT ? eng->slot_of[button] : -1;
+
+    if (slot < 0 || !(eng->held & (1u << slot)) || (eng->chorded & (1u << slot)) ||
+        eng->mode[slot] != GESTURE_SWIPE) {
+        return DIR_COUNT;
+    }
+    return classify(eng, slot, NULL);
+}
+
+// End a hold without classifying it, undoing whatever the press started
+static void cancel(struct gesture_engine *eng, int slot) {
+    uint32_t bit = 1u << slot;
+
+    if (eng->mode[slot] == GESTURE_SWITCHER) {
+        send_key_frame(eng->out, KEY_LEFTALT, 0);
+    } else if (eng->mode[slot] == GESTURE_SNIPER && eng->dpi_handler) {
+        eng->dpi_handler(eng->dpi_ctx, 0);
+    }
+    timer_cancel(&eng->tap_timer[slot]);
+    eng->held &= ~bit;
+    eng->moved_x &= ~bit;
+    eng->moved_y &= ~bit;
+    eng->chorded &= ~bit;
+    eng->tap_expired &= ~bit;
+}
+
+void gesture_engine_release_all(struct gesture_engine *eng) {
+    while (eng->held) {
+        cancel(eng, __builtin_ctz(eng->held));
+    }
+}
+
+void gesture_engine_resync(struct gesture_engine *eng, const unsigned long *keys) {
+    uint32_t pending = eng->held;
+
+    while (pending) {
+        int slot = __builtin_ctz(pending);
+        int button = eng->binding[slot]->button;
+        bool down = keys[button / KEY_BITS_LONG] >> (button % KEY_BITS_LONG) & 1;
+        pending &= pending - 1;
+
+        if (!down || eng->mode[slot] == GESTURE_SWIPE) {
+            cancel(eng, slot);
+        }
+    }
+
+    // Partial thumb wheel travel may belong to a frame that was lost
+    eng->hwheel = 0;
+    eng->hwheel_steps = 0;
+}
@@ -0,0 +1,170 @@
+#ifndef GESTURE_H
+#define GESTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/input.h>
+
+#include "timer.h"
+
+struct output_sink;
+
+#define MAX_GESTURE_BUTTONS 8
+#define MAX_CHORD_KEYS 4
+#define KEY_BITS_LONG (8 * sizeof(unsigned long))
+#define KEY_LONGS ((KEY_CNT + KEY_BITS_LONG - 1) / KEY_BITS_LONG) // EVIOCGKEY bitmap size
+
+// What a gesture button does while held
+enum gesture_mode {
+    GESTURE_NONE,     // not a gesture button
+    GESTURE_SWIPE,    // classify tap/swipe on release
+    GESTURE_SWITCHER, // hold Alt, step through windows with horizontal travel
+    GESTURE_SNIPER,   // drop the sensor to binding->dpi while held
+};
+
+// Outcome of a swipe-mode press, used to index the binding's actions
+enum gesture_dir {
+    DIR_TAP,
+    DIR_LEFT,
+    DIR_RIGHT,
+    DIR_UP,
+    DIR_DOWN,
+    DIR_COUNT
+};
+
+// Thresholds the engine classifies with; config.h holds the defaults
+struct gesture_params {
+    int tap_timeout_ms; // longest motionless press that still counts as a tap
+    double arm_mm;      // travel that turns a press into a swipe
+    double cancel_mm;   // falling back below this turns it into a tap again
+    int dir_margin_pct; // how far the dominant axis must lead, else the swipe is dropped
+};
+
+struct key_chord {
+    int keys[MAX_CHORD_KEYS];
+    int count;
+};
+
+struct gesture_binding {
+    int button;                        // BTN_* code from the mouse
+    enum gesture_mode mode;
+    struct key_chord action[DIR_COUNT]; // swipe mode only
+    struct key_chord wheel_up;          // per detent scrolled while held
+    struct key_chord wheel_down;
+    int dpi;                            // sniper mode only
+};
+
+// Called when a sniper-mode button goes down (dpi > 0) or up (dpi == 0,
+// restore the normal resolution). Must not block.
+typedef void (*gesture_dpi_handler)(void *ctx, int dpi);
+
+// A swipe-mode press that ended in a release (not a wheel chord, not
+// cancelled), for learning how this user taps
+struct gesture_press {
+    int button;
+    enum gesture_dir dir; // what it sent, DIR_COUNT for nothing
+    int hold_ms;
+    double peak_mm;       // farthest the pointer strayed on either axis
+};
+
+// Called after the press's keys were sent. Must not block.
+typedef void (*gesture_press_handler)(void *ctx, const struct gesture_press *press);
+
+// Thumb wheel (REL_HWHEEL) remapping, independent of any held button
+struct thumbwheel_binding {
+    struct key_chord left;  // per THUMBWHEEL_STEP_HI_RES toward negative REL_HWHEEL
+    struct key_chord right;
+};
+
+// Per-button state kept as parallel arrays indexed by slot, so the fields
+// touched on every motion event stay packed together. slot_of maps an
+// EV_KEY code straight to its slot (or -1) for O(1) dispatch.
+struct gesture_engine {
+    struct output_sink *out; // where injected keys go
+    int count;
+    uint32_t held;   // bit per slot: button currently down
+    uint32_t moved_x; // bit per slot: horizontal travel armed (hysteresis)
+    uint32_t moved_y; // bit per slot: vertical travel armed
+    uint32_t chorded; // bit per slot: wheel chord fired, skip tap/swipe
+    uint32_t tap_expired; // bit per slot: tap timer fired, for pending(); never set without a wheel
+    bool wheel_hires; // device reports REL_WHEEL_HI_RES, ignore REL_WHEEL
+    int32_t dx[MAX_GESTURE_BUTTONS];
+    int32_t dy[MAX_GESTURE_BUTTONS];
+    int32_t wheel[MAX_GESTURE_BUTTONS]; // hi-res units toward the next detent
+    int32_t peak[MAX_GESTURE_BUTTONS];  // largest |dx| or |dy| this press
+    struct timeval press_time[MAX_GESTURE_BUTTONS];
+    struct timer tap_timer[MAX_GESTURE_BUTTONS];
+    uint8_t mode[MAX_GESTURE_BUTTONS];
+    const struct gesture_binding *binding[MAX_GESTURE_BUTTONS];
+    int8_t slot_of[KEY_CNT];
+
+    struct gesture_params params;
+
+    // Physical thresholds converted to sensor counts for the current DPI
+    int dpi;
+    int32_t arm_counts;
+    int32_t cancel_counts;
+    int32_t step_counts;
+
+    gesture_dpi_handler dpi_handler;
+    void *dpi_ctx;
+    gesture_press_handler press_handler;
+    void *press_ctx;
+
+    struct timer_wheel *timers; // NULL: every motionless press is a tap
+
+    const struct thumbwheel_binding *thumb; // NULL leaves the thumb wheel alone
+    bool hwheel_hires; // device reports REL_HWHEEL_HI_RES, ignore REL_HWHEEL
+    int32_t hwheel;    // hi-res units toward the next thumb wheel step
+    int32_t hwheel_steps; // whole steps seen in the current frame
+};
+
+// Bindings with GESTURE_NONE are skipped. Returns the number of active slots.
+int gesture_engine_init(struct gesture_engine *eng, struct output_sink *out,
+                        const struct gesture_binding *bindings, int count);
+
+// Rescale the millimetre thresholds to a new sensor resolution
+void gesture_engine_set_dpi(struct gesture_engine *eng, int dpi);
+
+// The config.h thresholds
+void gesture_params_default(struct gesture_params *params);
+
+// Classify with other thresholds from the next release on (the tap timer
+// of a press already held keeps its deadline)
+void gesture_engine_set_params(struct gesture_engine *eng, const struct gesture_params *params);
+
+// Route sniper-mode presses to whatever can change the sensor resolution
+void gesture_engine_set_dpi_handler(struct gesture_engine *eng,
+                                    gesture_dpi_handler handler, void *ctx);
+
+// Report every finished swipe-mode press to handler
+void gesture_engine_set_press_handler(struct gesture_engine *eng,
+                                      gesture_press_handler handler, void *ctx);
+
+// Time tap presses on the wheel. Without one a release still goes by the
+// press and release timestamps, but a button held past the timeout is not
+// reported as such until it is released.
+void gesture_engine_set_timers(struct gesture_engine *eng, struct timer_wheel *timers);
+
+// Remap the thumb wheel; pass NULL to disable
+void gesture_engine_set_thumbwheel(struct gesture_engine *eng,
+                                   const struct thumbwheel_binding *thumb);
+
+// Feed one evdev event from the mouse
+void gesture_engine_event(struct gesture_engine *eng, const struct input_event *ev);
+
+// What releasing button now would send: a direction, or DIR_COUNT for
+// nothing (not held, used for a chord, not a swipe button, held too long
+// or too diagonal)
+enum gesture_dir gesture_engine_pending(const struct gesture_engine *eng, int button);
+
+// Drop all held gestures, releasing any modifier still held down
+void gesture_engine_release_all(struct gesture_engine *eng);
+
+// After events were lost (SYN_DROPPED), bring held buttons in line with
+// keys, an EVIOCGKEY bitmap of KEY_LONGS longs. Holds whose button is up
+// are cancelled without firing; so are swipes still down, whose motion
+// can no longer be trusted. Switcher and sniper holds carry on.
+void gesture_engine_resync(struct gesture_engine *eng, const unsigned long *keys);
+
+#endif
@@ -0,0 +1,218 @@
+// Golden-trace regression suite: replay recorded gestures through the
+// engine and compare the key frames it emits with the ones each trace
+// expects (trace.h has the format). Time is the trace's own: a manual
+// timer wheel is advanced to each frame's timestamp before the frame is
+// fed, so TAP_TIMEOUT_MS behaves exactly as recorded however fast the
+// suite runs. At the end every hold still down is dropped as on shutdown.
+// Traces are shared out to one worker per core, each with an engine,
+// wheel and memory sink of its own.
+//
+// ./golden [-j JOBS] [-w] TRACE...
+//   -w  write the emitted frames back as the expectation (re-record)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <linux/input.h>
+
+#include "bindings.h"
+#include "gesture.h"
+#include "sink.h"
+#include "timer.h"
+#include "trace.h"
+
+#define MAX_WORKERS 64
+
+struct worker {
+    pthread_t thread;
+    struct gesture_binding bindings[DEFAULT_BINDING_COUNT];
+    struct gesture_engine engine;
+    struct timer_wheel timers;
+    struct output_sink sink;
+    struct input_event events[SINK_RING_EVENTS];
+};
+
+static struct worker workers[MAX_WORKERS];
+static char **traces;
+static int trace_count;
+static int next_trace;
+static int failed;
+static bool rewrite;
+
+// Everything but the expectation, then the frames just emitted
+static int rewrite_trace(const char *path, const char *inputs, const char *actual) {
+    char tmp[4096];
+    FILE *f;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    f = fopen(tmp, "w");
+    if (!f) {
+        perror(tmp);
+        return -1;
+    }
+    fputs(inputs, f);
+    fputs(actual, f);
+    if (fclose(f) != 0 || rename(tmp, path) < 0) {
+        perror(path);
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// First line where the two texts part, for the report
+static void report_diff(const char *path, const char *expected, const char *actual) {
+    const char *e = expected, *a = actual;
+    int line = 1;
+    size_t i;
+
+    for (i = 0; expected[i] && expected[i] == actual[i]; i++) {
+        if (expected[i] == '\n') {
+            e = &expected[i + 1];
+            a = &actual[i + 1];
+            line++;
+        }
+    }
+    if (!*e) {
+        e = "(end)";
+    }
+    if (!*a) {
+        a = "(end)";
+    }
+    fprintf(stderr, "FAIL %s: output frame %d\n  expected: %.*s\n  emitted:  %.*s\n", path, line,
+            (int)strcspn(e, "\n"), e, (int)strcspn(a, "\n"), a);
+}
+
+// Returns 0 on a match (or rewrite), 1 on a mismatch, -1 if unreadable
+static int run_trace(struct worker *w, const char *path) {
+    struct trace t;
+    char *expected = NULL, *actual = NULL;
+    size_t expected_len, actual_len;
+    FILE *exp_f, *act_f;
+    long now = -1;
+    int result = 0;
+    int i, n;
+
+    if (trace_load(&t, path) < 0) {
+        return -1;
+    }
+    memcpy(w->bindings, default_bindings, sizeof(w->bindings));
+    if (t.switcher) {
+        w->bindings[0].mode = GESTURE_SWITCHER;
+    }
+    if (sink_open(&w->sink, "memory") < 0) {
+        trace_free(&t);
+        return -1;
+    }
+    timer_wheel_init_manual(&w->timers);
+    gesture_engine_init(&w->engine, &w->sink, w->bindings, DEFAULT_BINDING_COUNT);
+    gesture_engine_set_timers(&w->engine, &w->timers);
+    if (t.dpi > 0) {
+        gesture_engine_set_dpi(&w->engine, t.dpi);
+    }
+    if (t.thumbwheel) {
+        gesture_engine_set_thumbwheel(&w->engine, &thumbwheel_tabs);
+    }
+
+    for (i = 0; i < t.event_count; i++) {
+        if (trace_ms(&t.events[i]) != now) {
+            now = trace_ms(&t.events[i]);
+            timer_wheel_advance(&w->timers, now);
+        }
+        gesture_engine_event(&w->engine, &t.events[i]);
+    }
+    gesture_engine_release_all(&w->engine);
+
+    if (w->sink.ring_head > SINK_RING_EVENTS) {
+        fprintf(stderr, "%s: more than %d events emitted\n", path, SINK_RING_EVENTS);
+        result = -1;
+    } else {
+        exp_f = open_memstream(&expected, &expected_len);
+        act_f = open_memstream(&actual, &actual_len);
+        n = sink_memory_events(&w->sink, w->events, SINK_RING_EVENTS);
+        trace_print_frames(exp_f, t.expected, t.expected_count);
+        trace_print_frames(act_f, w->events, n);
+        fclose(exp_f);
+        fclose(act_f);
+
+        if (rewrite) {
+            result = rewrite_trace(path, t.text, actual);
+        } else if (strcmp(expected, actual) != 0) {
+            report_diff(path, expected, actual);
+            result = 1;
+        }
+    }
+    sink_close(&w->sink);
+    timer_wheel_destroy(&w->timers);
+    trace_free(&t);
+    free(expected);
+    free(actual);
+    return result;
+}
+
+static void *work(void *arg) {
+    struct worker *w = arg;
+    int i;
+
+    while ((i = __atomic_fetch_add(&next_trace, 1, __ATOMIC_RELAXED)) < trace_count) {
+        if (run_trace(w, traces[i]) != 0) {
+            __atomic_fetch_add(&failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    struct timespec start, end;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "j:wh")) != -1) {
+        switch (opt) {
+        case 'j':
+            jobs = atol(optarg);
+            break;
+        case 'w':
+            rewrite = true;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-j JOBS] [-w] TRACE...\n", argv[0]);
+            fprintf(stderr, "  -j  worker threads (default: one per core)\n");
+            fprintf(stderr, "  -w  record the emitted frames as each trace's expectation\n");
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    traces = argv + optind;
+    trace_count = argc - optind;
+    if (trace_count == 0) {
+        fprintf(stderr, "No traces given\n");
+        return 1;
+    }
+    if (jobs < 1) {
+        jobs = 1;
+    }
+    if (jobs > MAX_WORKERS) {
+        jobs = MAX_WORKERS;
+    }
+    if (jobs > trace_count) {
+        jobs = trace_count;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < jobs; i++) {
+        if (pthread_create(&workers[i].thread, NULL, work, &workers[i]) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    for (i = 0; i < jobs; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("%d traces, %d failed, %ld jobs, %.3f s\n", trace_count, failed, jobs,
+           (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    return failed ? 1 : 0;
+}
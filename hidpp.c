@@ -0,0 +1,849 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+
+#include "hidpp.h"
+
+#define LOGITECH_VENDOR_ID 0x046d
+#define MAX_PATH_LEN 512
+
+// REPROG_CONTROLS_V4
+#define REPROG_FN_SET_CID_REPORTING 3
+#define REPROG_EVENT_DIVERTED_BUTTONS 0
+#define REPROG_EVENT_RAW_XY 1
+#define REPROG_FLAG_DIVERT 0x01
+#define REPROG_FLAG_DIVERT_VALID 0x02
+#define REPROG_FLAG_RAW_XY 0x10
+#define REPROG_FLAG_RAW_XY_VALID 0x20
+
+// ADJUSTABLE_DPI
+#define DPI_FN_GET_SENSOR_DPI 2
+#define DPI_FN_SET_SENSOR_DPI 3
+
+// THUMBWHEEL
+#define THUMB_FN_GET_INFO 0
+#define THUMB_FN_SET_REPORTING 2
+#define THUMB_EVENT_STATUS 0
+#define THUMB_FLAG_TOUCH 0x01
+#define THUMB_FLAG_PROXIMITY 0x02
+
+// SMART_SHIFT
+#define SMARTSHIFT_FN_SET_RATCHET_CONTROL 1
+#define SMARTSHIFT_MODE_RATCHET 2
+
+#define HI_RES_PER_NOTCH 120 // evdev REL_*_HI_RES convention
+
+// IRoot
+#define ROOT_FN_GET_FEATURE 0
+#define ROOT_FN_GET_PROTOCOL_VERSION 1
+#define ROOT_PING_DATA 0x5A
+
+// Walk the short items of a report descriptor looking for a vendor usage
+// page (0xFF00) that declares the HID++ long report id.
+static bool descriptor_has_hidpp(const uint8_t *desc, int size) {
+    unsigned usage_page = 0;
+    int i = 0;
+
+    while (i < size) {
+        uint8_t prefix = desc[i];
+        int len = prefix & 0x03;
+        unsigned value = 0;
+        int j;
+
+        if (prefix == 0xFE) {  // long item: skip it whole
+            if (i + 1 >= size) {
+                break;
+            }
+            i += 3 + desc[i + 1];
+            continue;
+        }
+        if (len == 3) {
+            len = 4;
+        }
+        for (j = 0; j < len && i + 1 + j < size; j++) {
+            value |= (unsigned)desc[i + 1 + j] << (8 * j);
+        }
+
+        switch (prefix & 0xFC) {
+        case 0x04:  // Usage Page
+            usage_page = value;
+            break;
+        case 0x84:  // Report ID
+            if (usage_page == 0xFF00 && value == HIDPP_LONG_REPORT) {
+                return true;
+            }
+            break;
+        }
+        i += 1 + len;
+    }
+    return false;
+}
+
+int hidpp_open(void) {
+    DIR *dir;
+    struct dirent *entry;
+    char device_path[MAX_PATH_LEN];
+    int fd = -1;
+
+    dir = opendir("/dev");
+    if (!dir) {
+        perror("Cannot open /dev");
+        return -1;
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        struct hidraw_devinfo info;
+        struct hidraw_report_descriptor desc;
+        int desc_size = 0;
+
+        if (strncmp(entry->d_name, "hidraw", 6) != 0) {
+            continue;
+        }
+        snprintf(device_path, sizeof(device_path), "/dev/%s", entry->d_name);
+        fd = open(device_path, O_RDWR | O_NONBLOCK);
+        if (fd < 0) {
+            continue;
+        }
+
+        if (ioctl(fd, HIDIOCGRAWINFO, &info) >= 0 &&
+            (info.vendor & 0xFFFF) == LOGITECH_VENDOR_ID &&
+            ioctl(fd, HIDIOCGRDESCSIZE, &desc_size) >= 0) {
+            desc.size = desc_size;
+            if (ioctl(fd, HIDIOCGRDESC, &desc) >= 0 &&
+                descriptor_has_hidpp(desc.value, desc.size)) {
+                printf("Found HID++ interface: %s\n", device_path);
+                break;
+            }
+        }
+
+        close(fd);
+        fd = -1;
+    }
+
+    closedir(dir);
+    return fd;
+}
+
+static int transmit(struct hidpp_device *dev, int sw_id) {
+    struct hidpp_inflight *req = &dev->inflight[sw_id];
+
+    if (write(dev->fd, req->report, req->len) != req->len) {
+        perror("HID++ write");
+        return -1;
+    }
+    timer_add(dev->timers, &dev->req_timer[sw_id], HIDPP_TIMEOUT_MS);
+    return 0;
+}
+
+static void complete(struct hidpp_device *dev, int sw_id, int status,
+                     const struct hidpp_report *reply);
+
+// No answer in time: resend, or fail the request after the last retry
+static void request_timeout(struct timer *t, void *ctx) {
+    struct hidpp_device *dev = ctx;
+    int id = t - dev->req_timer;
+    struct hidpp_inflight *req = &dev->inflight[id];
+
+    if (req->state != HIDPP_REQ_SENT) {
+        return;
+    }
+    if (req->retries > 0) {
+        req->retries--;
+        if (transmit(dev, id) == 0) {
+            return;
+        }
+    }
+    complete(dev, id, -1, NULL);
+}
+
+// Put queued requests on the wire, oldest first, up to HIDPP_WINDOW
+static void pump(struct hidpp_device *dev) {
+    while (dev->sent_count < HIDPP_WINDOW) {
+        int best = 0;
+        int id;
+
+        for (id = 1; id <= HIDPP_MAX_INFLIGHT; id++) {
+            if (dev->inflight[id].state == HIDPP_REQ_QUEUED &&
+                (best == 0 || (int32_t)(dev->inflight[id].seq - dev->inflight[best].seq) < 0)) {
+                best = id;
+            }
+        }
+        if (best == 0) {
+            return;
+        }
+
+        dev->inflight[best].state = HIDPP_REQ_SENT;
+        dev->sent_count++;
+        if (transmit(dev, best) < 0) {
+            complete(dev, best, -1, NULL);
+        }
+    }
+}
+
+// Free the slot before running the callback so it can submit follow-ups
+static void complete(struct hidpp_device *dev, int sw_id, int status,
+                     const struct hidpp_report *reply) {
+    struct hidpp_inflight *req = &dev->inflight[sw_id];
+    hidpp_callback cb = req->cb;
+    void *ctx = req->ctx;
+
+    if (req->state == HIDPP_REQ_SENT) {
+        dev->sent_count--;
+    }
+    timer_cancel(&dev->req_timer[sw_id]);
+    req->state = HIDPP_REQ_FREE;
+    pump(dev);
+
+    if (cb) {
+        cb(dev, status, reply, ctx);
+    }
+}
+
+int hidpp_submit(struct hidpp_device *dev, uint8_t feature_index, uint8_t function,
+                 const uint8_t *params, int params_len, hidpp_callback cb, void *ctx) {
+    struct hidpp_inflight *req;
+    int id = 0;
+    int i;
+
+    if (params_len > HIDPP_PARAMS_LEN) {
+        return -1;
+    }
+
+    // Rotate through software ids so a late reply to a request that timed
+    // out is not mistaken for the answer to the next one
+    for (i = 0; i < HIDPP_MAX_INFLIGHT; i++) {
+        int candidate = (dev->next_sw_id + i) % HIDPP_MAX_INFLIGHT + 1;
+        if (dev->inflight[candidate].state == HIDPP_REQ_FREE) {
+            id = candidate;
+            break;
+        }
+    }
+    if (id == 0) {
+        return -1; // every software id is in use
+    }
+    dev->next_sw_id = id;
+
+    req = &dev->inflight[id];
+    memset(req, 0, sizeof(*req));
+
+    // Short reports carry three parameter bytes; anything longer goes long
+    req->len = params_len <= 3 ? HIDPP_SHORT_LEN : HIDPP_LONG_LEN;
+    req->report[0] = req->len == HIDPP_SHORT_LEN ? HIDPP_SHORT_REPORT : HIDPP_LONG_REPORT;
+    req->report[1] = dev->index;
+    req->report[2] = feature_index;
+    req->report[3] = (uint8_t)(function << 4 | id);
+    if (params_len > 0) {
+        memcpy(&req->report[4], params, params_len);
+    }
+    req->retries = HIDPP_RETRIES;
+    req->seq = dev->next_seq++;
+    req->cb = cb;
+    req->ctx = ctx;
+    req->state = HIDPP_REQ_QUEUED;
+
+    pump(dev);
+    return id;
+}
+
+// Match a reply or error report to its in-flight request. Returns true if
+// the report was consumed.
+static bool dispatch_reply(struct hidpp_device *dev, const uint8_t *buf, int len) {
+    struct hidpp_report reply;
+    struct hidpp_inflight *req;
+    bool error = buf[2] == HIDPP_ERROR_FEATURE || buf[2] == HIDPP10_ERROR;
+    int id;
+
+    // Errors echo the request's feature index and function in bytes 3-4
+    id = (error ? buf[4] : buf[3]) & 0x0F;
+    if (id == 0) {
+        return false; // notification
+    }
+    req = &dev->inflight[id];
+    if (req->state != HIDPP_REQ_SENT) {
+        return true; // late reply to a request we already gave up on
+    }
+
+    if (error) {
+        if (buf[3] != req->report[2] || buf[4] != req->report[3]) {
+            return true;
+        }
+        complete(dev, id, buf[5] ? buf[5] : -1, NULL);
+        return true;
+    }
+
+    if (buf[2] != req->report[2] || buf[3] != req->report[3]) {
+        return true;
+    }
+    memset(&reply, 0, sizeof(reply));
+    memcpy(&reply, buf, len < (int)sizeof(reply) ? len : (int)sizeof(reply));
+    complete(dev, id, 0, &reply);
+    return true;
+}
+
+struct sync_result {
+    bool done;
+    int status;
+    struct hidpp_report *reply;
+};
+
+static void sync_done(struct hidpp_device *dev, int status,
+                      const struct hidpp_report *reply, void *ctx) {
+    struct sync_result *r = ctx;
+
+    r->done = true;
+    r->status = status;
+    if (r->reply && reply) {
+        *r->reply = *reply;
+    }
+}
+
+int hidpp_request(struct hidpp_device *dev, uint8_t feature_index, uint8_t function,
+                  const uint8_t *params, int params_len, struct hidpp_report *reply) {
+    struct sync_result r = { false, -1, reply };
+    int id = hidpp_submit(dev, feature_index, function, params, params_len, sync_done, &r);
+
+    if (id < 0) {
+        return -1;
+    }
+
+    while (!r.done) {
+        struct pollfd pfds[2] = {
+            { .fd = dev->fd, .events = POLLIN },
+            { .fd = dev->timers->fd, .events = POLLIN },
+        };
+        uint8_t buf[HIDPP_LONG_LEN];
+        int ready = poll(pfds, 2, -1);
+
+        if (ready < 0 && errno != EINTR) {
+            // Drop the request: its callback points at this stack frame
+            dev->inflight[id].cb = NULL;
+            complete(dev, id, -1, NULL);
+            return -1;
+        }
+        if (ready <= 0) {
+            continue;
+        }
+        if (pfds[0].revents & POLLIN) {
+            ssize_t n = read(dev->fd, buf, sizeof(buf));
+            if (n > 0) {
+                hidpp_handle_report(dev, buf, n, NULL, 0);
+            }
+        }
+        if (pfds[1].revents & POLLIN) {
+            timer_wheel_run(dev->timers);
+        }
+    }
+    return r.status;
+}
+
+int hidpp_get_feature(struct hidpp_device *dev, uint16_t feature_id, uint8_t *index) {
+    uint8_t params[2] = { feature_id >> 8, feature_id & 0xFF };
+    struct hidpp_report reply;
+
+    if (hidpp_request(dev, 0, ROOT_FN_GET_FEATURE, params, sizeof(params), &reply) != 0) {
+        return -1;
+    }
+    *index = reply.params[0];
+    return 0;
+}
+
+int hidpp_feature_index(struct hidpp_device *dev, uint16_t feature_id, uint8_t *index) {
+    int i;
+
+    for (i = 0; i < dev->feature_count; i++) {
+        if (dev->features[i].id == feature_id) {
+            *index = dev->features[i].index;
+            return 0;
+        }
+    }
+
+    if (hidpp_get_feature(dev, feature_id, index) < 0) {
+        return -1;
+    }
+    if (dev->feature_count < HIDPP_MAX_FEATURES) {
+        dev->features[dev->feature_count].id = feature_id;
+        dev->features[dev->feature_count].index = *index;
+        dev->feature_count++;
+        dev->cache_dirty = true;
+    }
+    return 0;
+}
+
+// Look up every feature the daemon uses. With a cache hit these are all
+// table lookups; otherwise each costs one IRoot round trip.
+static void resolve_features(struct hidpp_device *dev) {
+    if (hidpp_feature_index(dev, HIDPP_FEATURE_REPROG_CONTROLS_V4, &dev->reprog_index) < 0) {
+        dev->reprog_index = 0;
+    }
+    if (hidpp_feature_index(dev, HIDPP_FEATURE_ADJUSTABLE_DPI, &dev->dpi_index) < 0) {
+        dev->dpi_index = 0;
+    }
+    if (hidpp_feature_index(dev, HIDPP_FEATURE_THUMBWHEEL, &dev->thumb_index) < 0) {
+        dev->thumb_index = 0;
+    }
+    if (hidpp_feature_index(dev, HIDPP_FEATURE_SMART_SHIFT, &dev->smartshift_index) < 0) {
+        dev->smartshift_index = 0;
+    }
+    if (hidpp_feature_index(dev, HIDPP_FEATURE_WIRELESS_STATUS, &dev->wireless_index) < 0) {
+        dev->wireless_index = 0;
+    }
+    dev->battery_feature = HIDPP_FEATURE_UNIFIED_BATTERY;
+    if (hidpp_feature_index(dev, HIDPP_FEATURE_UNIFIED_BATTERY, &dev->battery_index) < 0 ||
+        dev->battery_index == 0) {
+        dev->battery_feature = HIDPP_FEATURE_BATTERY_STATUS;
+        if (hidpp_feature_index(dev, HIDPP_FEATURE_BATTERY_STATUS, &dev->battery_index) < 0) {
+            dev->battery_index = 0;
+        }
+    }
+}
+
+// A device pinned to an index by hidpp_init() is only looked for there
+static int probe(struct hidpp_device *dev) {
+    static const uint8_t indices[] = { 1, 2, 3, 4, 5, 6, HIDPP_DEVICE_DIRECT };
+    uint8_t ping[3] = { 0, 0, ROOT_PING_DATA };
+    struct hidpp_report reply;
+    uint8_t known = dev->pinned_index;
+    size_t i;
+
+    for (i = 0; i < sizeof(indices); i++) {
+        if (known && indices[i] != known) {
+            continue;
+        }
+        dev->index = indices[i];
+        if (hidpp_request(dev, 0, ROOT_FN_GET_PROTOCOL_VERSION, ping, sizeof(ping), &reply) == 0 &&
+            reply.params[0] >= 2 && reply.params[2] == ROOT_PING_DATA) {
+            printf("HID++ %d.%d device at index %d\n",
+                   reply.params[0], reply.params[1], dev->index);
+            resolve_features(dev);
+            dev->cache_dirty = true;
+            return 0;
+        }
+    }
+
+    if (known) {
+        fprintf(stderr, "No HID++ 2.0 device answered at index %d.\n", known);
+    } else {
+        fprintf(stderr, "No HID++ 2.0 device answered on the receiver.\n");
+    }
+    return -1;
+}
+
+int hidpp_rediscover(struct hidpp_device *dev) {
+    dev->feature_count = 0;
+    dev->reprog_index = 0;
+    dev->dpi_index = 0;
+    dev->thumb_index = 0;
+    dev->smartshift_index = 0;
+    dev->wireless_index = 0;
+    dev->battery_index = 0;
+    dev->from_cache = false;
+    return probe(dev);
+}
+
+// Every feature resolve_features() looks up, plus the one the cache is
+// identified through
+static const uint16_t wanted_features[] = {
+    HIDPP_FEATURE_REPROG_CONTROLS_V4, HIDPP_FEATURE_ADJUSTABLE_DPI, HIDPP_FEATURE_THUMBWHEEL,
+    HIDPP_FEATURE_SMART_SHIFT, HIDPP_FEATURE_WIRELESS_STATUS, HIDPP_FEATURE_UNIFIED_BATTERY,
+    HIDPP_FEATURE_BATTERY_STATUS, HIDPP_FEATURE_DEVICE_INFORMATION,
+};
+
+#define WANTED_FEATURES (int)(sizeof(wanted_features) / sizeof(wanted_features[0]))
+
+static int request_fresh_feature(struct hidpp_device *dev);
+
+static void on_fresh_feature(struct hidpp_device *dev, int status,
+                             const struct hidpp_report *reply, void *ctx) {
+    if (status != 0) {
+        fprintf(stderr, "HID++ rediscovery failed (%d); keeping the old feature indices.\n", status);
+        dev->rediscovering = false;
+        timer_add(dev->timers, &dev->sync_timer, HIDPP_SYNC_RETRY_MS);
+        return;
+    }
+    dev->fresh[dev->fresh_count].id = wanted_features[dev->fresh_count];
+    dev->fresh[dev->fresh_count].index = reply->params[0];
+    dev->fresh_count++;
+    if (dev->fresh_count < WANTED_FEATURES) {
+        if (request_fresh_feature(dev) < 0) {
+            dev->rediscovering = false;
+            timer_add(dev->timers, &dev->sync_timer, HIDPP_SYNC_RETRY_MS);
+        }
+        return;
+    }
+
+    // All answered: switch over, every lookup below is a table hit
+    memcpy(dev->features, dev->fresh, sizeof(dev->fresh[0]) * dev->fresh_count);
+    dev->feature_count = dev->fresh_count;
+    dev->from_cache = false;
+    dev->cache_dirty = true;
+    dev->rediscovering = false;
+    resolve_features(dev);
+    printf("HID++ features rediscovered at index %d\n", dev->index);
+    hidpp_reapply(dev);
+    hidpp_cache_sync(dev);
+}
+
+static int request_fresh_feature(struct hidpp_device *dev) {
+    uint16_t id = wanted_features[dev->fresh_count];
+    uint8_t params[2] = { id >> 8, id & 0xFF };
+
+    return hidpp_submit(dev, 0, ROOT_FN_GET_FEATURE, params, sizeof(params),
+                        on_fresh_feature, NULL) < 0 ? -1 : 0;
+}
+
+int hidpp_rediscover_async(struct hidpp_device *dev) {
+    if (dev->rediscovering) {
+        return 0;
+    }
+    dev->fresh_count = 0;
+    if (request_fresh_feature(dev) < 0) {
+        return -1;
+    }
+    dev->rediscovering = true;
+    return 0;
+}
+
+static void sync_retry(struct timer *t, void *ctx) {
+    hidpp_cache_sync(ctx);
+}
+
+int hidpp_init(struct hidpp_device *dev, int fd, uint8_t index, struct timer_wheel *timers,
+               int gesture_code, const char *cache_path) {
+    struct hidraw_devinfo info;
+    int id;
+
+    memset(dev, 0, sizeof(*dev));
+    dev->fd = fd;
+    dev->pinned_index = index;
+    dev->timers = timers;
+    for (id = 0; id <= HIDPP_MAX_INFLIGHT; id++) {
+        timer_init(&dev->req_timer[id], request_timeout, dev);
+    }
+    timer_init(&dev->sync_timer, sync_retry, dev);
+    dev->gesture_code = gesture_code;
+    dev->cache_path = cache_path;
+    dev->battery_level = -1;
+
+    if (ioctl(fd, HIDIOCGRAWINFO, &info) >= 0) {
+        snprintf(dev->locator, sizeof(dev->locator), "%04x:%04x:%04x",
+                 info.bustype, info.vendor & 0xFFFF, info.product & 0xFFFF);
+    } else {
+        snprintf(dev->locator, sizeof(dev->locator), "unknown");
+    }
+    if (index) {
+        // Mice paired to one receiver share its node; keep their entries apart
+        size_t len = strlen(dev->locator);
+        snprintf(dev->locator + len, sizeof(dev->locator) - len, "/%d", index);
+    }
+
+    // Cached indices are trusted now and checked later by hidpp_cache_sync()
+    if (hidpp_cache_load(dev) == 0) {
+        dev->from_cache = true;
+        resolve_features(dev);
+        printf("HID++ device at index %d (cached features)\n", dev->index);
+        return 0;
+    }
+
+    return probe(dev);
+}
+
+int hidpp_divert_gesture_button(struct hidpp_device *dev, bool divert) {
+    uint8_t params[5];
+    int err;
+
+    if (dev->reprog_index == 0 && dev->from_cache && hidpp_rediscover(dev) < 0) {
+        return -1;
+    }
+    if (dev->reprog_index == 0) {
+        fprintf(stderr, "Device has no REPROG_CONTROLS_V4; cannot divert the gesture button.\n");
+        return -1;
+    }
+
+    params[0] = HIDPP_CID_GESTURE_BUTTON >> 8;
+    params[1] = HIDPP_CID_GESTURE_BUTTON & 0xFF;
+    params[2] = REPROG_FLAG_DIVERT_VALID | REPROG_FLAG_RAW_XY_VALID;
+    if (divert) {
+        params[2] |= REPROG_FLAG_DIVERT | REPROG_FLAG_RAW_XY;
+    }
+    params[3] = 0; // no remap
+    params[4] = 0;
+
+    err = hidpp_request(dev, dev->reprog_index, REPROG_FN_SET_CID_REPORTING,
+                        params, sizeof(params), NULL);
+    if (err != 0 && dev->from_cache) {
+        // The cached indices were wrong (or the device moved); start over
+        fprintf(stderr, "Cached HID++ features are stale, rediscovering.\n");
+        if (hidpp_rediscover(dev) < 0) {
+            return -1;
+        }
+        return hidpp_divert_gesture_button(dev, divert);
+    }
+    if (err != 0) {
+        fprintf(stderr, "setCidReporting failed (%d)\n", err);
+        return -1;
+    }
+    dev->diverted = divert;
+    return 0;
+}
+
+static void on_dpi_read(struct hidpp_device *dev, int status,
+                        const struct hidpp_report *reply, void *ctx) {
+    int dpi = -1;
+
+    if (status == 0) {
+        dpi = (reply->params[1] << 8) | reply->params[2];
+        dev->base_dpi = dev->current_dpi = dpi;
+        if (!dev->dpi_busy) {
+            dev->target_dpi = dpi;
+        }
+    }
+    if (dev->dpi_cb) {
+        dev->dpi_cb(dev, dpi, dev->dpi_ctx);
+    }
+}
+
+int hidpp_query_dpi(struct hidpp_device *dev, hidpp_dpi_callback cb, void *ctx) {
+    uint8_t sensor = 0;
+
+    if (dev->dpi_index == 0) {
+        return -1;
+    }
+    dev->dpi_cb = cb;
+    dev->dpi_ctx = ctx;
+    return hidpp_submit(dev, dev->dpi_index, DPI_FN_GET_SENSOR_DPI, &sensor, 1,
+                        on_dpi_read, NULL) < 0 ? -1 : 0;
+}
+
+static void send_dpi(struct hidpp_device *dev);
+
+static void on_dpi_set(struct hidpp_device *dev, int status,
+                       const struct hidpp_report *reply, void *ctx) {
+    dev->dpi_busy = false;
+    if (status == 0) {
+        dev->current_dpi = dev->sent_dpi;
+    } else {
+        // Give up on this value rather than retrying it forever
+        fprintf(stderr, "setSensorDpi(%d) failed (%d)\n", dev->sent_dpi, status);
+        if (dev->target_dpi == dev->sent_dpi) {
+            dev->target_dpi = dev->current_dpi;
+        }
+    }
+    send_dpi(dev);
+}
+
+static void send_dpi(struct hidpp_device *dev) {
+    int dpi = dev->target_dpi;
+    uint8_t params[3] = { 0, dpi >> 8, dpi & 0xFF };
+
+    if (dev->dpi_busy || dpi <= 0 || dpi == dev->current_dpi) {
+        return;
+    }
+    if (hidpp_submit(dev, dev->dpi_index, DPI_FN_SET_SENSOR_DPI, params, sizeof(params),
+                     on_dpi_set, NULL) >= 0) {
+        dev->dpi_busy = true;
+        dev->sent_dpi = dpi;
+    }
+}
+
+void hidpp_set_dpi(struct hidpp_device *dev, int dpi) {
+    if (dev->dpi_index == 0) {
+        return;
+    }
+    dev->target_dpi = dpi;
+    send_dpi(dev);
+}
+
+int hidpp_restore_dpi(struct hidpp_device *dev) {
+    uint8_t params[3] = { 0, dev->base_dpi >> 8, dev->base_dpi & 0xFF };
+
+    if (dev->dpi_index == 0 || dev->base_dpi <= 0 ||
+        (dev->current_dpi == dev->base_dpi && !dev->dpi_busy)) {
+        return 0;
+    }
+    dev->target_dpi = dev->base_dpi;
+    if (hidpp_request(dev, dev->dpi_index, DPI_FN_SET_SENSOR_DPI, params, sizeof(params), NULL) != 0) {
+        return -1;
+    }
+    dev->current_dpi = dev->base_dpi;
+    return 0;
+}
+
+int hidpp_divert_thumbwheel(struct hidpp_device *dev, bool divert) {
+    struct hidpp_report reply;
+    uint8_t params[2] = { divert ? 1 : 0, 0 }; // reporting mode, no inversion
+
+    if (dev->thumb_index == 0) {
+        fprintf(stderr, "Device has no THUMBWHEEL feature.\n");
+        return -1;
+    }
+    if (divert) {
+        if (hidpp_request(dev, dev->thumb_index, THUMB_FN_GET_INFO, NULL, 0, &reply) != 0) {
+            return -1;
+        }
+        dev->thumb_native_res = (reply.params[0] << 8) | reply.params[1];
+        dev->thumb_diverted_res = (reply.params[2] << 8) | reply.params[3];
+        if (dev->thumb_native_res <= 0 || dev->thumb_diverted_res <= 0) {
+            return -1;
+        }
+    }
+    if (hidpp_request(dev, dev->thumb_index, THUMB_FN_SET_REPORTING, params, sizeof(params), NULL) != 0) {
+        fprintf(stderr, "setThumbwheelReporting failed\n");
+        return -1;
+    }
+    dev->thumb_diverted = divert;
+    dev->thumb_rem = 0;
+    return 0;
+}
+
+int hidpp_set_smartshift(struct hidpp_device *dev, int threshold) {
+    uint8_t params[3] = { SMARTSHIFT_MODE_RATCHET, (uint8_t)threshold, 0 };
+
+    if (dev->smartshift_index == 0 || threshold < 1 || threshold > 255) {
+        return -1;
+    }
+    return hidpp_submit(dev, dev->smartshift_index, SMARTSHIFT_FN_SET_RATCHET_CONTROL,
+                        params, sizeof(params), NULL, NULL) < 0 ? -1 : 0;
+}
+
+void hidpp_reapply(struct hidpp_device *dev) {
+    uint8_t divert[5] = {
+        HIDPP_CID_GESTURE_BUTTON >> 8, HIDPP_CID_GESTURE_BUTTON & 0xFF,
+        REPROG_FLAG_DIVERT | REPROG_FLAG_DIVERT_VALID | REPROG_FLAG_RAW_XY | REPROG_FLAG_RAW_XY_VALID,
+        0, 0,
+    };
+    uint8_t thumb[2] = { 1, 0 };
+
+    if (dev->diverted && dev->reprog_index) {
+        hidpp_submit(dev, dev->reprog_index, REPROG_FN_SET_CID_REPORTING,
+                     divert, sizeof(divert), NULL, NULL);
+    }
+    if (dev->thumb_diverted && dev->thumb_index) {
+        hidpp_submit(dev, dev->thumb_index, THUMB_FN_SET_REPORTING, thumb, sizeof(thumb), NULL, NULL);
+    }
+
+    // The sensor comes back at its stored resolution
+    dev->current_dpi = dev->base_dpi;
+    dev->dpi_busy = false;
+    if (dev->target_dpi > 0 && dev->target_dpi != dev->base_dpi) {
+        send_dpi(dev);
+    }
+}
+
+static void set_event(struct input_event *ev, const struct timespec *ts,
+                      int type, int code, int value) {
+    ev->time.tv_sec = ts->tv_sec;
+    ev->time.tv_usec = ts->tv_nsec / 1000;
+    ev->type = type;
+    ev->code = code;
+    ev->value = value;
+}
+
+// Thumb wheel status: rotation (int16, diverted increments), timestamp,
+// rotation status, then touch/proximity/tap flags
+static int decode_thumbwheel(struct hidpp_device *dev, const uint8_t *buf,
+                             struct input_event *out, int max_events) {
+    struct timespec now;
+    int16_t rotation;
+    int64_t scaled;
+    int32_t hires;
+    bool touch, proximity;
+    int n = 0;
+
+    if ((buf[3] >> 4) != THUMB_EVENT_STATUS || max_events < 4) {
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // Rescale to evdev hi-res units (120 per native notch), carrying the
+    // remainder so no increment is lost
+    rotation = (int16_t)((buf[4] << 8) | buf[5]);
+    scaled = (int64_t)rotation * HI_RES_PER_NOTCH * dev->thumb_native_res + dev->thumb_rem;
+    hires = (int32_t)(scaled / dev->thumb_diverted_res);
+    dev->thumb_rem = (int32_t)(scaled - (int64_t)hires * dev->thumb_diverted_res);
+
+    touch = buf[9] & THUMB_FLAG_TOUCH;
+    proximity = buf[9] & THUMB_FLAG_PROXIMITY;
+
+    if (proximity != dev->thumb_proximity) {
+        dev->thumb_proximity = proximity;
+        set_event(&out[n++], &now, EV_KEY, BTN_TOOL_FINGER, proximity);
+    }
+    if (hires) {
+        set_event(&out[n++], &now, EV_REL, REL_HWHEEL_HI_RES, hires);
+    }
+    if (touch != dev->thumb_touch) {
+        dev->thumb_touch = touch;
+        if (!touch) {
+            dev->thumb_rem = 0;
+        }
+        set_event(&out[n++], &now, EV_KEY, BTN_TOUCH, touch);
+    }
+    if (n > 0) {
+        set_event(&out[n++], &now, EV_SYN, SYN_REPORT, 0);
+    }
+    return n;
+}
+
+int hidpp_handle_report(struct hidpp_device *dev, const uint8_t *buf, int len,
+                        struct input_event *out, int max_events) {
+    struct timespec now;
+    int n = 0;
+
+    if (len < HIDPP_SHORT_LEN ||
+        (buf[0] != HIDPP_SHORT_REPORT && buf[0] != HIDPP_LONG_REPORT) ||
+        buf[1] != dev->index) {
+        return 0;
+    }
+    // Receiver notifications reuse byte 3 for other things, so they must
+    // be picked out before reply matching looks at the software id
+    if (hidpp_handle_status(dev, buf, len) || dispatch_reply(dev, buf, len)) {
+        return 0;
+    }
+    if (dev->thumb_diverted && buf[2] == dev->thumb_index) {
+        return decode_thumbwheel(dev, buf, out, max_events);
+    }
+    if (max_events < 3 || dev->reprog_index == 0 || buf[2] != dev->reprog_index) {
+        return 0; // not a REPROG_CONTROLS_V4 notification
+    }
+
+    // hidraw carries no timestamps; stamp on the same clock as evdev
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if ((buf[3] >> 4) == REPROG_EVENT_DIVERTED_BUTTONS) {
+        // Up to four currently pressed diverted CIDs, big-endian
+        bool held = false;
+        int i;
+
+        for (i = 4; i + 1 < len && i < 12; i += 2) {
+            if (((buf[i] << 8) | buf[i + 1]) == HIDPP_CID_GESTURE_BUTTON) {
+                held = true;
+            }
+        }
+        if (held != dev->gesture_held) {
+            dev->gesture_held = held;
+            set_event(&out[n++], &now, EV_KEY, dev->gesture_code, held);
+        }
+    } else if ((buf[3] >> 4) == REPROG_EVENT_RAW_XY) {
+        int16_t dx = (int16_t)((buf[4] << 8) | buf[5]);
+        int16_t dy = (int16_t)((buf[6] << 8) | buf[7]);
+
+        if (dx) {
+            set_event(&out[n++], &now, EV_REL, REL_X, dx);
+        }
+        if (dy) {
+            set_event(&out[n++], &now, EV_REL, REL_Y, dy);
+        }
+    }
+
+    if (n > 0) {
+        set_event(&out[n++], &now, EV_SYN, SYN_REPORT, 0);
+    }
+    return n;
+}
@@ -0,0 +1,261 @@
+#ifndef HIDPP_H
+#define HIDPP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/input.h>
+
+#include "timer.h"
+
+// HID++ 2.0 report layout: report id, device index, feature index,
+// function << 4 | software id, then parameters
+#define HIDPP_SHORT_REPORT 0x10
+#define HIDPP_LONG_REPORT 0x11
+#define HIDPP_SHORT_LEN 7
+#define HIDPP_LONG_LEN 20
+#define HIDPP_PARAMS_LEN (HIDPP_LONG_LEN - 4)
+
+#define HIDPP_DEVICE_DIRECT 0xFF  // device index when not behind a receiver
+#define HIDPP_ERROR_FEATURE 0xFF  // feature index of a HID++ 2.0 error reply
+#define HIDPP10_ERROR 0x8F        // sub id of a HID++ 1.0 error reply
+#define HIDPP10_DEVICE_CONNECTION 0x41 // receiver notification: link up/down
+
+#define HIDPP_FEATURE_ROOT 0x0000
+#define HIDPP_FEATURE_DEVICE_INFORMATION 0x0003
+#define HIDPP_FEATURE_BATTERY_STATUS 0x1000
+#define HIDPP_FEATURE_UNIFIED_BATTERY 0x1004
+#define HIDPP_FEATURE_REPROG_CONTROLS_V4 0x1B04
+#define HIDPP_FEATURE_WIRELESS_STATUS 0x1D4B
+#define HIDPP_FEATURE_SMART_SHIFT 0x2110
+#define HIDPP_FEATURE_THUMBWHEEL 0x2150
+#define HIDPP_FEATURE_ADJUSTABLE_DPI 0x2201
+
+#define HIDPP_CID_GESTURE_BUTTON 0x00C3 // MX Master 3 thumb button
+
+#define HIDPP_TIMEOUT_MS 500  // per attempt
+#define HIDPP_RETRIES 2       // resends after the first timeout
+#define HIDPP_SYNC_RETRY_MS 60000 // cache check the device did not answer: ask again
+#define HIDPP_MAX_INFLIGHT 15 // one request per software id 1-15
+#define HIDPP_WINDOW 4        // requests on the wire at once
+#define HIDPP_MAX_FEATURES 16
+
+struct hidpp_report {
+    uint8_t report_id;
+    uint8_t device_index;
+    uint8_t feature_index;
+    uint8_t function;  // function << 4 | software id
+    uint8_t params[HIDPP_PARAMS_LEN];
+};
+
+struct hidpp_device;
+
+// Completion of an asynchronous request: status is 0 with the reply, the
+// HID++ error code (> 0), or -1 after the last retry timed out
+typedef void (*hidpp_callback)(struct hidpp_device *dev, int status,
+                               const struct hidpp_report *reply, void *ctx);
+
+enum hidpp_request_state {
+    HIDPP_REQ_FREE,
+    HIDPP_REQ_QUEUED, // waiting for room in the window
+    HIDPP_REQ_SENT,
+};
+
+// In-flight table entry. The table is indexed by software id, and a reply
+// must also echo the feature index and function to match.
+struct hidpp_inflight {
+    uint8_t state;
+    uint8_t len;
+    uint8_t retries;
+    uint8_t report[HIDPP_LONG_LEN];
+    uint32_t seq; // submission order, for sending queued requests FIFO
+    hidpp_callback cb;
+    void *ctx;
+};
+
+// Result of hidpp_query_dpi(): the sensor resolution, or -1 on failure
+typedef void (*hidpp_dpi_callback)(struct hidpp_device *dev, int dpi, void *ctx);
+
+enum hidpp_link {
+    HIDPP_LINK_UNKNOWN,
+    HIDPP_LINK_CONNECTED,
+    HIDPP_LINK_DISCONNECTED, // powered off, out of range or switched to another host
+};
+
+// Link state changed; called from hidpp_handle_report()
+typedef void (*hidpp_link_callback)(struct hidpp_device *dev, enum hidpp_link link, void *ctx);
+
+// Feature id -> feature index. Index 0 records a feature the device lacks.
+struct hidpp_feature {
+    uint16_t id;
+    uint8_t index;
+};
+
+// One HID++ 2.0 device on a hidraw fd. The fd may be any packet-oriented
+// descriptor (a hidraw node, or a SOCK_SEQPACKET socket in hidpp_check); all
+// protocol traffic goes through plain read()/write().
+struct hidpp_device {
+    int fd;
+    uint8_t index;         // device index: 1-6 behind a receiver, 0xFF direct
+    uint8_t pinned_index;  // index the caller asked for, 0 to probe
+    uint8_t reprog_index;  // feature index of REPROG_CONTROLS_V4, 0 if absent
+    int gesture_code;      // EV_KEY code synthesized for the diverted button
+    bool gesture_held;
+    bool diverted;
+
+    struct hidpp_feature features[HIDPP_MAX_FEATURES];
+    int feature_count;
+
+    // ADJUSTABLE_DPI, sensor 0
+    uint8_t dpi_index;
+    int base_dpi;      // resolution to go back to after sniper mode
+    int current_dpi;   // last value the device confirmed
+    int target_dpi;    // latest value asked for
+    int sent_dpi;      // value of the setSensorDpi in flight
+    bool dpi_busy;
+    hidpp_dpi_callback dpi_cb;
+    void *dpi_ctx;
+
+    // THUMBWHEEL, diverted: rotation arrives as notifications
+    uint8_t thumb_index;
+    uint8_t smartshift_index;
+    bool thumb_diverted;
+    bool thumb_touch;
+    bool thumb_proximity;
+    int thumb_native_res;   // notches per revolution
+    int thumb_diverted_res; // diverted increments per revolution
+    int32_t thumb_rem;      // remainder of the increment -> hi-res conversion
+
+    // Battery and link, updated only from notifications (hidpp_status.c)
+    uint8_t battery_index;
+    uint16_t battery_feature;  // UNIFIED_BATTERY or BATTERY_STATUS
+    uint8_t wireless_index;
+    int battery_level;         // percent, -1 until known
+    bool battery_charging;
+    enum hidpp_link link;
+    bool receiver_link;        // link changes come from receiver notifications
+    unsigned disconnects;
+    hidpp_link_callback link_cb;
+    void *link_ctx;
+
+    struct hidpp_inflight inflight[HIDPP_MAX_INFLIGHT + 1]; // [0] unused
+    struct timer req_timer[HIDPP_MAX_INFLIGHT + 1]; // retry deadline per software id
+    struct timer_wheel *timers;
+    int sent_count;
+    int next_sw_id;
+    uint32_t next_seq;
+
+    // On-disk feature-index cache (hidpp_cache.c)
+    const char *cache_path; // NULL disables the cache
+    char locator[32];       // bus:vendor:product of the hidraw node[/device index]
+    char model[16];         // DEVICE_INFORMATION model id, hex
+    char firmware[16];      // main application firmware name and version
+    bool from_cache;        // indices not yet confirmed against the device
+    bool cache_dirty;
+    uint8_t devinfo_index;  // identify chain state while validating
+    uint8_t sync_entity;
+    uint8_t sync_entities;
+    char sync_model[16];
+    char sync_firmware[16];
+    struct timer sync_timer; // retries a check the device did not answer
+    struct hidpp_feature fresh[HIDPP_MAX_FEATURES]; // rediscovery in progress
+    int fresh_count;
+    bool rediscovering;
+};
+
+// Find the HID++ interface of a Logitech receiver or device under
+// /dev/hidraw*. Returns an open read/write fd or -1.
+int hidpp_open(void);
+
+// Set up a device on fd. If cache_path has an entry for this hidraw node
+// the cached device index and feature indices are used without any
+// round trip; otherwise probe device indices for a HID++ 2.0 device and
+// discover the features we need. A nonzero index names the paired device
+// on a receiver and limits the probe to it. Request timeouts run on
+// timers, which the caller keeps running. Returns 0 or -1 if none responds.
+int hidpp_init(struct hidpp_device *dev, int fd, uint8_t index, struct timer_wheel *timers,
+               int gesture_code, const char *cache_path);
+
+// Forget every feature index and probe the device again from scratch
+int hidpp_rediscover(struct hidpp_device *dev);
+
+// hidpp_rediscover() without blocking, for a device that answers at
+// dev->index: every feature is asked for again, and the answers replace
+// the old indices only once all are in (a failure keeps the old ones).
+// Then the diversions are re-sent and the cache checked again.
+// Returns 0 or -1 if it could not start.
+int hidpp_rediscover_async(struct hidpp_device *dev);
+
+// Queue a request without waiting. Up to HIDPP_WINDOW requests are on the
+// wire at once; each is resent HIDPP_RETRIES times after HIDPP_TIMEOUT_MS
+// before cb sees -1. Returns the software id used or -1 if the table is full.
+int hidpp_submit(struct hidpp_device *dev, uint8_t feature_index, uint8_t function,
+                 const uint8_t *params, int params_len, hidpp_callback cb, void *ctx);
+
+// Blocking request built on hidpp_submit(), for setup before the event
+// loop runs. It runs the timer wheel while it waits; notifications that
+// arrive in the meantime are discarded.
+// Returns 0, the HID++ error code (> 0) or -1.
+int hidpp_request(struct hidpp_device *dev, uint8_t feature_index, uint8_t function,
+                  const uint8_t *params, int params_len, struct hidpp_report *reply);
+
+// IRoot getFeature. Returns 0 with *index set (0 if unsupported) or -1.
+int hidpp_get_feature(struct hidpp_device *dev, uint16_t feature_id, uint8_t *index);
+
+// Feature index from the table, asking the device on a miss
+int hidpp_feature_index(struct hidpp_device *dev, uint16_t feature_id, uint8_t *index);
+
+// Feature-index cache. Load fills in index, model, firmware and features
+// for dev->locator. Sync starts an asynchronous check of the device's
+// model and firmware against the entry (rediscovering on mismatch) that
+// writes the file if anything changed; a device that does not answer is
+// asked again after HIDPP_SYNC_RETRY_MS. Both return 0 or -1.
+int hidpp_cache_load(struct hidpp_device *dev);
+int hidpp_cache_sync(struct hidpp_device *dev);
+
+// Divert the gesture button and its raw XY motion to us, or give it back
+int hidpp_divert_gesture_button(struct hidpp_device *dev, bool divert);
+
+// Read the current sensor resolution without blocking; it also becomes
+// the resolution hidpp_set_dpi() callers restore to. Returns 0 or -1.
+int hidpp_query_dpi(struct hidpp_device *dev, hidpp_dpi_callback cb, void *ctx);
+
+// Ask for a new sensor resolution without blocking. While a change is in
+// flight only the latest request is kept, and it is sent once the device
+// answers, so rapid toggling never queues a backlog of setSensorDpi calls.
+void hidpp_set_dpi(struct hidpp_device *dev, int dpi);
+
+// Blocking: put the resolution back to base_dpi, for shutdown
+int hidpp_restore_dpi(struct hidpp_device *dev);
+
+// Blocking, for setup: divert the thumb wheel so its rotation, touch and
+// proximity arrive as notifications, or return it to native scrolling
+int hidpp_divert_thumbwheel(struct hidpp_device *dev, bool divert);
+
+// SmartShift: switch from ratchet to free spin above threshold (1-254),
+// 255 to always ratchet. Sent without waiting. Returns 0 or -1.
+int hidpp_set_smartshift(struct hidpp_device *dev, int threshold);
+
+// Start tracking battery and link state: one battery read now, then only
+// unsolicited notifications. On reconnection the diversions are re-sent
+// (the firmware forgets them) before link_cb runs. Returns 0 or -1.
+int hidpp_watch_status(struct hidpp_device *dev, hidpp_link_callback link_cb, void *ctx);
+
+// After a reconnection: re-send the gesture button and thumb wheel
+// diversions and the requested DPI, without waiting
+void hidpp_reapply(struct hidpp_device *dev);
+
+// Consume battery, wireless-status and receiver connection notifications.
+// Returns true if the report was one of them.
+bool hidpp_handle_status(struct hidpp_device *dev, const uint8_t *buf, int len);
+
+const char *hidpp_link_name(enum hidpp_link link);
+
+// Handle one report read from the fd. Replies complete their in-flight
+// request; notifications are translated into evdev events, each frame
+// terminated by SYN_REPORT: a key event for the diverted button, REL_X/REL_Y
+// for raw motion, and REL_HWHEEL_HI_RES (120 per notch) with BTN_TOUCH and
+// BTN_TOOL_FINGER for the diverted thumb wheel. Returns the number of events written to out.
+int hidpp_handle_report(struct hidpp_device *dev, const uint8_t *buf, int len,
+                        struct input_event *out, int max_events);
+
+#endif
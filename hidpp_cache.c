@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "hidpp.h"
+
+// One line per hidraw node:
+//   <locator> <device index> <model> <firmware> <feature>=<index> ...
+// with feature ids and indices in hex. The locator picks the entry without
+// talking to the device; model and firmware are what hidpp_cache_sync()
+// checks, in the background, before the entry is trusted for good.
+#define CACHE_LINE_LEN 512
+
+// DEVICE_INFORMATION
+#define DEVINFO_FN_GET_DEVICE_INFO 0
+#define DEVINFO_FN_GET_FW_INFO 1
+#define DEVINFO_FW_TYPE_MAIN 0
+
+#define ROOT_FN_GET_FEATURE 0
+
+#define SYNC_UNCONFIRMED 1 // the device answered but cannot confirm the entry
+
+static int parse_entry(struct hidpp_device *dev, char *line) {
+    char *save = NULL;
+    char *tok;
+    int field = 0;
+
+    dev->feature_count = 0;
+    for (tok = strtok_r(line, " \n", &save); tok; tok = strtok_r(NULL, " \n", &save), field++) {
+        unsigned id, index;
+
+        switch (field) {
+        case 0:
+            break; // locator, already matched
+        case 1:
+            dev->index = (uint8_t)strtoul(tok, NULL, 16);
+            break;
+        case 2:
+            snprintf(dev->model, sizeof(dev->model), "%s", tok);
+            break;
+        case 3:
+            snprintf(dev->firmware, sizeof(dev->firmware), "%s", tok);
+            break;
+        default:
+            if (sscanf(tok, "%x=%x", &id, &index) != 2 ||
+                dev->feature_count >= HIDPP_MAX_FEATURES) {
+                return -1;
+            }
+            dev->features[dev->feature_count].id = id;
+            dev->features[dev->feature_count].index = index;
+            dev->feature_count++;
+            break;
+        }
+    }
+    return field >= 4 ? 0 : -1;
+}
+
+int hidpp_cache_load(struct hidpp_device *dev) {
+    char line[CACHE_LINE_LEN];
+    size_t key_len = strlen(dev->locator);
+    FILE *f;
+    int ret = -1;
+
+    if (!dev->cache_path) {
+        return -1;
+    }
+    f = fopen(dev->cache_path, "r");
+    if (!f) {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, dev->locator, key_len) == 0 && line[key_len] == ' ') {
+            ret = parse_entry(dev, line);
+            break;
+        }
+    }
+    fclose(f);
+
+    if (ret < 0) {
+        dev->feature_count = 0;
+        dev->model[0] = '\0';
+        dev->firmware[0] = '\0';
+    }
+    return ret;
+}
+
+static void mkdir_parent(const char *path) {
+    char dir[CACHE_LINE_LEN];
+    char *slash;
+
+    snprintf(dir, sizeof(dir), "%s", path);
+    slash = strrchr(dir, '/');
+    if (slash && slash != dir) {
+        *slash = '\0';
+        mkdir(dir, 0755);
+    }
+}
+
+static int cache_save(struct hidpp_device *dev) {
+    char tmp_path[CACHE_LINE_LEN];
+    char line[CACHE_LINE_LEN];
+    size_t key_len = strlen(dev->locator);
+    FILE *in, *out;
+    int i;
+
+    mkdir_parent(dev->cache_path);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", dev->cache_path);
+    out = fopen(tmp_path, "w");
+    if (!out) {
+        fprintf(stderr, "Cannot write feature cache %s: %s\n", tmp_path, strerror(errno));
+        return -1;
+    }
+
+    // Keep entries for other receivers
+    in = fopen(dev->cache_path, "r");
+    if (in) {
+        while (fgets(line, sizeof(line), in)) {
+            if (!(strncmp(line, dev->locator, key_len) == 0 && line[key_len] == ' ')) {
+                fputs(line, out);
+            }
+        }
+        fclose(in);
+    }
+
+    fprintf(out, "%s %02x %s %s", dev->locator, dev->index, dev->model, dev->firmware);
+    for (i = 0; i < dev->feature_count; i++) {
+        fprintf(out, " %04x=%02x", dev->features[i].id, dev->features[i].index);
+    }
+    fputc('\n', out);
+
+    if (fclose(out) != 0 || rename(tmp_path, dev->cache_path) != 0) {
+        fprintf(stderr, "Cannot update feature cache %s: %s\n", dev->cache_path, strerror(errno));
+        remove(tmp_path);
+        return -1;
+    }
+    dev->cache_dirty = false;
+    return 0;
+}
+
+static void sync_finish(struct hidpp_device *dev, int status);
+
+static void on_fw_info(struct hidpp_device *dev, int status,
+                       const struct hidpp_report *reply, void *ctx);
+
+static void request_fw_info(struct hidpp_device *dev) {
+    uint8_t entity = dev->sync_entity;
+
+    if (hidpp_submit(dev, dev->devinfo_index, DEVINFO_FN_GET_FW_INFO, &entity, 1,
+                     on_fw_info, NULL) < 0) {
+        sync_finish(dev, -1);
+    }
+}
+
+static void on_fw_info(struct hidpp_device *dev, int status,
+                       const struct hidpp_report *reply, void *ctx) {
+    if (status != 0) {
+        sync_finish(dev, status);
+        return;
+    }
+    if ((reply->params[0] & 0x0F) == DEVINFO_FW_TYPE_MAIN) {
+        snprintf(dev->sync_firmware, sizeof(dev->sync_firmware), "%.3s%02x.%02x_%02x%02x",
+                 (const char *)&reply->params[1], reply->params[4], reply->params[5],
+                 reply->params[6], reply->params[7]);
+        sync_finish(dev, 0);
+        return;
+    }
+    if (++dev->sync_entity >= dev->sync_entities) {
+        sync_finish(dev, SYNC_UNCONFIRMED); // no main firmware entity
+        return;
+    }
+    request_fw_info(dev);
+}
+
+static void on_device_info(struct hidpp_device *dev, int status,
+                           const struct hidpp_report *reply, void *ctx) {
+    if (status != 0) {
+        sync_finish(dev, status);
+        return;
+    }
+    snprintf(dev->sync_model, sizeof(dev->sync_model), "%02x%02x%02x%02x%02x%02x",
+             reply->params[7], reply->params[8], reply->params[9],
+             reply->params[10], reply->params[11], reply->params[12]);
+    dev->sync_entities = reply->params[0];
+    dev->sync_entity = 0;
+    if (dev->sync_entities == 0) {
+        sync_finish(dev, SYNC_UNCONFIRMED);
+        return;
+    }
+    request_fw_info(dev);
+}
+
+static void request_device_info(struct hidpp_device *dev) {
+    if (hidpp_submit(dev, dev->devinfo_index, DEVINFO_FN_GET_DEVICE_INFO, NULL, 0,
+                     on_device_info, NULL) < 0) {
+        sync_finish(dev, -1);
+    }
+}
+
+static void on_devinfo_index(struct hidpp_device *dev, int status,
+                             const struct hidpp_report *reply, void *ctx) {
+    if (status != 0) {
+        sync_finish(dev, status);
+        return;
+    }
+    if (reply->params[0] == 0) {
+        sync_finish(dev, SYNC_UNCONFIRMED); // no DEVICE_INFORMATION
+        return;
+    }
+    dev->devinfo_index = reply->params[0];
+    if (dev->feature_count < HIDPP_MAX_FEATURES) {
+        dev->features[dev->feature_count].id = HIDPP_FEATURE_DEVICE_INFORMATION;
+        dev->features[dev->feature_count].index = dev->devinfo_index;
+        dev->feature_count++;
+        dev->cache_dirty = true;
+    }
+    request_device_info(dev);
+}
+
+// End of the identify chain: compare what the device reported with the
+// entry we started from and write the file if anything changed. With
+// status < 0 nothing answered (asleep, switched off): the entry is not
+// wrong, just unverified, so ask again later. With status > 0 the device
+// answered but could not confirm the entry, which counts as a mismatch.
+static void sync_finish(struct hidpp_device *dev, int status) {
+    if (status < 0) {
+        timer_add(dev->timers, &dev->sync_timer, HIDPP_SYNC_RETRY_MS);
+        return;
+    }
+    if (status > 0) {
+        if (!dev->from_cache) {
+            return; // nothing to validate, and no identity to record
+        }
+        dev->sync_model[0] = dev->sync_firmware[0] = '\0'; // forces a mismatch
+    }
+
+    if (dev->from_cache && (strcmp(dev->sync_model, dev->model) != 0 ||
+                            strcmp(dev->sync_firmware, dev->firmware) != 0)) {
+        // Firmware update or a different mouse on the receiver. The new
+        // indices are fetched in the background; once they are in, the
+        // cache is identified again and rewritten.
+        fprintf(stderr, "Feature cache is for %s/%s, device is %s/%s; rediscovering.\n",
+                dev->model, dev->firmware, dev->sync_model, dev->sync_firmware);
+        if (hidpp_rediscover_async(dev) < 0) {
+            timer_add(dev->timers, &dev->sync_timer, HIDPP_SYNC_RETRY_MS);
+        }
+        return;
+    }
+    dev->from_cache = false;
+
+    if (strcmp(dev->sync_model, dev->model) != 0 ||
+        strcmp(dev->sync_firmware, dev->firmware) != 0) {
+        snprintf(dev->model, sizeof(dev->model), "%s", dev->sync_model);
+        snprintf(dev->firmware, sizeof(dev->firmware), "%s", dev->sync_firmware);
+        dev->cache_dirty = true;
+    }
+    if (dev->cache_dirty) {
+        cache_save(dev);
+    }
+}
+
+int hidpp_cache_sync(struct hidpp_device *dev) {
+    int i;
+
+    if (!dev->cache_path) {
+        return 0;
+    }
+
+    // Model id and main firmware version, the identity a cache entry is
+    // valid for, fetched through DEVICE_INFORMATION without blocking
+    for (i = 0; i < dev->feature_count; i++) {
+        if (dev->features[i].id == HIDPP_FEATURE_DEVICE_INFORMATION && dev->features[i].index) {
+            dev->devinfo_index = dev->features[i].index;
+            request_device_info(dev);
+            return 0;
+        }
+    }
+
+    uint8_t params[2] = { HIDPP_FEATURE_DEVICE_INFORMATION >> 8,
+                          HIDPP_FEATURE_DEVICE_INFORMATION & 0xFF };
+    if (hidpp_submit(dev, 0, ROOT_FN_GET_FEATURE, params, sizeof(params),
+                     on_devinfo_index, NULL) < 0) {
+        return -1;
+    }
+    return 0;
+}
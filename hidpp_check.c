@@ -0,0 +1,473 @@
+// Checks for the HID++ client against a scripted fake device on the
+// other end of a SOCK_SEQPACKET socketpair, which keeps report boundaries
+// the way a hidraw node does. Setup (hidpp_init() and the other blocking
+// calls) runs while a peer thread answers; everything after that is
+// single-threaded: the check reads each request off the peer end, sends
+// back what the script says and hands the answer to hidpp_handle_report().
+// The timer wheel is manual, so timeouts and retries fire exactly when
+// the check moves the clock.
+//
+// ./hidpp_check
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+
+#include "hidpp.h"
+
+#define FAKE_INDEX 2        // the device answers here; the receiver errors elsewhere
+#define FAKE_REPROG 5       // feature indices of the fake device, 0 absent
+#define FAKE_DPI 6
+#define FAKE_THUMB 7
+#define FAKE_WIRELESS 8
+#define FAKE_BATTERY 9      // UNIFIED_BATTERY
+#define FAKE_DEVINFO 3
+#define FAKE_BATTERY_LEVEL 80
+#define THUMB_NATIVE_RES 18
+#define THUMB_DIVERTED_RES 100
+#define HIDPP10_ERR_UNKNOWN_DEVICE 0x08
+#define MAX_EVENTS 8
+
+static int checks;
+static int failed;
+
+static struct timer_wheel wheel;
+static struct hidpp_device dev;
+static int peer = -1;
+static atomic_bool serving;
+static int served; // requests the peer thread answered
+
+static int links[3];       // link callbacks, by state
+static int completions;    // async callbacks
+static int last_status;
+static uint8_t last_param; // params[0] of the last reply
+
+static void expect(bool ok, const char *what) {
+    checks++;
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        failed++;
+    }
+}
+
+static int feature_of(uint16_t id) {
+    switch (id) {
+    case HIDPP_FEATURE_ROOT:
+        return 0;
+    case HIDPP_FEATURE_DEVICE_INFORMATION:
+        return FAKE_DEVINFO;
+    case HIDPP_FEATURE_REPROG_CONTROLS_V4:
+        return FAKE_REPROG;
+    case HIDPP_FEATURE_ADJUSTABLE_DPI:
+        return FAKE_DPI;
+    case HIDPP_FEATURE_THUMBWHEEL:
+        return FAKE_THUMB;
+    case HIDPP_FEATURE_WIRELESS_STATUS:
+        return FAKE_WIRELESS;
+    case HIDPP_FEATURE_UNIFIED_BATTERY:
+        return FAKE_BATTERY;
+    default:
+        return 0; // SMART_SHIFT, BATTERY_STATUS: not on this device
+    }
+}
+
+// The script: what the fake device (or the receiver in front of it) says
+// to one request. Returns the reply length.
+static int answer(const uint8_t *req, int len, uint8_t *reply) {
+    uint8_t feature = req[2];
+    uint8_t function = req[3] >> 4;
+
+    memset(reply, 0, HIDPP_LONG_LEN);
+    if (req[1] != FAKE_INDEX) {
+        // HID++ 1.0 error from the receiver: sub id, address, error code
+        reply[0] = HIDPP_SHORT_REPORT;
+        reply[1] = req[1];
+        reply[2] = HIDPP10_ERROR;
+        reply[3] = req[2];
+        reply[4] = req[3];
+        reply[5] = HIDPP10_ERR_UNKNOWN_DEVICE;
+        return HIDPP_SHORT_LEN;
+    }
+    reply[0] = HIDPP_LONG_REPORT;
+    reply[1] = req[1];
+    reply[2] = req[2];
+    reply[3] = req[3];
+    if (feature == 0 && function == 1) {
+        reply[4] = 4; // protocol 4.2, ping echoed
+        reply[5] = 2;
+        reply[6] = req[6];
+    } else if (feature == 0 && function == 0) {
+        reply[4] = feature_of(req[4] << 8 | req[5]);
+    } else if (feature == FAKE_THUMB && function == 0) {
+        reply[4] = THUMB_NATIVE_RES >> 8;
+        reply[5] = THUMB_NATIVE_RES & 0xFF;
+        reply[6] = THUMB_DIVERTED_RES >> 8;
+        reply[7] = THUMB_DIVERTED_RES & 0xFF;
+    } else if (feature == FAKE_BATTERY) {
+        reply[4] = FAKE_BATTERY_LEVEL;
+    } else {
+        memcpy(&reply[4], &req[4], len - 4); // setters echo their parameters
+    }
+    return HIDPP_LONG_LEN;
+}
+
+// Answers everything while the blocking setup calls wait
+static void *peer_main(void *arg) {
+    while (atomic_load(&serving)) {
+        struct pollfd pfd = { .fd = peer, .events = POLLIN };
+        uint8_t req[HIDPP_LONG_LEN], reply[HIDPP_LONG_LEN];
+        ssize_t n;
+
+        if (poll(&pfd, 1, 10) <= 0) {
+            continue;
+        }
+        n = recv(peer, req, sizeof(req), 0);
+        if (n < HIDPP_SHORT_LEN) {
+            continue;
+        }
+        send(peer, reply, answer(req, (int)n, reply), 0);
+        served++;
+    }
+    return NULL;
+}
+
+// Next request the client put on the wire, 0 if none
+static int take_request(uint8_t *req) {
+    ssize_t n = recv(peer, req, HIDPP_LONG_LEN, MSG_DONTWAIT);
+
+    return n > 0 ? (int)n : 0;
+}
+
+static int drain(void) {
+    uint8_t req[HIDPP_LONG_LEN];
+    int count = 0;
+
+    while (take_request(req) > 0) {
+        count++;
+    }
+    return count;
+}
+
+// Send a report from the device side and let the client read and handle it
+static int deliver(const uint8_t *report, int len, struct input_event *out, int max) {
+    uint8_t buf[HIDPP_LONG_LEN];
+    ssize_t n;
+
+    send(peer, report, len, 0);
+    n = read(dev.fd, buf, sizeof(buf));
+    if (n <= 0) {
+        return -1;
+    }
+    return hidpp_handle_report(&dev, buf, (int)n, out, max);
+}
+
+static void respond(const uint8_t *req, int len) {
+    uint8_t reply[HIDPP_LONG_LEN];
+
+    deliver(reply, answer(req, len, reply), NULL, 0);
+}
+
+static void advance(int ms) {
+    timer_wheel_advance(&wheel, wheel.clock + ms);
+}
+
+static void on_complete(struct hidpp_device *d, int status, const struct hidpp_report *reply,
+                        void *ctx) {
+    completions++;
+    last_status = status;
+    last_param = reply ? reply->params[0] : 0;
+}
+
+static void on_link(struct hidpp_device *d, enum hidpp_link link, void *ctx) {
+    links[link]++;
+}
+
+static int notify(uint8_t feature, uint8_t event, const uint8_t *params, int params_len,
+                  struct input_event *out) {
+    uint8_t report[HIDPP_LONG_LEN] = { HIDPP_LONG_REPORT, FAKE_INDEX, feature, event << 4 };
+
+    memcpy(&report[4], params, params_len);
+    return deliver(report, HIDPP_LONG_LEN, out, MAX_EVENTS);
+}
+
+static bool is_event(const struct input_event *ev, int type, int code, int value) {
+    return ev->type == type && ev->code == code && ev->value == value;
+}
+
+static void check_cached_init(int fd) {
+    char path[] = "/tmp/hidpp_check.XXXXXX";
+    int cache_fd = mkstemp(path);
+    FILE *f = cache_fd >= 0 ? fdopen(cache_fd, "w") : NULL;
+
+    if (!f) {
+        perror("hidpp cache");
+        failed++;
+        return;
+    }
+    fprintf(f, "unknown/%d %02x 000000004082 RBM00.00_0000 1b04=%02x 2201=%02x\n",
+            FAKE_INDEX, FAKE_INDEX, FAKE_REPROG, FAKE_DPI);
+    fclose(f);
+
+    // A cache hit costs no round trip; the absent features are still asked for
+    atomic_store(&serving, true);
+    {
+        pthread_t thread;
+
+        pthread_create(&thread, NULL, peer_main, NULL);
+        expect(hidpp_init(&dev, fd, FAKE_INDEX, &wheel, BTN_FORWARD, path) == 0, "cached init");
+        atomic_store(&serving, false);
+        pthread_join(thread, NULL);
+    }
+    expect(dev.from_cache && dev.index == FAKE_INDEX, "cached entry used");
+    expect(dev.reprog_index == FAKE_REPROG && dev.dpi_index == FAKE_DPI, "cached indices");
+    expect(dev.thumb_index == FAKE_THUMB, "features missing from the entry looked up");
+    unlink(path);
+}
+
+static void check_setup(int fd) {
+    pthread_t thread;
+
+    atomic_store(&serving, true);
+    pthread_create(&thread, NULL, peer_main, NULL);
+
+    // Probing: index 1 errors from the receiver, the device answers at 2
+    expect(hidpp_init(&dev, fd, 0, &wheel, BTN_FORWARD, NULL) == 0, "probe finds the device");
+    expect(dev.index == FAKE_INDEX, "device index from the probe");
+    expect(dev.reprog_index == FAKE_REPROG && dev.dpi_index == FAKE_DPI &&
+           dev.thumb_index == FAKE_THUMB && dev.wireless_index == FAKE_WIRELESS,
+           "feature indices discovered");
+    expect(dev.smartshift_index == 0, "absent feature left at 0");
+    expect(dev.battery_feature == HIDPP_FEATURE_UNIFIED_BATTERY &&
+           dev.battery_index == FAKE_BATTERY, "unified battery preferred");
+
+    expect(hidpp_divert_gesture_button(&dev, true) == 0 && dev.diverted, "gesture button diverted");
+    expect(hidpp_divert_thumbwheel(&dev, true) == 0 && dev.thumb_diverted &&
+           dev.thumb_native_res == THUMB_NATIVE_RES &&
+           dev.thumb_diverted_res == THUMB_DIVERTED_RES, "thumb wheel diverted");
+
+    atomic_store(&serving, false);
+    pthread_join(thread, NULL);
+    expect(dev.sent_count == 0, "nothing left in flight after setup");
+}
+
+static void check_reply_matching(void) {
+    uint8_t req[HIDPP_LONG_LEN], reply[HIDPP_LONG_LEN];
+    uint8_t params[2] = { HIDPP_FEATURE_THUMBWHEEL >> 8, HIDPP_FEATURE_THUMBWHEEL & 0xFF };
+    int len;
+
+    completions = 0;
+    expect(hidpp_submit(&dev, 0, 0, params, sizeof(params), on_complete, NULL) > 0, "submit");
+    len = take_request(req);
+    expect(len == HIDPP_SHORT_LEN && req[1] == FAKE_INDEX && req[2] == 0 && (req[3] >> 4) == 0,
+           "getFeature on the wire");
+
+    // Same software id, other feature index: not this request's answer
+    answer(req, len, reply);
+    reply[2] = FAKE_DPI;
+    deliver(reply, HIDPP_LONG_LEN, NULL, 0);
+    expect(completions == 0, "reply for another feature ignored");
+
+    respond(req, len);
+    expect(completions == 1 && last_status == 0 && last_param == FAKE_THUMB, "reply completes");
+    respond(req, len);
+    expect(completions == 1, "duplicate reply ignored");
+
+    // HID++ 2.0 error: feature index 0xFF, then the request's feature and function
+    hidpp_submit(&dev, FAKE_DPI, 3, params, sizeof(params), on_complete, NULL);
+    len = take_request(req);
+    memset(reply, 0, sizeof(reply));
+    reply[0] = HIDPP_LONG_REPORT;
+    reply[1] = FAKE_INDEX;
+    reply[2] = HIDPP_ERROR_FEATURE;
+    reply[3] = req[2];
+    reply[4] = req[3];
+    reply[5] = 0x05;
+    deliver(reply, HIDPP_LONG_LEN, NULL, 0);
+    expect(completions == 2 && last_status == 0x05, "error reply completes with its code");
+}
+
+static void check_retries(void) {
+    uint8_t req[HIDPP_LONG_LEN];
+    uint8_t params[2] = { 0, 0 };
+    int sent, len, i;
+
+    completions = 0;
+    hidpp_submit(&dev, 0, 0, params, sizeof(params), on_complete, NULL);
+    len = take_request(req);
+    expect(len > 0, "first attempt sent");
+    for (i = 0; i < HIDPP_RETRIES; i++) {
+        advance(HIDPP_TIMEOUT_MS - 1);
+        expect(drain() == 0, "no resend before the timeout");
+        advance(2);
+        expect(drain() == 1, "resent after the timeout");
+    }
+    expect(completions == 0, "still waiting before the last timeout");
+    advance(HIDPP_TIMEOUT_MS + 1);
+    sent = drain();
+    expect(sent == 0 && completions == 1 && last_status == -1, "fails after the last retry");
+    expect(dev.sent_count == 0, "slot given back");
+
+    // Late answer to the abandoned request
+    respond(req, len);
+    expect(completions == 1, "late reply ignored");
+}
+
+static void check_window(void) {
+    uint8_t req[HIDPP_WINDOW + 2][HIDPP_LONG_LEN];
+    int len[HIDPP_WINDOW + 2];
+    uint8_t extra[HIDPP_LONG_LEN];
+    int i, n = 0;
+
+    completions = 0;
+    for (i = 0; i < HIDPP_WINDOW + 2; i++) {
+        uint8_t params[2] = { 0, (uint8_t)i };
+
+        hidpp_submit(&dev, 0, 0, params, sizeof(params), on_complete, NULL);
+    }
+    while (n < HIDPP_WINDOW + 2 && (len[n] = take_request(req[n])) > 0) {
+        n++;
+    }
+    expect(n == HIDPP_WINDOW, "only a window's worth on the wire");
+
+    // Each answer lets the oldest queued request out
+    respond(req[0], len[0]);
+    expect(take_request(extra) > 0 && extra[5] == HIDPP_WINDOW, "queued requests sent in order");
+    for (i = 1; i < n; i++) {
+        respond(req[i], len[i]);
+    }
+    respond(extra, HIDPP_SHORT_LEN);
+    len[0] = take_request(req[0]);
+    expect(len[0] > 0 && req[0][5] == HIDPP_WINDOW + 1, "last queued request sent");
+    respond(req[0], len[0]);
+    expect(completions == HIDPP_WINDOW + 2 && dev.sent_count == 0, "every request completed");
+}
+
+static void check_reprog_events(void) {
+    const uint8_t pressed[2] = { HIDPP_CID_GESTURE_BUTTON >> 8, HIDPP_CID_GESTURE_BUTTON & 0xFF };
+    const uint8_t released[2] = { 0, 0 };
+    const uint8_t motion[4] = { 0x00, 0x05, 0xFF, 0xFD }; // +5, -3
+    struct input_event out[MAX_EVENTS];
+    int n;
+
+    n = notify(FAKE_REPROG, 0, pressed, sizeof(pressed), out);
+    expect(n == 2 && is_event(&out[0], EV_KEY, BTN_FORWARD, 1) &&
+           is_event(&out[1], EV_SYN, SYN_REPORT, 0), "diverted press");
+    n = notify(FAKE_REPROG, 0, pressed, sizeof(pressed), out);
+    expect(n == 0, "repeated button report adds nothing");
+    n = notify(FAKE_REPROG, 1, motion, sizeof(motion), out);
+    expect(n == 3 && is_event(&out[0], EV_REL, REL_X, 5) && is_event(&out[1], EV_REL, REL_Y, -3),
+           "raw XY");
+    n = notify(FAKE_REPROG, 0, released, sizeof(released), out);
+    expect(n == 2 && is_event(&out[0], EV_KEY, BTN_FORWARD, 0), "diverted release");
+}
+
+static void check_thumbwheel(void) {
+    // rotation (int16), timestamp, rotation status, flags
+    uint8_t params[6] = { 0x00, 0x01, 0, 0, 0, 0x03 };
+    struct input_event out[MAX_EVENTS];
+    int n;
+
+    // 18 native notches, 100 diverted increments a turn: one increment is
+    // 21.6 hi-res units, the remainder carried to the next
+    n = notify(FAKE_THUMB, 0, params, sizeof(params), out);
+    expect(n == 4 && is_event(&out[0], EV_KEY, BTN_TOOL_FINGER, 1) &&
+           is_event(&out[1], EV_REL, REL_HWHEEL_HI_RES, 21) &&
+           is_event(&out[2], EV_KEY, BTN_TOUCH, 1), "thumb wheel touch and rotation");
+    n = notify(FAKE_THUMB, 0, params, sizeof(params), out);
+    expect(n == 2 && is_event(&out[0], EV_REL, REL_HWHEEL_HI_RES, 22), "remainder carried");
+
+    params[0] = 0xFF; // -1
+    params[1] = 0xFF;
+    params[5] = 0;
+    n = notify(FAKE_THUMB, 0, params, sizeof(params), out);
+    expect(n == 4 && is_event(&out[0], EV_KEY, BTN_TOOL_FINGER, 0) &&
+           is_event(&out[1], EV_REL, REL_HWHEEL_HI_RES, -21) &&
+           is_event(&out[2], EV_KEY, BTN_TOUCH, 0) && dev.thumb_rem == 0,
+           "lifting off drops the remainder");
+}
+
+static void check_status(void) {
+    const uint8_t battery[3] = { 55, 0, 1 }; // charging
+    const uint8_t reconnected[1] = { 1 };
+    uint8_t connection[HIDPP_SHORT_LEN] = { HIDPP_SHORT_REPORT, FAKE_INDEX,
+                                            HIDPP10_DEVICE_CONNECTION, 0x04, 0x40, 0, 0 };
+    const uint8_t pressed[2] = { HIDPP_CID_GESTURE_BUTTON >> 8, HIDPP_CID_GESTURE_BUTTON & 0xFF };
+    struct input_event out[MAX_EVENTS];
+    uint8_t req[HIDPP_LONG_LEN];
+    bool rediverted = false;
+    int len;
+
+    // One battery read at the start
+    expect(hidpp_watch_status(&dev, on_link, NULL) == 0, "watch status");
+    len = take_request(req);
+    expect(len > 0 && req[2] == FAKE_BATTERY, "battery read sent");
+    respond(req, len);
+    expect(dev.battery_level == FAKE_BATTERY_LEVEL && !dev.battery_charging, "battery read");
+
+    notify(FAKE_BATTERY, 0, battery, sizeof(battery), out);
+    expect(dev.battery_level == 55 && dev.battery_charging, "battery notification");
+
+    // Connected directly, the device only announces coming back
+    notify(FAKE_WIRELESS, 0, reconnected, sizeof(reconnected), out);
+    expect(dev.disconnects == 1 && dev.link == HIDPP_LINK_CONNECTED, "direct reconnection");
+    expect(links[HIDPP_LINK_DISCONNECTED] == 1 && links[HIDPP_LINK_CONNECTED] == 1,
+           "link callbacks for the implied drop");
+    while ((len = take_request(req)) > 0) {
+        rediverted |= req[2] == FAKE_REPROG && (req[3] >> 4) == 3 && req[6] & 0x01;
+        respond(req, len);
+    }
+    expect(rediverted, "diversion re-sent on reconnection");
+
+    // Behind a receiver, 0x41 reports both edges
+    notify(FAKE_REPROG, 0, pressed, sizeof(pressed), out);
+    expect(hidpp_handle_status(&dev, connection, sizeof(connection)), "connection notification");
+    expect(dev.link == HIDPP_LINK_DISCONNECTED && dev.disconnects == 2 && !dev.gesture_held &&
+           dev.receiver_link, "receiver reports the drop");
+    connection[4] = 0;
+    expect(deliver(connection, sizeof(connection), out, MAX_EVENTS) == 0 &&
+           dev.link == HIDPP_LINK_CONNECTED, "receiver reports the link back");
+    drain();
+    notify(FAKE_WIRELESS, 0, reconnected, sizeof(reconnected), out);
+    expect(dev.disconnects == 2 && links[HIDPP_LINK_DISCONNECTED] == 2,
+           "no second drop behind a receiver");
+    drain();
+}
+
+int main(void) {
+    int sv[2];
+    int saved_stdout;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+        perror("socketpair");
+        return 1;
+    }
+    peer = sv[1];
+    timer_wheel_init_manual(&wheel);
+
+    // The client reports what it finds on stdout; keep the summary readable
+    fflush(stdout);
+    saved_stdout = dup(STDOUT_FILENO);
+    freopen("/dev/null", "w", stdout);
+
+    check_cached_init(sv[0]);
+    check_setup(sv[0]);
+    check_reply_matching();
+    check_retries();
+    check_window();
+    check_reprog_events();
+    check_thumbwheel();
+    check_status();
+
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    close(sv[0]);
+    close(sv[1]);
+    printf("%d hidpp checks, %d failed\n", checks, failed);
+    return failed ? 1 : 0;
+}
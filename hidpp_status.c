@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "hidpp.h"
+
+// BATTERY_STATUS (0x1000): level, next level, status
+#define BATTERY_FN_GET_LEVEL_STATUS 0
+#define BATTERY_STATUS_RECHARGING 1
+#define BATTERY_STATUS_SLOW_RECHARGE 4
+
+// UNIFIED_BATTERY (0x1004): state of charge, level flags, charging status
+#define UNIFIED_FN_GET_STATUS 1
+#define UNIFIED_CHARGING 1
+#define UNIFIED_CHARGING_SLOW 2
+
+// WIRELESS_DEVICE_STATUS: status, request, reason
+#define WIRELESS_STATUS_RECONNECTION 1
+
+// HID++ 1.0 device connection flags
+#define CONNECTION_LINK_NOT_ESTABLISHED 0x40
+
+const char *hidpp_link_name(enum hidpp_link link) {
+    switch (link) {
+    case HIDPP_LINK_CONNECTED:
+        return "connected";
+    case HIDPP_LINK_DISCONNECTED:
+        return "disconnected";
+    default:
+        return "unknown";
+    }
+}
+
+// Both battery features put the percentage first and a status byte after;
+// replies and notifications share the layout
+static void update_battery(struct hidpp_device *dev, const uint8_t *params) {
+    int level = params[0];
+    bool charging;
+
+    if (dev->battery_feature == HIDPP_FEATURE_UNIFIED_BATTERY) {
+        charging = params[2] == UNIFIED_CHARGING || params[2] == UNIFIED_CHARGING_SLOW;
+    } else {
+        charging = params[2] >= BATTERY_STATUS_RECHARGING &&
+                   params[2] <= BATTERY_STATUS_SLOW_RECHARGE;
+    }
+
+    if (level != dev->battery_level || charging != dev->battery_charging) {
+        dev->battery_level = level;
+        dev->battery_charging = charging;
+        printf("Battery: %d%%%s\n", level, charging ? " (charging)" : "");
+    }
+}
+
+static void on_battery(struct hidpp_device *dev, int status,
+                       const struct hidpp_report *reply, void *ctx) {
+    if (status == 0) {
+        update_battery(dev, reply->params);
+    }
+}
+
+static void request_battery(struct hidpp_device *dev) {
+    uint8_t fn = dev->battery_feature == HIDPP_FEATURE_UNIFIED_BATTERY ?
+                 UNIFIED_FN_GET_STATUS : BATTERY_FN_GET_LEVEL_STATUS;
+
+    if (dev->battery_index) {
+        hidpp_submit(dev, dev->battery_index, fn, NULL, 0, on_battery, NULL);
+    }
+}
+
+static void set_link(struct hidpp_device *dev, enum hidpp_link link) {
+    if (link == dev->link) {
+        return;
+    }
+    dev->link = link;
+    printf("Mouse %s\n", hidpp_link_name(link));
+
+    if (link == HIDPP_LINK_DISCONNECTED) {
+        dev->disconnects++;
+        // Whatever was held is gone; the next report starts from scratch
+        dev->gesture_held = false;
+        dev->thumb_touch = false;
+        dev->thumb_proximity = false;
+        dev->thumb_rem = 0;
+    } else if (link == HIDPP_LINK_CONNECTED) {
+        hidpp_reapply(dev);
+        request_battery(dev);
+    }
+    if (dev->link_cb) {
+        dev->link_cb(dev, link, dev->link_ctx);
+    }
+}
+
+int hidpp_watch_status(struct hidpp_device *dev, hidpp_link_callback link_cb, void *ctx) {
+    dev->link_cb = link_cb;
+    dev->link_ctx = ctx;
+    dev->link = HIDPP_LINK_CONNECTED; // it just answered us
+    request_battery(dev);
+    return dev->battery_index ? 0 : -1;
+}
+
+bool hidpp_handle_status(struct hidpp_device *dev, const uint8_t *buf, int len) {
+    if (buf[0] == HIDPP_SHORT_REPORT && buf[2] == HIDPP10_DEVICE_CONNECTION) {
+        dev->receiver_link = true;
+        set_link(dev, (buf[4] & CONNECTION_LINK_NOT_ESTABLISHED) ?
+                      HIDPP_LINK_DISCONNECTED : HIDPP_LINK_CONNECTED);
+        return true;
+    }
+    if ((buf[3] & 0x0F) != 0) {
+        return false; // a reply, not a notification
+    }
+    if (dev->battery_index && buf[2] == dev->battery_index && (buf[3] >> 4) == 0) {
+        update_battery(dev, &buf[4]);
+        return true;
+    }
+    if (dev->wireless_index && buf[2] == dev->wireless_index && (buf[3] >> 4) == 0) {
+        // Devices connected directly report reconnection here rather than
+        // through a receiver
+        if (buf[4] == WIRELESS_STATUS_RECONNECTION) {
+            // A direct connection only announces coming back: count the
+            // drop it implies. Behind a receiver the connection
+            // notification has already reported both.
+            if (!dev->receiver_link) {
+                set_link(dev, HIDPP_LINK_DISCONNECTED);
+            }
+            set_link(dev, HIDPP_LINK_CONNECTED);
+        }
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,493 @@
+#define _GNU_SOURCE // F_SETPIPE_SZ, ppoll
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+
+#include "config.h"
+#include "input.h"
+
+#define RECEIVER_SLOTS 6   // device indices 1-6 on a Unifying/Bolt receiver
+#define SYNTH_IDLE_FRAMES 48 // plain motion frames per synthetic gesture
+
+// The HID++ device index of a node created by hid-logitech-dj, which ends
+// its phys with ":<index>" (e.g. "usb-0000:00:14.0-2/input2:1"); 0 if the
+// node is not behind a receiver
+static uint8_t phys_device_index(int fd) {
+    char phys[256] = "";
+    char *slash, *colon;
+    long index;
+
+    if (ioctl(fd, EVIOCGPHYS(sizeof(phys) - 1), phys) < 0) {
+        return 0;
+    }
+    slash = strrchr(phys, '/');
+    colon = strrchr(phys, ':');
+    if (!slash || !colon || colon < slash) {
+        return 0;
+    }
+    index = strtol(colon + 1, NULL, 10);
+    return index >= 1 && index <= RECEIVER_SLOTS ? (uint8_t)index : 0;
+}
+
+// Something that names this device and no other, for state kept across
+// restarts: its uniq, which hid-logitech-hidpp fills with the HID++ serial
+// (unit id) and Bluetooth with the address, else its phys, which at least
+// stays put while it is plugged into the same port. Blanks become '_' so
+// the id is one word.
+static void device_id(int fd, char *id, size_t size) {
+    char *c;
+
+    memset(id, 0, size);
+    if (ioctl(fd, EVIOCGUNIQ(size - 1), id) < 0 || !id[0]) {
+        memset(id, 0, size);
+        if (ioctl(fd, EVIOCGPHYS(size - 1), id) < 0) {
+            id[0] = '\0';
+        }
+    }
+    for (c = id; *c; c++) {
+        if (*c == ' ' || *c == '\t' || *c == '\n') {
+            *c = '_';
+        }
+    }
+}
+
+static void source_init(struct input_source *src, enum input_backend backend) {
+    memset(src, 0, sizeof(*src));
+    src->backend = backend;
+    src->fd = -1;
+    src->feed_fd = -1;
+    src->stop_fd = -1;
+    src->file_fd = -1;
+}
+
+static int open_evdev(struct input_source *srcs, int max) {
+    DIR *dir;
+    struct dirent *entry;
+    char device_path[512];
+    int count = 0;
+    char name[256];
+
+    dir = opendir("/dev/input");
+    if (!dir) {
+        perror("Cannot open /dev/input");
+        return -1;
+    }
+
+    printf("Looking for mouse devices: %s\n", MOUSE_NAME);
+
+    while ((entry = readdir(dir)) != NULL && count < max) {
+        if (strncmp(entry->d_name, "event", 5) == 0) {
+            int fd;
+
+            snprintf(device_path, sizeof(device_path), "/dev/input/%s", entry->d_name);
+            fd = open(device_path, O_RDONLY);
+
+            if (fd < 0) {
+                perror(device_path);
+                continue;
+            }
+
+            if (ioctl(fd, EVIOCGNAME(sizeof(name)), name) >= 0) {
+                printf("Checking device: %s (%s)\n", device_path, name);
+
+                if (strstr(name, MOUSE_NAME) != NULL) {
+                    struct input_source *src = &srcs[count++];
+
+                    source_init(src, INPUT_EVDEV);
+                    src->fd = fd;
+                    src->index = phys_device_index(fd);
+                    device_id(fd, src->id, sizeof(src->id));
+                    printf("Found '%s' mouse device: %s (device index %d)\n",
+                           MOUSE_NAME, device_path, src->index);
+                    // Gesture timing uses event timestamps; keep them monotonic
+                    int clk = CLOCK_MONOTONIC;
+                    ioctl(fd, EVIOCSCLOCKID, &clk);
+                    continue;
+                }
+            }
+
+            close(fd);
+        }
+    }
+
+    closedir(dir);
+
+    if (count == 0) {
+        fprintf(stderr, "ERROR: '%s' not found. Please verify the exact device name. Exiting.\n", MOUSE_NAME);
+        return -1;
+    }
+
+    return count;
+}
+
+// Wait until deadline unless asked to stop. Returns false on stop.
+static bool wait_until(struct input_source *src, const struct timespec *deadline) {
+    struct pollfd pfd = { .fd = src->stop_fd, .events = POLLIN };
+    struct timespec now, left;
+
+    for (;;) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        left.tv_sec = deadline->tv_sec - now.tv_sec;
+        left.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+        if (left.tv_nsec < 0) {
+            left.tv_sec--;
+            left.tv_nsec += 1000000000L;
+        }
+        if (left.tv_sec < 0) {
+            return true;
+        }
+        if (ppoll(&pfd, 1, &left, NULL) > 0) {
+            return false;
+        }
+    }
+}
+
+// Wait for the file to have data unless asked to stop; stdin may sit idle
+static bool wait_readable(struct input_source *src) {
+    struct pollfd fds[2] = {
+        { .fd = src->file_fd, .events = POLLIN },
+        { .fd = src->stop_fd, .events = POLLIN },
+    };
+
+    while (poll(fds, 2, -1) < 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    return !(fds[1].revents & POLLIN);
+}
+
+// Pipe writes up to PIPE_BUF are all or nothing, so as long as each one
+// holds whole events no read can end in the middle of one
+static bool feed(struct input_source *src, const struct input_event *ev, int count) {
+    const int per_write = PIPE_BUF / sizeof(*ev);
+
+    while (count > 0) {
+        int n = count < per_write ? count : per_write;
+
+        if (write(src->feed_fd, ev, n * sizeof(*ev)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false; // EPIPE: the loop closed its end
+        }
+        ev += n;
+        count -= n;
+    }
+    return true;
+}
+
+static void timespec_add_ns(struct timespec *ts, long long ns) {
+    ts->tv_sec += ns / 1000000000LL;
+    ts->tv_nsec += ns % 1000000000LL;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+// Paced replay: each frame waits until its SYN_REPORT is as far from the
+// start as it was in the recording
+struct pace {
+    struct timespec start;
+    struct timeval first;
+    bool have_first;
+};
+
+// Feed count recorded events, paced if the source asks for it. Returns
+// false once the loop is gone or asked to stop.
+static bool feed_recorded(struct input_source *src, struct pace *pace,
+                          const struct input_event *buf, int count) {
+    int from = 0;
+    int i;
+
+    for (i = 0; i < count && src->paced; i++) {
+        struct timespec due = pace->start;
+
+        if (!pace->have_first) {
+            pace->first = buf[i].time;
+            pace->have_first = true;
+        }
+        if (buf[i].type != EV_SYN || buf[i].code != SYN_REPORT) {
+            continue;
+        }
+        timespec_add_ns(&due, (buf[i].time.tv_sec - pace->first.tv_sec) * 1000000000LL +
+                              (buf[i].time.tv_usec - pace->first.tv_usec) * 1000LL);
+        if (!wait_until(src, &due) || !feed(src, buf + from, i + 1 - from)) {
+            return false;
+        }
+        from = i + 1;
+    }
+    return from == count || feed(src, buf + from, count - from);
+}
+
+// Copy a raw struct input_event stream into the pipe. Reads from a pipe
+// may end mid-event; the partial event waits for the rest.
+static void *replay_main(void *arg) {
+    struct input_source *src = arg;
+    struct input_event buf[INPUT_CHUNK];
+    struct pace pace = { .have_first = false };
+    size_t have = 0;
+    ssize_t n;
+
+    clock_gettime(CLOCK_MONOTONIC, &pace.start);
+    while (wait_readable(src) &&
+           ((n = read(src->file_fd, (char *)buf + have, sizeof(buf) - have)) > 0 ||
+            (n < 0 && errno == EINTR))) {
+        int count;
+
+        if (n < 0) {
+            continue;
+        }
+        have += n;
+        count = (int)(have / sizeof(buf[0]));
+        have -= count * sizeof(buf[0]);
+        if (!feed_recorded(src, &pace, buf, count)) {
+            break;
+        }
+        memmove(buf, buf + count, have);
+    }
+    close(src->feed_fd);
+    src->feed_fd = -1;
+    return NULL;
+}
+
+// The same from a compressed capture, decoded out of its mapping
+static void *capture_main(void *arg) {
+    struct input_source *src = arg;
+    struct input_event buf[INPUT_CHUNK];
+    struct pace pace = { .have_first = false };
+    struct capture_cursor cur;
+    int count;
+
+    clock_gettime(CLOCK_MONOTONIC, &pace.start);
+    capture_seek(&cur, &src->capture, 0);
+    while ((count = capture_read(&cur, buf, INPUT_CHUNK)) > 0 &&
+           feed_recorded(src, &pace, buf, count)) {
+    }
+    close(src->feed_fd);
+    src->feed_fd = -1;
+    return NULL;
+}
+
+static void put(struct input_event *ev, int *n, int type, int code, int value) {
+    ev[*n].type = type;
+    ev[*n].code = code;
+    ev[*n].value = value;
+    (*n)++;
+}
+
+// One synthetic gesture: BTN_FORWARD held over a little jitter and a wheel
+// detent (a chord, so no swipe and none of send_keys()' delay), then
+// plain motion. Returns the number of events.
+static int synth_cycle(struct input_event *ev) {
+    int n = 0;
+    int i;
+
+    put(ev, &n, EV_KEY, BTN_FORWARD, 1);
+    put(ev, &n, EV_SYN, SYN_REPORT, 0);
+    for (i = 0; i < 8; i++) {
+        put(ev, &n, EV_REL, REL_X, i & 1 ? -2 : 2);
+        put(ev, &n, EV_SYN, SYN_REPORT, 0);
+    }
+    put(ev, &n, EV_REL, REL_WHEEL, 1);
+    put(ev, &n, EV_REL, REL_WHEEL_HI_RES, 120);
+    put(ev, &n, EV_SYN, SYN_REPORT, 0);
+    put(ev, &n, EV_KEY, BTN_FORWARD, 0);
+    put(ev, &n, EV_SYN, SYN_REPORT, 0);
+    for (i = 0; i < SYNTH_IDLE_FRAMES; i++) {
+        put(ev, &n, EV_REL, REL_X, i & 1 ? -3 : 3);
+        put(ev, &n, EV_REL, REL_Y, i & 2 ? -2 : 2);
+        put(ev, &n, EV_SYN, SYN_REPORT, 0);
+    }
+    return n;
+}
+
+// Unpaced: whole cycles per batch, stamped with one clock read. Paced:
+// one frame at a time, each due when the events before it are.
+static void *synth_main(void *arg) {
+    struct input_source *src = arg;
+    struct input_event buf[INPUT_CHUNK];
+    unsigned long long produced = 0;
+    struct timespec start, now;
+    int cycle, count, from, i;
+
+    memset(buf, 0, sizeof(buf));
+    cycle = synth_cycle(buf);
+    for (count = cycle; count + cycle <= INPUT_CHUNK && src->rate == 0; count += cycle) {
+        memcpy(buf + count, buf, cycle * sizeof(buf[0]));
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (src->limit == 0 || produced < src->limit) {
+        for (from = 0; from < count; from = i) {
+            i = from;
+            if (src->rate > 0) {
+                struct timespec due = start;
+
+                timespec_add_ns(&due, (long long)(produced * 1000000000ULL / src->rate));
+                if (!wait_until(src, &due)) {
+                    goto done;
+                }
+                while (buf[i++].type != EV_SYN) {
+                }
+            } else {
+                i = count;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            for (int j = from; j < i; j++) {
+                buf[j].time.tv_sec = now.tv_sec;
+                buf[j].time.tv_usec = now.tv_nsec / 1000;
+            }
+            if (!feed(src, buf + from, i - from)) {
+                goto done;
+            }
+            produced += i - from;
+        }
+    }
+done:
+    close(src->feed_fd);
+    src->feed_fd = -1;
+    return NULL;
+}
+
+static int start_feeder(struct input_source *src, void *(*fn)(void *)) {
+    int pipefd[2];
+    int err;
+
+    if (pipe2(pipefd, O_CLOEXEC) < 0) {
+        perror("pipe");
+        return -1;
+    }
+    // A deep pipe lets the feeder run ahead of a busy loop; best effort
+    fcntl(pipefd[1], F_SETPIPE_SZ, INPUT_PIPE_SIZE);
+    src->fd = pipefd[0];
+    src->feed_fd = pipefd[1];
+    src->stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (src->stop_fd < 0) {
+        perror("eventfd");
+        input_close(src);
+        return -1;
+    }
+    err = pthread_create(&src->feeder, NULL, fn, src);
+    if (err != 0) {
+        fprintf(stderr, "Cannot start input thread: %s\n", strerror(err));
+        input_close(src);
+        return -1;
+    }
+    src->started = true;
+    return 0;
+}
+
+static int open_replay(struct input_source *src, const char *path, bool paced) {
+    source_init(src, INPUT_REPLAY);
+    src->paced = paced;
+    src->file_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (src->file_fd < 0) {
+        perror(path);
+        return -1;
+    }
+    if (capture_is_capture(src->file_fd)) {
+        close(src->file_fd);
+        src->file_fd = -1;
+        if (capture_open(&src->capture, path) < 0) {
+            return -1;
+        }
+        return start_feeder(src, capture_main);
+    }
+    return start_feeder(src, replay_main);
+}
+
+static int open_synth(struct input_source *src, const char *args) {
+    char *end = NULL;
+
+    source_init(src, INPUT_SYNTHETIC);
+    if (*args == ':') {
+        src->rate = strtol(args + 1, &end, 10);
+        if (*end == ':') {
+            src->limit = strtoull(end + 1, &end, 10);
+        }
+        if (*end != '\0' || src->rate < 0) {
+            return -1;
+        }
+    } else if (*args != '\0') {
+        return -1;
+    }
+    return start_feeder(src, synth_main);
+}
+
+int input_open(struct input_source *srcs, int max, const char *spec) {
+    if (max <= 0) {
+        fprintf(stderr, "Too many input sources.\n");
+        return -1;
+    }
+    if (strcmp(spec, "evdev") == 0) {
+        return open_evdev(srcs, max);
+    }
+    if (strcmp(spec, "stdin") == 0) {
+        // Through a feeder too: whoever writes our stdin may split events
+        source_init(srcs, INPUT_STDIN);
+        srcs->file_fd = dup(STDIN_FILENO);
+        return start_feeder(srcs, replay_main) < 0 ? -1 : 1;
+    }
+    if (strncmp(spec, "file:", 5) == 0) {
+        return open_replay(srcs, spec + 5, false) < 0 ? -1 : 1;
+    }
+    if (strncmp(spec, "replay:", 7) == 0) {
+        return open_replay(srcs, spec + 7, true) < 0 ? -1 : 1;
+    }
+    if (strncmp(spec, "synth", 5) == 0) {
+        return open_synth(srcs, spec + 5) < 0 ? -1 : 1;
+    }
+    return -1;
+}
+
+int input_get_keys(const struct input_source *src, unsigned long *keys, size_t size) {
+    memset(keys, 0, size);
+    if (!input_is_device(src)) {
+        return -1;
+    }
+    if (ioctl(src->fd, EVIOCGKEY(size), keys) < 0) {
+        perror("EVIOCGKEY");
+        return -1;
+    }
+    return 0;
+}
+
+void input_close(struct input_source *src) {
+    uint64_t one = 1;
+
+    // Closing our end first fails a blocked write with EPIPE; the stop
+    // eventfd ends a paced wait
+    if (src->fd >= 0) {
+        close(src->fd);
+        src->fd = -1;
+    }
+    if (src->started) {
+        write(src->stop_fd, &one, sizeof(one));
+        pthread_join(src->feeder, NULL);
+        src->started = false;
+    }
+    if (src->feed_fd >= 0) {
+        close(src->feed_fd);
+        src->feed_fd = -1;
+    }
+    if (src->stop_fd >= 0) {
+        close(src->stop_fd);
+        src->stop_fd = -1;
+    }
+    if (src->file_fd >= 0) {
+        close(src->file_fd);
+        src->file_fd = -1;
+    }
+    capture_free(&src->capture);
+}
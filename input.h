@@ -0,0 +1,69 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "capture.h"
+
+#define INPUT_PIPE_SIZE (1 << 20) // bytes buffered between a feeder and the loop
+#define INPUT_CHUNK 1024          // events a feeder reads or generates at once
+#define INPUT_ID_BYTES 64         // room for a device's uniq or phys string
+
+// Where a mouse's events come from
+enum input_backend {
+    INPUT_EVDEV,     // a real node under /dev/input
+    INPUT_STDIN,     // struct input_event stream on standard input
+    INPUT_REPLAY,    // a recording: raw (cat /dev/input/eventN > file) or capture.h
+    INPUT_SYNTHETIC, // generated gestures and motion
+};
+
+// Every backend hands the event loop a readable fd carrying struct
+// input_event, so poll(), the reader threads and io_uring all read it the
+// same way. Sources other than evdev are fed by a thread through a pipe,
+// in writes of whole events no larger than PIPE_BUF: those are atomic, so
+// like evdev every read returns whole events. End of input closes the
+// pipe, which the loop sees as the mouse going away.
+struct input_source {
+    enum input_backend backend;
+    int fd;             // read events here; -1 once closed
+    uint8_t index;      // HID++ device index, 0 if unknown
+    char id[INPUT_ID_BYTES]; // which device this is across restarts, "" if unknown
+
+    // Feeder thread: everything but evdev
+    int feed_fd;        // write end of the pipe
+    int stop_fd;        // eventfd that ends the feeder's waits
+    pthread_t feeder;
+    bool started;
+    int file_fd;        // stdin and raw replay: where the events are read from
+    struct capture capture; // compressed replay, mapped
+    bool paced;         // replay: keep the recorded spacing between frames
+    long rate;          // synthetic: events per second, 0 as fast as possible
+    unsigned long long limit; // synthetic: stop after this many events, 0 never
+};
+
+// Open the sources named by spec, at most max of them:
+//   evdev                  every node named MOUSE_NAME
+//   stdin                  events piped in on standard input
+//   file:PATH              a recording, as fast as the loop reads it
+//   replay:PATH            a recording, with its recorded timing
+// Recordings may be raw struct input_event or in the capture.h format.
+//   synth[:RATE[:COUNT]]   generated events; RATE per second (0 unpaced)
+// Returns the number opened or -1.
+int input_open(struct input_source *srcs, int max, const char *spec);
+
+// A real device: can be grabbed, mirrored and asked for its state
+static inline bool input_is_device(const struct input_source *src) {
+    return src->backend == INPUT_EVDEV;
+}
+
+// Current button state as an EVIOCGKEY bitmap of size bytes. Only a
+// device knows it; returns 0 or -1.
+int input_get_keys(const struct input_source *src, unsigned long *keys, size_t size);
+
+// Stop the feeder, if any, and close the fd
+void input_close(struct input_source *src);
+
+#endif
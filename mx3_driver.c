@@ -5,24 +5,69 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <linux/input.h>
-#include <linux/uinput.h>
-#include <dirent.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <time.h>
-
-#define MOUSE_NAME "Logitech USB Receiver Mouse"
-#define MOTION_THRESHOLD 50
-#define TAP_TIMEOUT 0.2  // seconds
-#define MAX_PATH_LEN 512 // Increased buffer size to prevent truncation
+#include <poll.h>
+#include <sys/ioctl.h>
+
+#include "adapt.h"
+#include "bindings.h"
+#include "capture.h"
+#include "config.h"
+#include "dispatch.h"
+#include "gesture.h"
+#include "hidpp.h"
+#include "input.h"
+#include "output.h"
+#include "precision.h"
+#include "realtime.h"
+#include "sink.h"
+#include "timer.h"
+#include "uring.h"
+
+#define EVENT_BATCH 64   // evdev events read per syscall
+#define MAX_MICE 6       // paired devices on one receiver
+
+// The defaults (bindings.c), modes changed by the options
+static struct gesture_binding bindings[DEFAULT_BINDING_COUNT];
+
+#define BINDING_COUNT (sizeof(bindings) / sizeof(bindings[0]))
+
+// One paired mouse: where its events come from, its HID++ device index on
+// the receiver, and gesture state and bindings of its own
+struct mouse {
+    struct input_source *input; // input->fd is -1 once it has gone away
+    uint8_t index; // HID++ device index from the node's phys, 0 if unknown
+    struct gesture_binding bindings[BINDING_COUNT];
+    struct gesture_engine engine;
+    struct precision_filter precision;
+    struct adapt adapt; // -a: thresholds learned from this mouse's presses
+    int passthrough_fd;
+    struct hidpp_device hidpp;
+    bool hidpp_ready;
+    bool cache_pending;
+    bool dropping;           // after SYN_DROPPED, until the next SYN_REPORT
+    unsigned long overflows; // SYN_DROPPED seen: events lost before we read them
+};
 
 volatile sig_atomic_t keep_running = 1;
+volatile sig_atomic_t status_requested = 0;
+static bool dpi_from_cli = false; // -d given: don't override with the sensor's DPI
+static int mice_left;              // mice whose node is still open
+static struct timer_wheel timers;  // every deadline in the daemon
+static struct timer cache_timer;   // feature cache check, pushed back by input
+static struct capture_writer capture; // -W: every input event, compressed
+static struct timer capture_timer;  // seals the capture's block while idle
+static bool capturing;
+static const char *adapt_path;      // -a: NULL not learning, "" learning without saving
+static struct adapt *adapts[MAX_MICE];
+static int adapt_count;
+static struct timer adapt_timer;    // writes learned thresholds out now and then
 
 // Function prototypes
-int open_mouse_device(void);
-int setup_uinput_device(void);
-void send_keys(int fd, const int keys[], int key_count);
-double get_time_diff_seconds(struct timespec start, struct timespec end);
+int parse_button(const char *arg, const char **value);
+struct gesture_binding *find_binding(int button);
 
 // Signal handler to enable clean shutdown
 void signal_handler(int signal) {
@@ -30,263 +75,885 @@ void signal_handler(int signal) {
     keep_running = 0;
 }
 
-int main() {
-    struct input_event ev;
-    int mouse_fd, uinput_fd;
-    bool btn_forward_pressed = false;
-    bool motion_detected = false;
-    int current_x = 0, current_y = 0;
-    struct timespec btn_press_time, current_time;
+// Sniper mode: engine -> HID++ ADJUSTABLE_DPI, never blocking the loop
+static void sniper_dpi(void *ctx, int dpi) {
+    struct hidpp_device *dev = ctx;
+    hidpp_set_dpi(dev, dpi > 0 ? dpi : dev->base_dpi);
+}
 
-    // Set up signal handlers
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
-    signal(SIGHUP, signal_handler);
+static void sensor_dpi_detected(struct hidpp_device *dev, int dpi, void *ctx) {
+    struct gesture_engine *engine = ctx;
 
-    // Open the mouse device
-    mouse_fd = open_mouse_device();
-    if (mouse_fd < 0) {
-        return 1;
+    if (dpi > 0) {
+        printf("Sensor resolution: %d DPI\n", dpi);
+        if (!dpi_from_cli) {
+            gesture_engine_set_dpi(engine, dpi);
+        }
     }
+}
 
-    // Create virtual keyboard
-    uinput_fd = setup_uinput_device();
-    printf("Monitoring mouse events... Press Ctrl+C to stop.\n");
+// SIGUSR1 asks for a status dump on stdout
+void status_signal_handler(int signal) {
+    status_requested = 1;
+}
 
-    // Switch to blocking mode for the main read loop
-    int flags = fcntl(mouse_fd, F_GETFL, 0);
-    fcntl(mouse_fd, F_SETFL, flags & ~O_NONBLOCK);
+// A dropped link leaves no release events behind; cancel anything held so
+// it cannot complete against presses from before the disconnect
+static void link_changed(struct hidpp_device *dev, enum hidpp_link link, void *ctx) {
+    struct gesture_engine *engine = ctx;
 
-    // Main event loop
-    while (keep_running) {
-        ssize_t bytes_read = read(mouse_fd, &ev, sizeof(struct input_event));
-        
-        if (bytes_read < 0) {
-            if (errno == EINTR) {
-                continue; // Signal interrupted the read, try again
+    if (link == HIDPP_LINK_DISCONNECTED) {
+        gesture_engine_release_all(engine);
+    }
+}
+
+// Learned thresholds take effect from the next press
+static void press_finished(void *ctx, const struct gesture_press *press) {
+    struct mouse *mouse = ctx;
+
+    if (adapt_press(&mouse->adapt, press)) {
+        gesture_engine_set_params(&mouse->engine, &mouse->adapt.params);
+    }
+}
+
+static void save_adapt(void) {
+    int i;
+
+    for (i = 0; i < adapt_count; i++) {
+        if (adapts[i]->dirty) {
+            adapt_save(adapt_path, adapts, adapt_count);
+            return;
+        }
+    }
+}
+
+static void adapt_due(struct timer *t, void *ctx) {
+    save_adapt();
+    timer_add(&timers, t, ADAPT_SAVE_MS);
+}
+
+static void print_status(const struct mouse *mouse) {
+    const struct gesture_engine *engine = &mouse->engine;
+    const struct hidpp_device *hidpp = &mouse->hidpp;
+
+    printf("--- status: mouse %d ---\n", mouse->index);
+    if (mouse->hidpp_ready) {
+        printf("link: %s (%u disconnects)\n", hidpp_link_name(hidpp->link), hidpp->disconnects);
+        if (hidpp->battery_level >= 0) {
+            printf("battery: %d%%%s\n", hidpp->battery_level,
+                   hidpp->battery_charging ? " charging" : "");
+        } else {
+            printf("battery: unknown\n");
+        }
+        printf("sensor dpi: %d (base %d)\n", hidpp->current_dpi, hidpp->base_dpi);
+        printf("hid++ requests in flight: %d\n", hidpp->sent_count);
+    } else {
+        printf("link: evdev only\n");
+    }
+    printf("gesture dpi: %d (arm %d, cancel %d, step %d counts)\n", engine->dpi,
+           engine->arm_counts, engine->cancel_counts, engine->step_counts);
+    if (adapt_path) {
+        const struct adapt *a = &mouse->adapt;
+
+        printf("learned: tap timeout %d ms (p%.0f hold %.0f ms), arm %.1f mm (p%.0f drift %.2f mm),"
+               " %llu still presses\n", a->params.tap_timeout_ms, ADAPT_QUANTILE * 100,
+               p2_value(&a->hold), a->params.arm_mm, ADAPT_QUANTILE * 100, p2_value(&a->jitter),
+               (unsigned long long)a->hold.count);
+    }
+    printf("buttons held: 0x%x\n", engine->held);
+    printf("evdev overflows: %lu\n", mouse->overflows);
+    fflush(stdout);
+}
+
+// Verify the feature caches once the mice have been idle for
+// CACHE_SYNC_DELAY_MS, one mouse per expiry
+static void cache_sync_due(struct timer *t, void *ctx) {
+    struct mouse *mice = ctx;
+    bool started = false;
+    bool pending = false;
+    int m;
+
+    for (m = 0; m < MAX_MICE; m++) {
+        if (!mice[m].cache_pending) {
+            continue;
+        }
+        if (!started && mice[m].hidpp.sent_count == 0) {
+            hidpp_cache_sync(&mice[m].hidpp);
+            mice[m].cache_pending = false;
+            started = true;
+        } else {
+            pending = true;
+        }
+    }
+    if (pending) {
+        timer_add(&timers, t, CACHE_SYNC_DELAY_MS);
+    }
+}
+
+// At most CAPTURE_BLOCK_MS of input is ever only in memory
+static void capture_due(struct timer *t, void *ctx) {
+    capture_flush(&capture);
+    timer_add(&timers, t, CAPTURE_BLOCK_MS);
+}
+
+static void postpone_cache_sync(void) {
+    if (timer_pending(&cache_timer)) {
+        timer_add(&timers, &cache_timer, CACHE_SYNC_DELAY_MS);
+    }
+}
+
+// Feed a run of intact events to a mouse's engine and passthrough
+static void feed_events(struct mouse *mouse, struct input_event *events, int count) {
+    int out = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        gesture_engine_event(&mouse->engine, &events[i]);
+    }
+
+    // Passthrough: filter in place, then one write for the batch
+    if (mouse->passthrough_fd >= 0) {
+        for (i = 0; i < count; i++) {
+            if (precision_filter_event(&mouse->precision, &events[i])) {
+                events[out++] = events[i];
             }
-            perror("Error reading from mouse device");
-            break;
         }
-        
-        if (bytes_read != sizeof(struct input_event)) {
+        if (out > 0) {
+            output_write(mouse->passthrough_fd, events, out);
+        }
+    }
+}
+
+// Button state after lost events, from the device if it can tell. A button
+// diverted over HID++ is not on the node, so its own state stands in.
+static void mouse_resync(struct mouse *mouse) {
+    unsigned long keys[KEY_LONGS];
+    struct precision_filter *pf = &mouse->precision;
+    struct input_event sync[BTN_TASK - BTN_MOUSE + 2];
+    int n = 0;
+    int code;
+
+    input_get_keys(mouse->input, keys, sizeof(keys)); // all up if unknown
+    if (mouse->hidpp_ready) {
+        code = mouse->hidpp.gesture_code;
+        keys[code / KEY_BITS_LONG] &= ~(1UL << (code % KEY_BITS_LONG));
+        if (mouse->hidpp.gesture_held) {
+            keys[code / KEY_BITS_LONG] |= 1UL << (code % KEY_BITS_LONG);
+        }
+    }
+
+    gesture_engine_resync(&mouse->engine, keys);
+
+    if (mouse->passthrough_fd < 0) {
+        return;
+    }
+    // Restate every mouse button on the mirror; the input core drops the
+    // ones whose state did not change
+    for (code = BTN_MOUSE; code <= BTN_TASK; code++) {
+        struct input_event ev = { .type = EV_KEY, .code = code };
+
+        ev.value = keys[code / KEY_BITS_LONG] >> (code % KEY_BITS_LONG) & 1;
+        if (code == pf->button) {
+            if (ev.value != pf->held) {
+                precision_filter_event(pf, &ev);
+            }
             continue;
         }
+        sync[n++] = ev;
+    }
+    sync[n].type = EV_SYN;
+    sync[n].code = SYN_REPORT;
+    sync[n].value = 0;
+    output_write(mouse->passthrough_fd, sync, n + 1);
+}
 
-        if (ev.type == EV_KEY && ev.code == BTN_FORWARD) {
-            if (ev.value == 1) {  // Button pressed
-                btn_forward_pressed = true;
-                motion_detected = false;
-                current_x = 0;
-                current_y = 0;
-                clock_gettime(CLOCK_MONOTONIC, &btn_press_time);
-                // printf("DEBUG: BTN_FORWARD pressed. Motion accumulators reset.\n");
-            } else if (ev.value == 0) {  // Button released
-                btn_forward_pressed = false;
-                
-                // Now apply actions ONLY on release, based on accumulated motion
-                if (motion_detected) {
-                    if (abs(current_x) > abs(current_y)) {
-                        if (current_x > 0) {
-                            // Mouse moved right
-                            int keys[] = {KEY_LEFTMETA, KEY_LEFTBRACE};
-                            send_keys(uinput_fd, keys, 2);
-                        } else {
-                            // Mouse moved left
-                            int keys[] = {KEY_LEFTMETA, KEY_RIGHTBRACE};
-                            send_keys(uinput_fd, keys, 2);
-                        }
-                    } else {
-                        if (current_y > 0) {
-                            // Mouse moved down
-                        } else {
-                            // Mouse moved up
-                        }
-                    }
-                } else {
-                    // No motion detected - just a tap
-                    clock_gettime(CLOCK_MONOTONIC, &current_time);
-                    double press_duration = get_time_diff_seconds(btn_press_time, current_time);
-                    
-                    if (press_duration < TAP_TIMEOUT) {
-                        // printf("ACTION: BTN_FORWARD - Just a Tap! (Sending Left Meta Key)\n");
-                        int keys[] = {KEY_LEFTMETA};
-                        send_keys(uinput_fd, keys, 1);
-                    } else {
-                        // printf("ACTION: BTN_FORWARD - Long Press Detected (Duration: %.2fs, no gesture).\n", press_duration);
-                    }
-                }
-                
-                // Reset for next gesture
-                current_x = 0;
-                current_y = 0;
-                motion_detected = false;
-            }
-        } else if (ev.type == EV_REL && btn_forward_pressed) {
-            if (ev.code == REL_X) {
-                current_x += ev.value;
-                if (abs(current_x) > MOTION_THRESHOLD) {
-                    motion_detected = true;
-                }
-            } else if (ev.code == REL_Y) {
-                current_y += ev.value;
-                if (abs(current_y) > MOTION_THRESHOLD) {
-                    motion_detected = true;
-                }
+// Feed one read() worth of events. On SYN_DROPPED the kernel has thrown
+// events away: everything up to the next SYN_REPORT is a partial frame
+// and discarded, then button state is resynced.
+static void mouse_events(struct mouse *mouse, struct input_event *events, int count) {
+    int start = 0;
+    int i;
+
+    postpone_cache_sync();
+    if (capturing) {
+        capture_write(&capture, events, count); // as read, SYN_DROPPED included
+    }
+
+    for (i = 0; i < count; i++) {
+        const struct input_event *ev = &events[i];
+
+        if (mouse->dropping) {
+            if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+                mouse->dropping = false;
+                mouse_resync(mouse);
             }
+            start = i + 1;
+        } else if (ev->type == EV_SYN && ev->code == SYN_DROPPED) {
+            feed_events(mouse, events + start, i - start);
+            mouse->dropping = true;
+            mouse->overflows++;
+            start = i + 1;
         }
     }
+    feed_events(mouse, events + start, count - start);
+}
+
+// Events synthesized from HID++ notifications (the diverted button and
+// its raw motion). They are whole frames that never carry SYN_DROPPED, and
+// they stay off the passthrough mirror: diverted motion must not move the
+// pointer. The capture still needs them, or a replay would miss exactly
+// the presses the engine saw.
+static void hidpp_events(struct mouse *mouse, const struct input_event *events, int count) {
+    int i;
 
-    if (uinput_fd >= 0) {
-        ioctl(uinput_fd, UI_DEV_DESTROY);
-        close(uinput_fd);
-        printf("Virtual keyboard device closed.\n");
+    if (capturing && count > 0) {
+        capture_write(&capture, events, count);
+    }
+    for (i = 0; i < count; i++) {
+        gesture_engine_event(&mouse->engine, &events[i]);
     }
-    
-    printf("Script terminated.\n");
-    return 0;
 }
 
-int open_mouse_device(void) {
-    DIR *dir;
-    struct dirent *entry;
-    char device_path[MAX_PATH_LEN]; // Using increased buffer size
-    int fd = -1;
-    char name[256];
+static void mouse_gone(struct mouse *mouse) {
+    fprintf(stderr, "Mouse %d went away.\n", mouse->index);
+    gesture_engine_release_all(&mouse->engine);
+    input_close(mouse->input);
+    if (--mice_left == 0) {
+        keep_running = 0;
+    }
+}
 
-    dir = opendir("/dev/input");
-    if (!dir) {
-        perror("Cannot open /dev/input");
-        return -1;
+// Threaded mode: a frame from mice[source]'s reader
+static void frame_arrived(void *ctx, int source, struct frame *frame) {
+    struct mouse *mice = ctx;
+
+    if (frame->count < 0) {
+        mouse_gone(&mice[source]);
+    } else {
+        mouse_events(&mice[source], frame->events, frame->count);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    struct input_event events[EVENT_BATCH];
+    static struct mouse mice[MAX_MICE];
+    static struct input_source inputs[MAX_MICE];
+    static struct output_sink keyboard; // injected keys, shared by all mice
+    const char *output_spec = "uinput";
+    const char *capture_path = NULL;
+    const char *input_specs[MAX_MICE];
+    int input_spec_count = 0;
+    static struct mouse *by_index[256]; // HID++ device index -> mouse
+    static struct dispatcher disp;
+    static struct uring_loop uring;
+    bool threaded = false;
+    bool use_uring = false;
+    struct realtime_config rt = { 0 };
+    bool realtime = false;
+    int mouse_count;
+    int hidpp_ready_count = 0;
+    int hidraw_fd = -1;
+    bool use_hidpp = false;
+    const char *cache_path = FEATURE_CACHE_PATH;
+    bool thumb_tabs = false;
+    bool sniper = false;
+    int smartshift = 0;
+    struct gesture_binding *binding;
+    struct precision_filter precision;
+    const char *value;
+    int button;
+    int dpi = DEFAULT_DPI;
+    int exit_code = 0;
+    int opt;
+    int m;
+
+    precision_init(&precision, -1, PRECISION_ONE);
+    memcpy(bindings, default_bindings, sizeof(bindings));
+
+    while ((opt = getopt(argc, argv, "stTUHI:O:W:C:a:d:S:P:R:L:A:h")) != -1) {
+        switch (opt) {
+        case 'O':
+            output_spec = optarg;
+            break;
+        case 'W':
+            capture_path = optarg;
+            break;
+        case 'I':
+            if (input_spec_count == MAX_MICE) {
+                fprintf(stderr, "At most %d input sources.\n", MAX_MICE);
+                return 1;
+            }
+            input_specs[input_spec_count++] = optarg;
+            break;
+        case 'L':
+            if (realtime_parse_policy(&rt, optarg) < 0) {
+                fprintf(stderr, "Invalid real-time policy: %s (expected fifo:PRIO or rr:PRIO)\n", optarg);
+                return 1;
+            }
+            realtime = true;
+            break;
+        case 'A':
+            if (realtime_parse_cpus(&rt, optarg) < 0) {
+                fprintf(stderr, "Invalid CPU list: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'R':
+            smartshift = atoi(optarg);
+            if (smartshift < 1 || smartshift > 255) {
+                fprintf(stderr, "Invalid SmartShift threshold: %s (1-255)\n", optarg);
+                return 1;
+            }
+            break;
+        case 'S':
+            button = parse_button(optarg, &value);
+            binding = button >= 0 ? find_binding(button) : NULL;
+            if (!binding || atoi(value) <= 0) {
+                fprintf(stderr, "Invalid sniper binding: %s (expected BUTTON:DPI)\n", optarg);
+                return 1;
+            }
+            binding->mode = GESTURE_SNIPER;
+            binding->dpi = atoi(value);
+            sniper = true;
+            break;
+        case 'P': {
+            // Parsed once here so the per-event path stays integer-only
+            double factor;
+
+            button = parse_button(optarg, &value);
+            factor = button >= 0 ? atof(value) : 0;
+            if (factor <= 0 || factor > 16) {
+                fprintf(stderr, "Invalid precision binding: %s (expected BUTTON:FACTOR)\n", optarg);
+                return 1;
+            }
+            precision_init(&precision, button, (int32_t)(factor * PRECISION_ONE + 0.5));
+            break;
+        }
+        case 'C':
+            cache_path = optarg[0] ? optarg : NULL;
+            break;
+        case 'a':
+            adapt_path = optarg;
+            break;
+        case 'H':
+            use_hidpp = true;
+            break;
+        case 'd':
+            dpi = atoi(optarg);
+            if (dpi <= 0) {
+                fprintf(stderr, "Invalid DPI: %s\n", optarg);
+                return 1;
+            }
+            dpi_from_cli = true;
+            break;
+        case 's':
+            bindings[0].mode = GESTURE_SWITCHER;
+            break;
+        case 't':
+            thumb_tabs = true;
+            break;
+        case 'T':
+            threaded = true;
+            break;
+        case 'U':
+            use_uring = true;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-s] [-t] [-T | -U] [-H] [-C CACHE] [-d DPI] [-S BUTTON:DPI] [-P BUTTON:FACTOR]\n"
+                            "       [-R THRESHOLD] [-L POLICY:PRIO [-A CPUS]] [-I SOURCE]... [-O SINK]\n"
+                            "       [-W CAPTURE] [-a STATE]\n",
+                    argv[0]);
+            fprintf(stderr, "  -s  use the gesture button as an Alt-Tab window switcher\n");
+            fprintf(stderr, "  -t  use the thumb wheel to switch tabs (diverted for finer steps with -H)\n");
+            fprintf(stderr, "  -T  read each mouse on its own thread, dispatching from this one\n");
+            fprintf(stderr, "  -U  io_uring event loop: posted reads, batched writes (poll() if unavailable)\n");
+            fprintf(stderr, "  -H  divert the gesture button over HID++ instead of relying on BTN_FORWARD\n");
+            fprintf(stderr, "  -C  HID++ feature cache file, empty to disable (default %s)\n",
+                    FEATURE_CACHE_PATH);
+            fprintf(stderr, "  -d  sensor resolution, for converting thresholds from mm (default %d,\n"
+                            "      or the sensor's own with -H)\n", DEFAULT_DPI);
+            fprintf(stderr, "  -S  sniper mode: drop to DPI while BUTTON (forward, side, extra, middle)\n"
+                            "      is held; needs -H\n");
+            fprintf(stderr, "  -P  precision mode: grab the mouse and scale its motion by FACTOR\n"
+                            "      while BUTTON is held\n");
+            fprintf(stderr, "  -R  SmartShift: free-spin the wheel above THRESHOLD (1-254, 255 = always\n"
+                            "      ratchet); needs -H\n");
+            fprintf(stderr, "  -L  low-latency mode: lock memory and run as fifo or rr at PRIO (1-99)\n");
+            fprintf(stderr, "  -A  with -L, run only on these CPUs (e.g. 2 or 2,3)\n");
+            fprintf(stderr, "  -I  where mice come from, once per source (default evdev):\n"
+                            "      evdev, stdin, file:PATH (as fast as possible), replay:PATH\n"
+                            "      (recorded timing), synth[:RATE[:COUNT]] (events/s, 0 unpaced)\n");
+            fprintf(stderr, "  -O  where injected keys go: uinput (default), null, memory or\n"
+                            "      trace:PATH (input_event stream for comparing runs)\n");
+            fprintf(stderr, "  -W  record all mouse input to CAPTURE, compressed (about 3 bytes an\n"
+                            "      event); play it back with -I file: or replay:\n");
+            fprintf(stderr, "  -a  learn tap timeout and arm distance from your own taps, kept in\n"
+                            "      STATE across restarts (e.g. %s; empty: not kept)\n", ADAPT_STATE_PATH);
+            fprintf(stderr, "Send SIGUSR1 for a status summary (link, battery, DPI) on stdout.\n");
+            return opt == 'h' ? 0 : 1;
+        }
     }
 
-    printf("Looking for mouse device: %s\n", MOUSE_NAME);
+    // Set up signal handlers
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGHUP, signal_handler);
+    signal(SIGUSR1, status_signal_handler);
+    signal(SIGPIPE, SIG_IGN); // a feeder writing to a closed pipe gets EPIPE instead
+
+    // Without uinput, keep running as before; the keys just go nowhere
+    if (sink_open(&keyboard, output_spec) < 0 && strcmp(output_spec, "uinput") != 0) {
+        fprintf(stderr, "Cannot open output %s\n", output_spec);
+        return 1;
+    }
 
-    while ((entry = readdir(dir)) != NULL) {
-        if (strncmp(entry->d_name, "event", 5) == 0) {
-            snprintf(device_path, sizeof(device_path), "/dev/input/%s", entry->d_name);
-            fd = open(device_path, O_RDONLY);
-            
-            if (fd < 0) {
-                perror(device_path);
-                continue;
+    // evdev opens every matching node; a receiver exposes one per paired mouse
+    if (input_spec_count == 0) {
+        input_specs[input_spec_count++] = "evdev";
+    }
+    mouse_count = 0;
+    for (m = 0; m < input_spec_count; m++) {
+        int opened = input_open(&inputs[mouse_count], MAX_MICE - mouse_count, input_specs[m]);
+
+        if (opened < 0) {
+            fprintf(stderr, "Cannot open input %s\n", input_specs[m]);
+            for (m = 0; m < mouse_count; m++) {
+                input_close(&inputs[m]);
             }
-            
-            if (ioctl(fd, EVIOCGNAME(sizeof(name)), name) >= 0) {
-                printf("Checking device: %s (%s)\n", device_path, name);
-                
-                if (strstr(name, MOUSE_NAME) != NULL) {
-                    printf("Found '%s' mouse device: %s\n", MOUSE_NAME, device_path);
-                    break;
+            sink_close(&keyboard);
+            return 1;
+        }
+        mouse_count += opened;
+    }
+    for (m = 0; m < mouse_count; m++) {
+        mice[m].input = &inputs[m];
+        mice[m].index = inputs[m].index;
+    }
+    mice_left = mouse_count;
+
+    if (timer_wheel_init(&timers) < 0) {
+        return 1;
+    }
+    timer_init(&cache_timer, cache_sync_due, mice);
+    timer_init(&capture_timer, capture_due, NULL);
+    timer_init(&adapt_timer, adapt_due, NULL);
+    if (adapt_path && adapt_path[0]) {
+        timer_add(&timers, &adapt_timer, ADAPT_SAVE_MS);
+    }
+    if (capture_path) {
+        if (capture_create(&capture, capture_path) < 0) {
+            return 1;
+        }
+        capturing = true;
+        timer_add(&timers, &capture_timer, CAPTURE_BLOCK_MS);
+    }
+
+    for (m = 0; m < mouse_count; m++) {
+        struct mouse *mouse = &mice[m];
+
+        mouse->passthrough_fd = -1;
+        mouse->precision = precision;
+
+        // Precision mode re-emits every event, so it needs the mouse to
+        // itself. Other sources reach no one else and need no mirror.
+        if (precision.button >= 0 && input_is_device(mouse->input)) {
+            mouse->passthrough_fd = setup_uinput_mirror(mouse->input->fd);
+            if (mouse->passthrough_fd < 0 || ioctl(mouse->input->fd, EVIOCGRAB, 1) < 0) {
+                perror("Cannot grab mouse for precision mode");
+                if (mouse->passthrough_fd >= 0) {
+                    destroy_uinput_device(mouse->passthrough_fd);
                 }
+                mouse->passthrough_fd = -1;
+                keep_running = 0;
+                exit_code = 1;
+                break;
             }
-            
-            close(fd);
-            fd = -1;
+        }
+
+        memcpy(mouse->bindings, bindings, sizeof(bindings));
+        gesture_engine_init(&mouse->engine, &keyboard, mouse->bindings, BINDING_COUNT);
+        gesture_engine_set_dpi(&mouse->engine, dpi);
+        gesture_engine_set_timers(&mouse->engine, &timers);
+        if (thumb_tabs) {
+            gesture_engine_set_thumbwheel(&mouse->engine, &thumbwheel_tabs);
+        }
+        if (adapt_path) {
+            char id[ADAPT_ID_BYTES];
+
+            // Learned thresholds follow the device, not the order it was
+            // found in; only a source with no identity falls back to its index
+            if (mouse->input->id[0]) {
+                snprintf(id, sizeof(id), "%s", mouse->input->id);
+            } else {
+                snprintf(id, sizeof(id), "%u", mouse->index);
+            }
+            adapt_init(&mouse->adapt, id);
+            if (adapt_path[0] && adapt_load(&mouse->adapt, adapt_path) == 0) {
+                printf("Mouse %d (%s): learned tap timeout %d ms, arm distance %.1f mm\n",
+                       mouse->index, id, mouse->adapt.params.tap_timeout_ms,
+                       mouse->adapt.params.arm_mm);
+                gesture_engine_set_params(&mouse->engine, &mouse->adapt.params);
+            }
+            gesture_engine_set_press_handler(&mouse->engine, press_finished, mouse);
+            adapts[adapt_count++] = &mouse->adapt;
         }
     }
 
-    closedir(dir);
+    // Divert the real gesture button; its presses and raw motion then come
+    // from HID++ notifications and appear to the engine as BTN_FORWARD
+    if (use_hidpp && keep_running) {
+        struct timespec start, ready;
 
-    if (fd < 0) {
-        fprintf(stderr, "ERROR: '%s' not found. Please verify the exact device name. Exiting.\n", MOUSE_NAME);
-        return -1;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        hidraw_fd = hidpp_open();
+
+        // Blocking setup first, for every mouse: a synchronous request
+        // drops reports addressed to other device indices, which would
+        // otherwise cost earlier mice their asynchronous replies
+        for (m = 0; hidraw_fd >= 0 && m < mouse_count; m++) {
+            struct mouse *mouse = &mice[m];
+
+            if (hidpp_init(&mouse->hidpp, hidraw_fd, mouse->index, &timers, BTN_FORWARD, cache_path) < 0 ||
+                hidpp_divert_gesture_button(&mouse->hidpp, true) < 0) {
+                fprintf(stderr, "Mouse %d: HID++ unavailable, using BTN_FORWARD from evdev.\n",
+                        mouse->index);
+                continue;
+            }
+            // Two nodes without a known index may find the same device
+            if (by_index[mouse->hidpp.index]) {
+                continue;
+            }
+            mouse->hidpp_ready = true;
+            by_index[mouse->hidpp.index] = mouse;
+
+            // Remapped thumb wheel: take its high-resolution rotation and
+            // touch straight from HID++ instead of REL_HWHEEL
+            if (thumb_tabs && hidpp_divert_thumbwheel(&mouse->hidpp, true) < 0) {
+                fprintf(stderr, "Thumb wheel stays on REL_HWHEEL.\n");
+            }
+        }
+
+        for (m = 0; m < mouse_count; m++) {
+            struct mouse *mouse = &mice[m];
+
+            if (!mouse->hidpp_ready) {
+                continue;
+            }
+            hidpp_ready_count++;
+            // Verify the cache entry once the mouse goes idle, not before
+            // the first gesture
+            if (cache_path) {
+                mouse->cache_pending = true;
+                timer_add(&timers, &cache_timer, CACHE_SYNC_DELAY_MS);
+            }
+            hidpp_query_dpi(&mouse->hidpp, sensor_dpi_detected, &mouse->engine);
+            hidpp_watch_status(&mouse->hidpp, link_changed, &mouse->engine);
+            gesture_engine_set_dpi_handler(&mouse->engine, sniper_dpi, &mouse->hidpp);
+            if (smartshift && hidpp_set_smartshift(&mouse->hidpp, smartshift) < 0) {
+                fprintf(stderr, "Device has no SmartShift.\n");
+            }
+        }
+
+        if (hidpp_ready_count == 0) {
+            fprintf(stderr, "HID++ unavailable, falling back to BTN_FORWARD from evdev.\n");
+            if (hidraw_fd >= 0) {
+                close(hidraw_fd);
+            }
+            hidraw_fd = -1;
+        } else {
+            int cached = 0;
+
+            for (m = 0; m < mouse_count; m++) {
+                cached += mice[m].hidpp_ready && mice[m].hidpp.from_cache;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &ready);
+            printf("HID++ ready for %d of %d mice in %.1f ms (%d cached, %d discovered)\n",
+                   hidpp_ready_count, mouse_count,
+                   (ready.tv_sec - start.tv_sec) * 1000.0 + (ready.tv_nsec - start.tv_nsec) / 1000000.0,
+                   cached, hidpp_ready_count - cached);
+        }
+    }
+    if (sniper && hidraw_fd < 0) {
+        fprintf(stderr, "Sniper mode needs HID++ (-H); the button will do nothing.\n");
     }
-    
-    return fd;
-}
 
-int setup_uinput_device(void) {
-    int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
-    if (fd < 0) {
-        perror("Cannot open /dev/uinput");
-        fprintf(stderr, "This might require the 'uinput' kernel module loaded and/or root privileges.\n");
-        fprintf(stderr, "Try 'sudo modprobe uinput' and ensure your user is in the 'input' and 'uinput' groups.\n");
-        return -1;
+    printf("Monitoring %d mice... Press Ctrl+C to stop.\n", mouse_count);
+
+    if (threaded && use_uring) {
+        fprintf(stderr, "-T and -U are exclusive; using -T.\n");
+        use_uring = false;
+    }
+    if (use_uring && keep_running) {
+        if (uring_loop_init(&uring) < 0) {
+            fprintf(stderr, "io_uring unavailable, using poll().\n");
+            use_uring = false;
+        } else {
+            for (m = 0; m < mouse_count; m++) {
+                uring_loop_add_reader(&uring, mice[m].input->fd, m);
+            }
+            uring_loop_watch(&uring, hidraw_fd);
+            uring_loop_watch(&uring, timers.fd);
+            uring_loop_take_output(&uring);
+        }
     }
 
-    // Enable key events
-    if (ioctl(fd, UI_SET_EVBIT, EV_KEY) < 0) {
-        perror("Cannot set EV_KEY bit");
-        close(fd);
-        return -1;
+    // Reads happen only after poll() reports data; posted io_uring reads
+    // need blocking fds instead
+    for (m = 0; m < mouse_count && !use_uring; m++) {
+        int flags = fcntl(mice[m].input->fd, F_GETFL, 0);
+        fcntl(mice[m].input->fd, F_SETFL, flags | O_NONBLOCK);
     }
 
-    // Enable specific keys
-    ioctl(fd, UI_SET_KEYBIT, KEY_LEFTMETA);
-    ioctl(fd, UI_SET_KEYBIT, KEY_RIGHTBRACE);
-    ioctl(fd, UI_SET_KEYBIT, KEY_LEFTBRACE);
-    ioctl(fd, UI_SET_KEYBIT, KEY_MUTE);
-    ioctl(fd, UI_SET_KEYBIT, KEY_LEFTALT);
-    ioctl(fd, UI_SET_KEYBIT, KEY_LEFT);
-    ioctl(fd, UI_SET_KEYBIT, KEY_RIGHT);
-    ioctl(fd, UI_SET_KEYBIT, KEY_F13);
-    ioctl(fd, UI_SET_KEYBIT, KEY_F14);
-    ioctl(fd, UI_SET_KEYBIT, KEY_VOLUMEDOWN);
-    ioctl(fd, UI_SET_KEYBIT, KEY_VOLUMEUP);
-
-    struct uinput_setup usetup;
-    memset(&usetup, 0, sizeof(usetup));
-    usetup.id.bustype = BUS_USB;
-    usetup.id.vendor = 0x1234;
-    usetup.id.product = 0x5678;
-    usetup.id.version = 1;
-    strcpy(usetup.name, "MouseGestureVirtualKeyboard");
-
-    if (ioctl(fd, UI_DEV_SETUP, &usetup) < 0) {
-        perror("Cannot setup uinput device");
-        close(fd);
-        return -1;
+    // Low-latency mode. The cache check writes its file from the event
+    // loop, so it is skipped; a stale cache is still caught when diverting.
+    if (realtime && keep_running) {
+        struct jitter before, after;
+
+        realtime_measure_jitter(&before);
+        if (realtime_enter(&rt) < 0) {
+            fprintf(stderr, "Low-latency mode unavailable (needs CAP_SYS_NICE and CAP_IPC_LOCK).\n");
+        } else {
+            realtime_measure_jitter(&after);
+            printf("Wake-up jitter (us): before p50 %ld p99 %ld max %ld, after p50 %ld p99 %ld max %ld\n",
+                   before.p50, before.p99, before.max, after.p50, after.p99, after.max);
+        }
+        for (m = 0; m < mouse_count; m++) {
+            mice[m].cache_pending = false;
+        }
+        timer_cancel(&cache_timer);
     }
 
-    if (ioctl(fd, UI_DEV_CREATE) < 0) {
-        perror("Cannot create uinput device");
-        close(fd);
-        return -1;
+    // Threaded mode: the nodes are read by their own threads and this one
+    // only dispatches
+    if (threaded && keep_running) {
+        if (dispatcher_init(&disp) < 0) {
+            threaded = false;
+        }
+        for (m = 0; threaded && m < mouse_count; m++) {
+            // Only a device outruns us; pipe-fed sources wait for room
+            if (dispatcher_add_reader(&disp, mice[m].input->fd, m,
+                                      !input_is_device(mice[m].input)) < 0) {
+                fprintf(stderr, "Falling back to the single-threaded loop.\n");
+                dispatcher_stop(&disp);
+                threaded = false;
+            }
+        }
     }
 
-    printf("Created virtual keyboard device for sending keypresses.\n");
-    return fd;
-}
+    // Nothing below may allocate until the loop ends
+    realtime_seal(true);
 
-// Simplified key sending function that handles any number of keys
-void send_keys(int fd, const int keys[], int key_count) {
-    struct input_event ev;
-    memset(&ev, 0, sizeof(ev));
-    int i;
+    // Main event loop. fds[m] is mice[m]'s node (left out in threaded mode),
+    // fds[mouse_count] hidraw, fds[mouse_count + 1] the dispatcher wake-up
+    // and fds[mouse_count + 2] the timer wheel. Deadlines all live on the
+    // wheel, so the wait itself never times out.
+    while (keep_running) {
+        struct pollfd fds[MAX_MICE + 3];
+        bool frames_pending;
+        int ready;
+
+        for (m = 0; m < mouse_count; m++) {
+            fds[m].fd = threaded ? -1 : mice[m].input->fd; // ignored by poll() when -1
+            fds[m].events = POLLIN;
+        }
+        fds[mouse_count].fd = hidraw_fd;
+        fds[mouse_count].events = POLLIN;
+        fds[mouse_count + 1].fd = threaded ? disp.wake_fd : -1;
+        fds[mouse_count + 1].events = POLLIN;
+        fds[mouse_count + 2].fd = timers.fd;
+        fds[mouse_count + 2].events = POLLIN;
+        frames_pending = threaded && !dispatcher_prepare_sleep(&disp);
+        if (use_uring) {
+            // Mouse frames are handled inside the wait
+            ready = uring_loop_wait(&uring, -1, frame_arrived, mice);
+            fds[mouse_count].revents = uring.watch_ready[0] ? POLLIN : 0;
+            fds[mouse_count + 2].revents = uring.watch_ready[1] ? POLLIN : 0;
+        } else {
+            ready = poll(fds, mouse_count + 3, frames_pending ? 0 : -1);
+        }
+
+        if (status_requested) {
+            status_requested = 0;
+            for (m = 0; m < mouse_count; m++) {
+                print_status(&mice[m]);
+                if (threaded) {
+                    printf("frames dropped by reader: %llu\n",
+                           (unsigned long long)disp.readers[m].dropped);
+                }
+            }
+            printf("output (%s): %llu frames, %llu events\n", keyboard.name,
+                   (unsigned long long)keyboard.frames, (unsigned long long)keyboard.events);
+            if (capturing) {
+                printf("capture: %llu events, %llu bytes written\n",
+                       (unsigned long long)capture.events, (unsigned long long)capture.offset);
+            }
+            fflush(stdout);
+        }
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue; // Signal interrupted the wait, check keep_running
+            }
+            perror("poll");
+            break;
+        }
+        // Expire before reading (releases themselves are judged by their
+        // timestamps, not by when the tap timer ran)
+        if (fds[mouse_count + 2].revents & POLLIN) {
+            timer_wheel_run(&timers);
+        }
+
+        if (threaded) {
+            dispatcher_woken(&disp);
+            dispatcher_drain(&disp, frame_arrived, mice);
+        }
+        for (m = 0; m < mouse_count && !threaded && !use_uring; m++) {
+            struct mouse *mouse = &mice[m];
+
+            // A closed pipe still holds what was written before; it is
+            // gone once a read returns 0
+            if ((fds[m].revents & (POLLERR | POLLHUP)) && !(fds[m].revents & POLLIN)) {
+                mouse_gone(mouse);
+                continue;
+            }
+            if (!(fds[m].revents & POLLIN)) {
+                continue;
+            }
+
+            ssize_t bytes_read = read(mouse->input->fd, events, sizeof(events));
+
+            if (bytes_read == 0) {
+                mouse_gone(mouse); // end of a pipe or file
+                continue;
+            }
+            if (bytes_read < 0) {
+                if (errno != EINTR && errno != EAGAIN) {
+                    perror("Error reading from mouse device");
+                    keep_running = 0;
+                    break;
+                }
+                bytes_read = 0;
+            }
+            mouse_events(mouse, events, (int)(bytes_read / sizeof(struct input_event)));
+        }
+
+        if (hidraw_fd >= 0 && (fds[mouse_count].revents & POLLIN)) {
+            uint8_t report[HIDPP_LONG_LEN];
+            ssize_t n = read(hidraw_fd, report, sizeof(report));
+            struct mouse *mouse;
+            int count;
+
+            // Byte 1 is the device index: one table lookup picks the mouse
+            mouse = n > 1 ? by_index[report[1]] : NULL;
+            if (mouse) {
+                postpone_cache_sync();
+                count = hidpp_handle_report(&mouse->hidpp, report, n, events, EVENT_BATCH);
+                hidpp_events(mouse, events, count);
+            }
+        }
+    }
 
-    // Press all keys in sequence
-    for (i = 0; i < key_count; i++) {
-        ev.type = EV_KEY;
-        ev.code = keys[i];
-        ev.value = 1; // Press
-        write(fd, &ev, sizeof(ev));
+    realtime_seal(false);
+    timer_cancel(&cache_timer); // the blocking shutdown requests run the wheel
+    for (m = 0; m < mouse_count; m++) {
+        timer_cancel(&mice[m].hidpp.sync_timer);
+    }
+    timer_cancel(&capture_timer);
+    timer_cancel(&adapt_timer);
+    if (realtime_sealed_allocations() > 0) {
+        fprintf(stderr, "%lu allocations in the event loop\n", realtime_sealed_allocations());
+        exit_code = 1;
     }
 
-    // Sync after all key presses
-    ev.type = EV_SYN;
-    ev.code = SYN_REPORT;
-    ev.value = 0;
-    write(fd, &ev, sizeof(ev));
+    if (threaded) {
+        dispatcher_stop(&disp);
+    }
+    if (use_uring) {
+        uring_loop_flush(&uring);
+        uring_loop_exit(&uring);
+    }
 
-    // Small delay to ensure the key combination is registered
-    usleep(10000);
+    for (m = 0; m < mouse_count; m++) {
+        struct mouse *mouse = &mice[m];
 
-    // Release all keys in reverse order
-    for (i = key_count - 1; i >= 0; i--) {
-        ev.type = EV_KEY;
-        ev.code = keys[i];
-        ev.value = 0; // Release
-        write(fd, &ev, sizeof(ev));
+        // Never leave a modifier stuck down (or the sensor slowed) if we
+        // exit mid-session
+        gesture_engine_release_all(&mouse->engine);
+
+        if (mouse->hidpp_ready) {
+            // Hand the button and sensor back to the firmware
+            hidpp_restore_dpi(&mouse->hidpp);
+            if (mouse->hidpp.thumb_diverted) {
+                hidpp_divert_thumbwheel(&mouse->hidpp, false);
+            }
+            hidpp_divert_gesture_button(&mouse->hidpp, false);
+        }
+
+        if (mouse->passthrough_fd >= 0) {
+            ioctl(mouse->input->fd, EVIOCGRAB, 0);
+            destroy_uinput_device(mouse->passthrough_fd);
+        }
+        input_close(mouse->input);
+    }
+    if (hidraw_fd >= 0) {
+        close(hidraw_fd);
+    }
+    timer_wheel_destroy(&timers);
+    if (adapt_path && adapt_path[0]) {
+        save_adapt();
     }
 
-    // Final sync
-    ev.type = EV_SYN;
-    ev.code = SYN_REPORT;
-    ev.value = 0;
-    write(fd, &ev, sizeof(ev));
+    if (capturing) {
+        uint64_t events = capture.events;
+
+        if (capture_close(&capture) < 0) {
+            exit_code = 1;
+        }
+        printf("Capture: %llu events in %llu bytes.\n", (unsigned long long)events,
+               (unsigned long long)capture.offset);
+    }
+    sink_close(&keyboard);
+    printf("Output (%s): %llu frames, %llu events.\n", keyboard.name,
+           (unsigned long long)keyboard.frames, (unsigned long long)keyboard.events);
+    
+    printf("Script terminated.\n");
+    return exit_code;
+}
+
+// Parse "BUTTON:VALUE": returns the button's EV_KEY code (or -1) and points
+// value at the text after the colon
+int parse_button(const char *arg, const char **value) {
+    static const struct {
+        const char *name;
+        int code;
+    } names[] = {
+        { "forward", BTN_FORWARD },
+        { "side", BTN_SIDE },
+        { "extra", BTN_EXTRA },
+        { "middle", BTN_MIDDLE },
+    };
+    const char *colon = strchr(arg, ':');
+    size_t i;
+
+    if (!colon) {
+        return -1;
+    }
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strlen(names[i].name) == (size_t)(colon - arg) &&
+            strncmp(arg, names[i].name, colon - arg) == 0) {
+            *value = colon + 1;
+            return names[i].code;
+        }
+    }
+    return -1;
 }
 
-double get_time_diff_seconds(struct timespec start, struct timespec end) {
-    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+struct gesture_binding *find_binding(int button) {
+    size_t i;
+
+    for (i = 0; i < sizeof(bindings) / sizeof(bindings[0]); i++) {
+        if (bindings[i].button == button) {
+            return &bindings[i];
+        }
+    }
+    return NULL;
 }
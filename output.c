@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+#include <sys/ioctl.h>
+
+#include "output.h"
+#include "sink.h"
+
+#define MAX_TAP_KEYS 8
+
+static output_write_fn writer;
+static output_flush_fn flusher;
+static void *writer_ctx;
+
+void output_set_writer(output_write_fn write_fn, output_flush_fn flush_fn, void *ctx) {
+    writer = write_fn;
+    flusher = flush_fn;
+    writer_ctx = ctx;
+}
+
+void output_write(int fd, const struct input_event *ev, int count) {
+    if (writer) {
+        writer(writer_ctx, fd, ev, count);
+    } else {
+        write(fd, ev, count * sizeof(*ev));
+    }
+}
+
+void output_flush(void) {
+    if (flusher) {
+        flusher(writer_ctx);
+    }
+}
+
+int setup_uinput_device(void) {
+    int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    if (fd < 0) {
+        perror("Cannot open /dev/uinput");
+        fprintf(stderr, "This might require the 'uinput' kernel module loaded and/or root privileges.\n");
+        fprintf(stderr, "Try 'sudo modprobe uinput' and ensure your user is in the 'input' and 'uinput' groups.\n");
+        return -1;
+    }
+
+    // Enable key events
+    if (ioctl(fd, UI_SET_EVBIT, EV_KEY) < 0) {
+        perror("Cannot set EV_KEY bit");
+        close(fd);
+        return -1;
+    }
+
+    // Enable specific keys
+    ioctl(fd, UI_SET_KEYBIT, KEY_LEFTMETA);
+    ioctl(fd, UI_SET_KEYBIT, KEY_RIGHTBRACE);
+    ioctl(fd, UI_SET_KEYBIT, KEY_LEFTBRACE);
+    ioctl(fd, UI_SET_KEYBIT, KEY_MUTE);
+    ioctl(fd, UI_SET_KEYBIT, KEY_LEFTALT);
+    ioctl(fd, UI_SET_KEYBIT, KEY_LEFT);
+    ioctl(fd, UI_SET_KEYBIT, KEY_RIGHT);
+    ioctl(fd, UI_SET_KEYBIT, KEY_TAB);
+    ioctl(fd, UI_SET_KEYBIT, KEY_LEFTCTRL);
+    ioctl(fd, UI_SET_KEYBIT, KEY_LEFTSHIFT);
+    ioctl(fd, UI_SET_KEYBIT, KEY_F13);
+    ioctl(fd, UI_SET_KEYBIT, KEY_F14);
+    ioctl(fd, UI_SET_KEYBIT, KEY_VOLUMEDOWN);
+    ioctl(fd, UI_SET_KEYBIT, KEY_VOLUMEUP);
+
+    struct uinput_setup usetup;
+    memset(&usetup, 0, sizeof(usetup));
+    usetup.id.bustype = BUS_USB;
+    usetup.id.vendor = 0x1234;
+    usetup.id.product = 0x5678;
+    usetup.id.version = 1;
+    strcpy(usetup.name, "MouseGestureVirtualKeyboard");
+
+    if (ioctl(fd, UI_DEV_SETUP, &usetup) < 0) {
+        perror("Cannot setup uinput device");
+        close(fd);
+        return -1;
+    }
+
+    if (ioctl(fd, UI_DEV_CREATE) < 0) {
+        perror("Cannot create uinput device");
+        close(fd);
+        return -1;
+    }
+
+    printf("Created virtual keyboard device for sending keypresses.\n");
+    return fd;
+}
+
+static bool test_bit(const unsigned long *bits, int bit) {
+    return bits[bit / (8 * sizeof(long))] & (1UL << (bit % (8 * sizeof(long))));
+}
+
+int setup_uinput_mirror(int source_fd) {
+    unsigned long key_bits[KEY_CNT / (8 * sizeof(long)) + 1];
+    unsigned long rel_bits[REL_CNT / (8 * sizeof(long)) + 1];
+    unsigned long msc_bits[MSC_CNT / (8 * sizeof(long)) + 1];
+    struct uinput_setup usetup;
+    int fd, i;
+
+    memset(key_bits, 0, sizeof(key_bits));
+    memset(rel_bits, 0, sizeof(rel_bits));
+    memset(msc_bits, 0, sizeof(msc_bits));
+    ioctl(source_fd, EVIOCGBIT(EV_KEY, sizeof(key_bits)), key_bits);
+    ioctl(source_fd, EVIOCGBIT(EV_REL, sizeof(rel_bits)), rel_bits);
+    ioctl(source_fd, EVIOCGBIT(EV_MSC, sizeof(msc_bits)), msc_bits);
+
+    fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    if (fd < 0) {
+        perror("Cannot open /dev/uinput");
+        return -1;
+    }
+
+    ioctl(fd, UI_SET_EVBIT, EV_KEY);
+    ioctl(fd, UI_SET_EVBIT, EV_REL);
+    ioctl(fd, UI_SET_EVBIT, EV_MSC);
+    for (i = 0; i < KEY_CNT; i++) {
+        if (test_bit(key_bits, i)) {
+            ioctl(fd, UI_SET_KEYBIT, i);
+        }
+    }
+    for (i = 0; i < REL_CNT; i++) {
+        if (test_bit(rel_bits, i)) {
+            ioctl(fd, UI_SET_RELBIT, i);
+        }
+    }
+    for (i = 0; i < MSC_CNT; i++) {
+        if (test_bit(msc_bits, i)) {
+            ioctl(fd, UI_SET_MSCBIT, i);
+        }
+    }
+
+    memset(&usetup, 0, sizeof(usetup));
+    usetup.id.bustype = BUS_USB;
+    usetup.id.vendor = 0x1234;
+    usetup.id.product = 0x5679;
+    usetup.id.version = 1;
+    strcpy(usetup.name, "MouseGesturePassthrough");
+
+    if (ioctl(fd, UI_DEV_SETUP, &usetup) < 0 || ioctl(fd, UI_DEV_CREATE) < 0) {
+        perror("Cannot create passthrough mouse");
+        close(fd);
+        return -1;
+    }
+
+    printf("Created virtual mouse for passthrough.\n");
+    return fd;
+}
+
+void destroy_uinput_device(int fd) {
+    ioctl(fd, UI_DEV_DESTROY);
+    close(fd);
+}
+
+// Fill ev with one frame pressing (value 1) or releasing keys, releases
+// in reverse order. Returns the number of events.
+static int chord_frame(struct input_event *ev, const int keys[], int key_count, int value) {
+    int i, n = 0;
+
+    for (i = 0; i < key_count; i++) {
+        ev[n].type = EV_KEY;
+        ev[n].code = keys[value ? i : key_count - 1 - i];
+        ev[n++].value = value;
+    }
+    ev[n].type = EV_SYN;
+    ev[n++].code = SYN_REPORT;
+    return n;
+}
+
+// Simplified key sending function that handles any number of keys
+void send_keys(struct output_sink *out, const int keys[], int key_count) {
+    struct input_event ev[MAX_TAP_KEYS + 1];
+    int n;
+
+    if (key_count > MAX_TAP_KEYS) {
+        key_count = MAX_TAP_KEYS;
+    }
+    memset(ev, 0, sizeof(ev));
+
+    n = chord_frame(ev, keys, key_count, 1);
+    sink_write(out, ev, n);
+
+    // Small delay to ensure the key combination is registered; it only
+    // means something if the press really went out first
+    if (out->hold_us > 0) {
+        sink_flush(out);
+        usleep(out->hold_us);
+    }
+
+    n = chord_frame(ev, keys, key_count, 0);
+    sink_write(out, ev, n);
+}
+
+// Used for held-modifier sessions where the caller controls the timing.
+void send_key_frame(struct output_sink *out, int key, int value) {
+    struct input_event ev[2];
+    memset(ev, 0, sizeof(ev));
+
+    ev[0].type = EV_KEY;
+    ev[0].code = key;
+    ev[0].value = value;
+    ev[1].type = EV_SYN;
+    ev[1].code = SYN_REPORT;
+    ev[1].value = 0;
+    sink_write(out, ev, 2);
+}
+
+// The compositor sees two reports, so no sleep is needed between them.
+void tap_key(struct output_sink *out, int key) {
+    send_key_frame(out, key, 1);
+    send_key_frame(out, key, 0);
+}
+
+// For repeated actions such as wheel chords, where sleeping per detent
+// would stall the read loop. Both frames go to the sink as one batch.
+void tap_keys(struct output_sink *out, const int keys[], int key_count) {
+    struct input_event ev[2 * MAX_TAP_KEYS + 2];
+    int n;
+
+    if (key_count > MAX_TAP_KEYS) {
+        key_count = MAX_TAP_KEYS;
+    }
+    memset(ev, 0, sizeof(ev));
+
+    n = chord_frame(ev, keys, key_count, 1);
+    n += chord_frame(ev + n, keys, key_count, 0);
+    sink_write(out, ev, n);
+}
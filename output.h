@@ -0,0 +1,42 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <linux/input.h>
+
+struct output_sink;
+
+// Virtual keyboard used to inject the keys bound to gestures
+int setup_uinput_device(void);
+void destroy_uinput_device(int fd);
+
+// Virtual mouse with the same keys, axes and misc events as source_fd, for
+// re-emitting a grabbed device's events
+int setup_uinput_mirror(int source_fd);
+
+// Where output frames go: write() unless an event loop that batches its
+// own writes installs a writer. flush must submit anything held back,
+// so that a direct write() after it cannot overtake earlier frames.
+typedef void (*output_write_fn)(void *ctx, int fd, const struct input_event *ev, int count);
+typedef void (*output_flush_fn)(void *ctx);
+void output_set_writer(output_write_fn write_fn, output_flush_fn flush_fn, void *ctx);
+
+// Send count events to fd through the current writer
+void output_write(int fd, const struct input_event *ev, int count);
+
+// Submit whatever the current writer holds back
+void output_flush(void);
+
+// Press a chord, sync, hold it for the sink's hold_us and release it in
+// reverse order
+void send_keys(struct output_sink *out, const int keys[], int key_count);
+
+// Emit a single key transition followed by a sync, without any delay
+void send_key_frame(struct output_sink *out, int key, int value);
+
+// Press and release a key as two separate frames
+void tap_key(struct output_sink *out, int key);
+
+// Like send_keys() but without the hold: press frame, then release frame
+void tap_keys(struct output_sink *out, const int keys[], int key_count);
+
+#endif
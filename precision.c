@@ -0,0 +1,49 @@
+#include "precision.h"
+
+void precision_init(struct precision_filter *pf, int button, int32_t scale) {
+    pf->button = button;
+    pf->scale = scale;
+    pf->held = false;
+    pf->rem_x = PRECISION_ONE / 2;
+    pf->rem_y = PRECISION_ONE / 2;
+}
+
+// Integer part out, fraction kept. The shift floors, so the remainder is
+// always in [0, 1) and rounding never drifts in one direction.
+static int32_t scale_axis(int32_t value, int32_t scale, int32_t *rem) {
+    int64_t scaled = (int64_t)value * scale + *rem;
+    int64_t whole = scaled >> 16;
+
+    *rem = (int32_t)(scaled - (whole << 16));
+    return (int32_t)whole;
+}
+
+bool precision_filter_event(struct precision_filter *pf, struct input_event *ev) {
+    if (pf->button < 0) {
+        return true;
+    }
+
+    if (ev->type == EV_KEY && ev->code == pf->button) {
+        if (ev->value == 0) {
+            pf->held = false;
+            pf->rem_x = 0;
+            pf->rem_y = 0;
+        } else {
+            // Start half a count in so the first output rounds to nearest
+            // in either direction
+            pf->held = true;
+            pf->rem_x = PRECISION_ONE / 2;
+            pf->rem_y = PRECISION_ONE / 2;
+        }
+        return false;
+    }
+
+    if (pf->held && ev->type == EV_REL) {
+        if (ev->code == REL_X) {
+            ev->value = scale_axis(ev->value, pf->scale, &pf->rem_x);
+        } else if (ev->code == REL_Y) {
+            ev->value = scale_axis(ev->value, pf->scale, &pf->rem_y);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,27 @@
+#ifndef PRECISION_H
+#define PRECISION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/input.h>
+
+#define PRECISION_ONE (1 << 16) // scale factors are 16.16 fixed point
+
+// Scales REL_X/REL_Y of a grabbed mouse while a chosen button is held.
+// The fractional part of every scaled delta is carried to the next event,
+// so slow motion is never rounded away.
+struct precision_filter {
+    int button;        // EV_KEY code that engages the filter, -1 if disabled
+    int32_t scale;     // factor in 16.16 fixed point
+    bool held;
+    int32_t rem_x;     // carried sub-count remainder, 16.16
+    int32_t rem_y;
+};
+
+void precision_init(struct precision_filter *pf, int button, int32_t scale);
+
+// Rewrites ev in place. Returns false if the event should not be passed
+// through (the engaging button itself).
+bool precision_filter_event(struct precision_filter *pf, struct input_event *ev);
+
+#endif
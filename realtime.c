@@ -0,0 +1,182 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <malloc.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "realtime.h"
+
+#define HEAP_PREFAULT (1024 * 1024) // bytes of heap faulted in and kept
+
+int realtime_parse_policy(struct realtime_config *rt, const char *arg) {
+    const char *colon = strchr(arg, ':');
+    int priority;
+
+    if (!colon) {
+        return -1;
+    }
+    if (colon - arg == 4 && strncmp(arg, "fifo", 4) == 0) {
+        rt->policy = SCHED_FIFO;
+    } else if (colon - arg == 2 && strncmp(arg, "rr", 2) == 0) {
+        rt->policy = SCHED_RR;
+    } else {
+        return -1;
+    }
+    priority = atoi(colon + 1);
+    if (priority < sched_get_priority_min(rt->policy) ||
+        priority > sched_get_priority_max(rt->policy)) {
+        return -1;
+    }
+    rt->priority = priority;
+    return 0;
+}
+
+int realtime_parse_cpus(struct realtime_config *rt, const char *arg) {
+    const char *p = arg;
+
+    rt->cpus = 0;
+    while (*p) {
+        char *end;
+        long cpu = strtol(p, &end, 10);
+
+        if (end == p || cpu < 0 || cpu >= 64 || (*end && *end != ',')) {
+            return -1;
+        }
+        rt->cpus |= (uint64_t)1 << cpu;
+        p = *end ? end + 1 : end;
+    }
+    return rt->cpus ? 0 : -1;
+}
+
+// Touch the stack we expect to use so no page fault lands in the loop
+static void prefault_stack(void) {
+    volatile char stack[REALTIME_STACK_PREFAULT];
+
+    memset((char *)stack, 0, sizeof(stack));
+}
+
+int realtime_enter(const struct realtime_config *rt) {
+    struct sched_param param = { .sched_priority = rt->priority };
+    char *heap;
+
+    // Keep freed memory in the arena instead of returning it, so the heap
+    // faulted in below stays resident
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        perror("mlockall");
+        return -1;
+    }
+    prefault_stack();
+    heap = malloc(HEAP_PREFAULT);
+    if (heap) {
+        memset(heap, 0, HEAP_PREFAULT);
+        free(heap);
+    }
+
+    if (rt->cpus) {
+        cpu_set_t set;
+        int cpu;
+
+        CPU_ZERO(&set);
+        for (cpu = 0; cpu < 64; cpu++) {
+            if (rt->cpus & ((uint64_t)1 << cpu)) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+            perror("sched_setaffinity");
+            return -1;
+        }
+    }
+
+    if (sched_setscheduler(0, rt->policy, &param) < 0) {
+        perror("sched_setscheduler");
+        return -1;
+    }
+    return 0;
+}
+
+static int compare_long(const void *a, const void *b) {
+    long x = *(const long *)a;
+    long y = *(const long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+void realtime_measure_jitter(struct jitter *out) {
+    long late[JITTER_SAMPLES];
+    struct timespec next, now;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (i = 0; i < JITTER_SAMPLES; i++) {
+        next.tv_nsec += JITTER_PERIOD_US * 1000L;
+        if (next.tv_nsec >= 1000000000L) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000L;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR) {
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        late[i] = (now.tv_sec - next.tv_sec) * 1000000L + (now.tv_nsec - next.tv_nsec) / 1000;
+    }
+
+    qsort(late, JITTER_SAMPLES, sizeof(late[0]), compare_long);
+    out->p50 = late[JITTER_SAMPLES / 2];
+    out->p99 = late[JITTER_SAMPLES * 99 / 100];
+    out->max = late[JITTER_SAMPLES - 1];
+}
+
+#ifdef RT_ALLOC_CHECK
+// Wrap glibc's allocator; the event loop runs sealed, so any count here
+// is an allocation on the hot path
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static atomic_bool sealed;
+static atomic_ulong sealed_allocations;
+
+static void count_allocation(void) {
+    if (atomic_load_explicit(&sealed, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&sealed_allocations, 1, memory_order_relaxed);
+    }
+}
+
+void *malloc(size_t size) {
+    count_allocation();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    count_allocation();
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    count_allocation();
+    return __libc_realloc(ptr, size);
+}
+
+void realtime_seal(bool seal) {
+    atomic_store(&sealed, seal);
+}
+
+unsigned long realtime_sealed_allocations(void) {
+    return atomic_load(&sealed_allocations);
+}
+#else
+void realtime_seal(bool seal) {
+}
+
+unsigned long realtime_sealed_allocations(void) {
+    return 0;
+}
+#endif
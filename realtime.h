@@ -0,0 +1,44 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define REALTIME_STACK_PREFAULT (256 * 1024) // bytes of stack touched up front
+#define JITTER_SAMPLES 500
+#define JITTER_PERIOD_US 1000
+
+struct realtime_config {
+    int policy;      // SCHED_FIFO or SCHED_RR
+    int priority;    // 1-99
+    uint64_t cpus;   // bit per CPU to run on, 0 to leave affinity alone
+};
+
+// Wake-up lateness of a periodic sleep, in microseconds
+struct jitter {
+    long p50;
+    long p99;
+    long max;
+};
+
+// Parse "fifo:PRIO" or "rr:PRIO". Returns 0 or -1.
+int realtime_parse_policy(struct realtime_config *rt, const char *arg);
+
+// Parse a CPU list such as "2" or "2,3" (CPUs 0-63). Returns 0 or -1.
+int realtime_parse_cpus(struct realtime_config *rt, const char *arg);
+
+// Lock all memory, pre-fault the stack and heap arena, pin the process
+// and switch it to the real-time policy. Threads created afterwards
+// inherit all of it. Returns 0 or -1, leaving whatever already succeeded.
+int realtime_enter(const struct realtime_config *rt);
+
+// Sleep JITTER_SAMPLES periods on an absolute schedule and record how
+// late each wake-up was
+void realtime_measure_jitter(struct jitter *out);
+
+// Allocation check, built in with -DRT_ALLOC_CHECK: counts malloc-family
+// calls made while sealed. Without it both are no-ops and the count is 0.
+void realtime_seal(bool sealed);
+unsigned long realtime_sealed_allocations(void);
+
+#endif
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "output.h"
+#include "sink.h"
+
+static void fd_write(struct output_sink *s, const struct input_event *ev, int count) {
+    output_write(s->fd, ev, count);
+}
+
+static void fd_flush(struct output_sink *s) {
+    output_flush();
+}
+
+static void fd_close(struct output_sink *s) {
+    if (s->uinput && s->fd >= 0) {
+        destroy_uinput_device(s->fd);
+    }
+    s->fd = -1;
+}
+
+static const struct output_sink_ops fd_ops = { fd_write, fd_flush, fd_close };
+
+static void null_write(struct output_sink *s, const struct input_event *ev, int count) {
+}
+
+static void null_flush(struct output_sink *s) {
+}
+
+static void null_close(struct output_sink *s) {
+}
+
+static const struct output_sink_ops null_ops = { null_write, null_flush, null_close };
+
+static void memory_write(struct output_sink *s, const struct input_event *ev, int count) {
+    int i;
+
+    for (i = 0; i < count; i++) {
+        s->ring[s->ring_head++ & (SINK_RING_EVENTS - 1)] = ev[i];
+    }
+}
+
+static void memory_close(struct output_sink *s) {
+    free(s->ring);
+    s->ring = NULL;
+}
+
+static const struct output_sink_ops memory_ops = { memory_write, null_flush, memory_close };
+
+static void trace_flush(struct output_sink *s) {
+    const char *p = (const char *)s->trace;
+    size_t left = s->trace_used * sizeof(s->trace[0]);
+
+    while (left > 0) {
+        ssize_t n = write(s->fd, p, left);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("trace write");
+            break;
+        }
+        p += n;
+        left -= n;
+    }
+    s->trace_used = 0;
+}
+
+static void trace_write(struct output_sink *s, const struct input_event *ev, int count) {
+    if (count > SINK_TRACE_EVENTS - s->trace_used) {
+        trace_flush(s);
+    }
+    if (count > SINK_TRACE_EVENTS) {
+        write(s->fd, ev, count * sizeof(*ev)); // larger than the buffer: straight out
+        return;
+    }
+    memcpy(&s->trace[s->trace_used], ev, count * sizeof(*ev));
+    s->trace_used += count;
+}
+
+static void trace_close(struct output_sink *s) {
+    trace_flush(s);
+    close(s->fd);
+    s->fd = -1;
+    free(s->trace);
+    s->trace = NULL;
+}
+
+static const struct output_sink_ops trace_ops = { trace_write, trace_flush, trace_close };
+
+static void sink_init(struct output_sink *s, const struct output_sink_ops *ops, const char *name) {
+    s->ops = ops;
+    s->name = name;
+    s->hold_us = 0;
+    s->events = 0;
+    s->frames = 0;
+    s->fd = -1;
+    s->uinput = false;
+    s->trace = NULL;
+    s->trace_used = 0;
+    s->ring = NULL;
+    s->ring_head = 0;
+}
+
+static struct input_event *alloc_events(int count) {
+    struct input_event *ev = malloc(count * sizeof(*ev));
+
+    if (!ev) {
+        perror("malloc");
+    }
+    return ev;
+}
+
+int sink_open(struct output_sink *s, const char *spec) {
+    if (strcmp(spec, "uinput") == 0) {
+        sink_init(s, &fd_ops, "uinput");
+        s->fd = setup_uinput_device();
+        s->uinput = true;
+        s->hold_us = CHORD_HOLD_US;
+        return s->fd < 0 ? -1 : 0;
+    }
+    if (strcmp(spec, "null") == 0) {
+        sink_init(s, &null_ops, "null");
+        return 0;
+    }
+    if (strcmp(spec, "memory") == 0) {
+        sink_init(s, &memory_ops, "memory");
+        s->ring = alloc_events(SINK_RING_EVENTS);
+        return s->ring ? 0 : -1;
+    }
+    if (strncmp(spec, "trace:", 6) == 0) {
+        sink_init(s, &trace_ops, "trace");
+        s->trace = alloc_events(SINK_TRACE_EVENTS);
+        if (!s->trace) {
+            return -1;
+        }
+        s->fd = open(spec + 6, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (s->fd < 0) {
+            perror(spec + 6);
+            free(s->trace);
+            s->trace = NULL;
+            return -1;
+        }
+        return 0;
+    }
+    return -1;
+}
+
+void sink_open_fd(struct output_sink *s, int fd, int hold_us) {
+    sink_init(s, &fd_ops, "fd");
+    s->fd = fd;
+    s->hold_us = hold_us;
+}
+
+void sink_write(struct output_sink *s, const struct input_event *ev, int count) {
+    int i;
+
+    for (i = 0; i < count; i++) {
+        s->frames += ev[i].type == EV_SYN && ev[i].code == SYN_REPORT;
+    }
+    s->events += count;
+    s->ops->write(s, ev, count);
+}
+
+void sink_flush(struct output_sink *s) {
+    s->ops->flush(s);
+}
+
+void sink_close(struct output_sink *s) {
+    s->ops->close(s);
+}
+
+int sink_memory_events(const struct output_sink *s, struct input_event *out, int max) {
+    uint64_t kept = s->ring_head < SINK_RING_EVENTS ? s->ring_head : SINK_RING_EVENTS;
+    uint64_t from;
+    int n = 0;
+
+    if ((uint64_t)max > kept) {
+        max = (int)kept;
+    }
+    for (from = s->ring_head - max; from < s->ring_head; from++) {
+        out[n++] = s->ring[from & (SINK_RING_EVENTS - 1)];
+    }
+    return n;
+}
@@ -0,0 +1,64 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/input.h>
+
+#define SINK_RING_EVENTS 4096  // memory sink: most recent events kept, power of two
+#define SINK_TRACE_EVENTS 4096 // trace sink: events buffered per write()
+#define CHORD_HOLD_US 10000    // uinput: how long send_keys() holds a chord down
+
+struct output_sink;
+
+struct output_sink_ops {
+    // Take count events making up one or more whole frames
+    void (*write)(struct output_sink *s, const struct input_event *ev, int count);
+    // Push out anything held back
+    void (*flush)(struct output_sink *s);
+    void (*close)(struct output_sink *s);
+};
+
+// Where injected key frames go. Frames arrive in batches and each sink
+// picks its own write granularity: the fd sink passes every batch on
+// (through the output.c writer, so an event loop can batch further), the
+// trace sink buffers whole frames into large writes, and the memory and
+// null sinks make no syscalls at all.
+struct output_sink {
+    const struct output_sink_ops *ops;
+    const char *name;
+    int hold_us;           // chord hold in send_keys(), 0 where nobody watches
+    uint64_t events;       // everything written, per sink
+    uint64_t frames;
+
+    int fd;                // fd and trace sinks; uinput owns it
+    bool uinput;           // fd is a uinput device to destroy on close
+
+    // Allocated by sink_open() for the sinks that use them only, so the
+    // sinks embedded per worker or per mouse stay small
+    struct input_event *trace; // SINK_TRACE_EVENTS
+    int trace_used;
+
+    struct input_event *ring;  // SINK_RING_EVENTS
+    uint64_t ring_head;    // events ever written to the ring
+};
+
+// Open the sink named by spec: "uinput" (the virtual keyboard), "null",
+// "memory" or "trace:PATH" (a struct input_event stream, timestamps
+// zero, so runs over the same input compare byte for byte). Returns 0 or -1.
+int sink_open(struct output_sink *s, const char *spec);
+
+// Write to an fd the caller owns, e.g. /dev/null in benchmarks
+void sink_open_fd(struct output_sink *s, int fd, int hold_us);
+
+void sink_write(struct output_sink *s, const struct input_event *ev, int count);
+void sink_flush(struct output_sink *s);
+
+// Also frees the buffers sink_open() allocated; every opened sink needs it
+void sink_close(struct output_sink *s);
+
+// Memory sink: copy out up to max of the most recent events, oldest
+// first. Returns the number copied.
+int sink_memory_events(const struct output_sink *s, struct input_event *out, int max);
+
+#endif
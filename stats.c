@@ -0,0 +1,412 @@
+// Offline analytics over recorded input, raw struct input_event files or
+// captures (capture.h): what each gesture-button press turned into and
+// at what hour, how long presses were held, how far taps moved compared
+// with the arm distance, and the near misses on either threshold. Files
+// are shared out to one worker per core; each replays its files through
+// the engine and keeps its own counts and t-digests, merged at the end.
+//
+// ./stats [-j JOBS] [-d DPI] FILE...
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/input.h>
+
+#include "capture.h"
+#include "config.h"
+#include "gesture.h"
+#include "sink.h"
+#include "tdigest.h"
+#include "timer.h"
+
+#define MAX_WORKERS 64
+#define READ_EVENTS 4096
+#define NEAR_ARM 0.75       // taps that moved this much of the arm distance
+#define NEAR_TIMEOUT_MS 50  // motionless presses this close past the tap timeout
+#define MIN_WALL_SEC 946684800 // 2000-01-01: earlier times are not wall clock
+#define NO_WALL_CLOCK INT64_MIN // offset of captures that do not record one
+#define MM_PER_INCH 25.4
+#define GESTURE_BUTTON BTN_FORWARD
+
+// What a press turned into: a direction, a wheel chord or nothing
+enum outcome {
+    OUT_CHORD = DIR_COUNT,
+    OUT_NONE,
+    OUTCOMES
+};
+
+static const char *outcome_names[OUTCOMES] = {
+    [DIR_TAP] = "tap", [DIR_LEFT] = "left", [DIR_RIGHT] = "right", [DIR_UP] = "up",
+    [DIR_DOWN] = "down", [OUT_CHORD] = "chord", [OUT_NONE] = "none",
+};
+
+static const struct gesture_binding stats_bindings[] = {
+    { .button = GESTURE_BUTTON, .mode = GESTURE_SWIPE },
+};
+
+struct stats {
+    uint64_t files;
+    uint64_t events;
+    uint64_t dropped;   // SYN_DROPPED: presses around them are not counted
+    uint64_t outcomes[OUTCOMES];
+    uint64_t by_hour[OUTCOMES][24];
+    uint64_t no_hour;   // presses without wall-clock time
+    uint64_t near_arm;  // taps past NEAR_ARM of the arm distance
+    uint64_t near_timeout; // presses lost to the tap timeout by < NEAR_TIMEOUT_MS
+    struct tdigest hold[OUTCOMES]; // ms
+    struct tdigest tap_peak;       // mm
+};
+
+// One press of the gesture button being followed
+struct press {
+    bool held;
+    uint64_t start_us;
+    int64_t wall_offset_us;
+    int32_t dx, dy;
+    int32_t peak; // largest |dx| or |dy| so far, counts
+    bool wheel;
+};
+
+struct worker {
+    pthread_t thread;
+    struct stats stats;
+    struct gesture_engine engine;
+    struct timer_wheel timers;
+    struct output_sink sink;
+    struct input_event events[READ_EVENTS];
+    struct press press;
+    long now_ms;
+};
+
+static struct worker workers[MAX_WORKERS];
+static struct stats total;
+static char **files;
+static int file_count;
+static int next_file;
+static int dpi = DEFAULT_DPI;
+static struct gesture_params params;
+
+static uint64_t event_us(const struct input_event *ev) {
+    return (uint64_t)ev->time.tv_sec * 1000000 + ev->time.tv_usec;
+}
+
+static void stats_init(struct stats *s) {
+    int i;
+
+    memset(s, 0, sizeof(*s));
+    for (i = 0; i < OUTCOMES; i++) {
+        tdigest_init(&s->hold[i]);
+    }
+    tdigest_init(&s->tap_peak);
+}
+
+static void stats_merge(struct stats *dst, struct stats *src) {
+    int i, h;
+
+    dst->files += src->files;
+    dst->events += src->events;
+    dst->dropped += src->dropped;
+    dst->no_hour += src->no_hour;
+    dst->near_arm += src->near_arm;
+    dst->near_timeout += src->near_timeout;
+    for (i = 0; i < OUTCOMES; i++) {
+        dst->outcomes[i] += src->outcomes[i];
+        for (h = 0; h < 24; h++) {
+            dst->by_hour[i][h] += src->by_hour[i][h];
+        }
+        tdigest_merge(&dst->hold[i], &src->hold[i]);
+    }
+    tdigest_merge(&dst->tap_peak, &src->tap_peak);
+}
+
+static double counts_to_mm(int32_t counts) {
+    return counts * MM_PER_INCH / dpi;
+}
+
+static void press_ended(struct worker *w, uint64_t end_us) {
+    struct stats *s = &w->stats;
+    struct press *p = &w->press;
+    enum gesture_dir pending = gesture_engine_pending(&w->engine, GESTURE_BUTTON);
+    int outcome = p->wheel ? OUT_CHORD : pending == DIR_COUNT ? OUT_NONE : (int)pending;
+    double hold_ms = (end_us - p->start_us) / 1000.0;
+    bool known = p->wall_offset_us != NO_WALL_CLOCK;
+    time_t wall = known ? (time_t)(((int64_t)p->start_us + p->wall_offset_us) / 1000000) : 0;
+    struct tm tm;
+
+    s->outcomes[outcome]++;
+    tdigest_add(&s->hold[outcome], hold_ms);
+    if (known && wall >= MIN_WALL_SEC && localtime_r(&wall, &tm)) {
+        s->by_hour[outcome][tm.tm_hour]++;
+    } else {
+        s->no_hour++;
+    }
+    if (outcome == DIR_TAP) {
+        double peak_mm = counts_to_mm(p->peak);
+
+        tdigest_add(&s->tap_peak, peak_mm);
+        s->near_arm += peak_mm >= NEAR_ARM * params.arm_mm;
+    } else if (outcome == OUT_NONE && p->peak <= w->engine.arm_counts &&
+               hold_ms <= params.tap_timeout_ms + NEAR_TIMEOUT_MS) {
+        s->near_timeout++;
+    }
+    p->held = false;
+}
+
+static void feed(struct worker *w, const struct input_event *ev, int count, int64_t wall_offset_us) {
+    struct press *p = &w->press;
+    int i;
+
+    w->stats.events += count;
+    for (i = 0; i < count; i++) {
+        const struct input_event *e = &ev[i];
+        long ms = (long)(event_us(e) / 1000);
+
+        if (ms != w->now_ms) {
+            w->now_ms = ms;
+            timer_wheel_advance(&w->timers, ms);
+        }
+        if (e->type == EV_SYN && e->code == SYN_DROPPED) {
+            // The rest of the frame is gone and the press with it
+            w->stats.dropped++;
+            gesture_engine_release_all(&w->engine);
+            p->held = false;
+            continue;
+        }
+        if (e->type == EV_KEY && e->code == GESTURE_BUTTON) {
+            if (e->value == 0 && p->held) {
+                press_ended(w, event_us(e)); // before the engine forgets it
+            } else if (e->value == 1) {
+                memset(p, 0, sizeof(*p));
+                p->held = true;
+                p->start_us = event_us(e);
+                p->wall_offset_us = wall_offset_us;
+            }
+        } else if (e->type == EV_REL && p->held) {
+            if (e->code == REL_X || e->code == REL_Y) {
+                int32_t *d = e->code == REL_X ? &p->dx : &p->dy;
+
+                *d += e->value;
+                if (abs(*d) > p->peak) {
+                    p->peak = abs(*d);
+                }
+            } else if (e->code == REL_WHEEL || e->code == REL_WHEEL_HI_RES) {
+                p->wheel = true;
+            }
+        }
+        gesture_engine_event(&w->engine, e);
+    }
+}
+
+// Raw recordings are used in place: mapped, with no copy or decoding
+static int feed_raw(struct worker *w, const char *path) {
+    const struct input_event *ev;
+    struct stat st;
+    size_t count;
+    void *map;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    count = st.st_size / sizeof(*ev);
+    if (count == 0) {
+        close(fd);
+        return 0;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    feed(w, map, (int)count, 0);
+    munmap(map, st.st_size);
+    return 0;
+}
+
+static int feed_capture(struct worker *w, const char *path) {
+    struct capture cap;
+    struct capture_cursor cur;
+    int n;
+
+    if (capture_open(&cap, path) < 0) {
+        return -1;
+    }
+    capture_seek(&cur, &cap, 0);
+    while ((n = capture_read(&cur, w->events, READ_EVENTS)) > 0) {
+        feed(w, w->events, n, cap.wall_clock ? cur.wall_offset_us : NO_WALL_CLOCK);
+    }
+    capture_free(&cap);
+    return 0;
+}
+
+static void run_file(struct worker *w, const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    bool is_capture;
+
+    if (fd < 0) {
+        perror(path);
+        return;
+    }
+    is_capture = capture_is_capture(fd);
+    close(fd);
+
+    timer_wheel_init_manual(&w->timers);
+    gesture_engine_init(&w->engine, &w->sink, stats_bindings, 1);
+    gesture_engine_set_params(&w->engine, &params);
+    gesture_engine_set_dpi(&w->engine, dpi);
+    gesture_engine_set_timers(&w->engine, &w->timers);
+    memset(&w->press, 0, sizeof(w->press));
+    w->now_ms = -1;
+
+    if ((is_capture ? feed_capture(w, path) : feed_raw(w, path)) == 0) {
+        w->stats.files++;
+    }
+    gesture_engine_release_all(&w->engine);
+    timer_wheel_destroy(&w->timers);
+}
+
+static void *work(void *arg) {
+    struct worker *w = arg;
+    int i;
+
+    while ((i = __atomic_fetch_add(&next_file, 1, __ATOMIC_RELAXED)) < file_count) {
+        run_file(w, files[i]);
+    }
+    return NULL;
+}
+
+static void report(struct stats *s, double seconds) {
+    uint64_t presses = 0;
+    int i, h;
+
+    for (i = 0; i < OUTCOMES; i++) {
+        presses += s->outcomes[i];
+    }
+    printf("%llu files, %llu events, %llu presses, %llu overflows (%.3f s)\n",
+           (unsigned long long)s->files, (unsigned long long)s->events,
+           (unsigned long long)presses, (unsigned long long)s->dropped, seconds);
+    if (presses == 0) {
+        return;
+    }
+
+    printf("\n%-8s %10s %7s   hold ms: %7s %7s %7s %7s\n", "outcome", "presses", "share",
+           "p10", "p50", "p90", "p99");
+    for (i = 0; i < OUTCOMES; i++) {
+        struct tdigest *td = &s->hold[i];
+
+        if (s->outcomes[i] == 0) {
+            continue;
+        }
+        printf("%-8s %10llu %6.2f%%            %7.0f %7.0f %7.0f %7.0f\n", outcome_names[i],
+               (unsigned long long)s->outcomes[i], 100.0 * s->outcomes[i] / presses,
+               tdigest_quantile(td, 0.10), tdigest_quantile(td, 0.50),
+               tdigest_quantile(td, 0.90), tdigest_quantile(td, 0.99));
+    }
+
+    if (tdigest_count(&s->tap_peak) > 0) {
+        printf("\ntap peak motion (mm, arm distance %.2f at %d DPI): p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n",
+               params.arm_mm, dpi, tdigest_quantile(&s->tap_peak, 0.50),
+               tdigest_quantile(&s->tap_peak, 0.90), tdigest_quantile(&s->tap_peak, 0.99),
+               s->tap_peak.max);
+    }
+    printf("near misses: %llu taps moved %.0f%% or more of the arm distance; "
+           "%llu still presses ran out the %d ms tap timeout by under %d ms\n",
+           (unsigned long long)s->near_arm, NEAR_ARM * 100, (unsigned long long)s->near_timeout,
+           params.tap_timeout_ms, NEAR_TIMEOUT_MS);
+
+    if (s->no_hour == presses) {
+        printf("\nno wall-clock times (monotonic raw recording or MX3CAP1 capture): "
+               "no hourly breakdown\n");
+        return;
+    }
+    printf("\nhour");
+    for (i = 0; i < OUTCOMES; i++) {
+        printf(" %7s", outcome_names[i]);
+    }
+    printf("\n");
+    for (h = 0; h < 24; h++) {
+        printf("%02d  ", h);
+        for (i = 0; i < OUTCOMES; i++) {
+            printf(" %7llu", (unsigned long long)s->by_hour[i][h]);
+        }
+        printf("\n");
+    }
+    if (s->no_hour > 0) {
+        printf("(%llu presses without wall-clock time)\n", (unsigned long long)s->no_hour);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    struct timespec start, end;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "j:d:h")) != -1) {
+        switch (opt) {
+        case 'j':
+            jobs = atol(optarg);
+            break;
+        case 'd':
+            dpi = atoi(optarg);
+            if (dpi <= 0) {
+                fprintf(stderr, "Invalid DPI: %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-j JOBS] [-d DPI] FILE...\n", argv[0]);
+            fprintf(stderr, "  FILE: a raw input_event recording or a capture (-W)\n");
+            fprintf(stderr, "  -j  worker threads (default: one per core)\n");
+            fprintf(stderr, "  -d  sensor resolution of the recording (default %d)\n", DEFAULT_DPI);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    files = argv + optind;
+    file_count = argc - optind;
+    if (file_count == 0) {
+        fprintf(stderr, "No files given\n");
+        return 1;
+    }
+    if (jobs < 1) {
+        jobs = 1;
+    }
+    if (jobs > MAX_WORKERS) {
+        jobs = MAX_WORKERS;
+    }
+    if (jobs > file_count) {
+        jobs = file_count;
+    }
+    gesture_params_default(&params);
+    tzset(); // once, before the workers call localtime_r()
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < jobs; i++) {
+        stats_init(&workers[i].stats);
+        sink_open(&workers[i].sink, "null");
+        if (pthread_create(&workers[i].thread, NULL, work, &workers[i]) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    stats_init(&total);
+    for (i = 0; i < jobs; i++) {
+        pthread_join(workers[i].thread, NULL);
+        stats_merge(&total, &workers[i].stats);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    report(&total, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    return 0;
+}
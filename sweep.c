@@ -0,0 +1,373 @@
+// Parameter sweep: replay labeled traces (trace.h, "= DIR" lines) through
+// the engine for every point of a grid of arm/cancel distances, tap
+// timeouts and direction margins, and report how often the outcome
+// missed the label and how long each press took to be decided. Grid
+// points are shared out to one worker per core; the traces are loaded
+// once and read by all of them.
+//
+// A press is decided when nothing later could change its outcome: a tap
+// (or nothing) only at release, a swipe in the frame it armed its final
+// direction.
+//
+// ./sweep [-j JOBS] [-a ARM_MM] [-c CANCEL_MM] [-t TAP_MS] [-m MARGIN_PCT] TRACE...
+// Each value is FROM[:TO[:STEP]]; omitted ones stay at their config.h default.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <linux/input.h>
+
+#include "gesture.h"
+#include "sink.h"
+#include "timer.h"
+#include "trace.h"
+
+#define MAX_WORKERS 64
+#define MAX_STEPS 1000 // values per axis
+
+// Every outcome gets a key of its own, so the emitted frame names it
+#define OUTCOME_KEY KEY_F13 // + enum gesture_dir
+
+static const struct gesture_binding sweep_bindings[] = {
+    {
+        .button = BTN_FORWARD,
+        .mode = GESTURE_SWIPE,
+        .action = {
+            [DIR_TAP] = { { OUTCOME_KEY + DIR_TAP }, 1 },
+            [DIR_LEFT] = { { OUTCOME_KEY + DIR_LEFT }, 1 },
+            [DIR_RIGHT] = { { OUTCOME_KEY + DIR_RIGHT }, 1 },
+            [DIR_UP] = { { OUTCOME_KEY + DIR_UP }, 1 },
+            [DIR_DOWN] = { { OUTCOME_KEY + DIR_DOWN }, 1 },
+        },
+        .wheel_up = { { KEY_VOLUMEUP }, 1 },
+        .wheel_down = { { KEY_VOLUMEDOWN }, 1 },
+    },
+};
+
+#define BINDING_COUNT (sizeof(sweep_bindings) / sizeof(sweep_bindings[0]))
+
+struct axis {
+    double value[MAX_STEPS];
+    int count;
+};
+
+struct point {
+    struct gesture_params params;
+    int segments;
+    int errors;
+    double latency_mean; // ms
+    long latency_p95;
+};
+
+struct worker {
+    pthread_t thread;
+    struct gesture_engine engine;
+    struct timer_wheel timers;
+    struct output_sink sink;
+    long *latency; // one per labeled press
+};
+
+// The press being followed through its hold
+struct segment {
+    const struct trace_label *label;
+    int button;
+    long press_ms;
+    enum gesture_dir pending; // what a release would send now
+    long settled_ms;          // when pending last changed
+};
+
+static struct worker workers[MAX_WORKERS];
+static struct trace *traces;
+static int trace_count;
+static int label_total;
+static struct point *points;
+static int point_count;
+static int next_point;
+
+// FROM[:TO[:STEP]] into axis; returns 0 or -1
+static int parse_axis(struct axis *axis, const char *arg, double step) {
+    double from, to, v;
+    int n = sscanf(arg, "%lf:%lf:%lf", &from, &to, &step);
+
+    if (n < 1 || step <= 0) {
+        return -1;
+    }
+    if (n == 1) {
+        to = from;
+    }
+    axis->count = 0;
+    // Half a step of slack so rounding cannot drop the last value
+    for (v = from; v <= to + step / 2 && axis->count < MAX_STEPS; v += step) {
+        axis->value[axis->count++] = v;
+    }
+    return axis->count > 0 ? 0 : -1;
+}
+
+static void axis_default(struct axis *axis, double value) {
+    if (axis->count == 0) {
+        axis->value[0] = value;
+        axis->count = 1;
+    }
+}
+
+static int compare_long(const void *a, const void *b) {
+    long x = *(const long *)a, y = *(const long *)b;
+    return x < y ? -1 : x > y;
+}
+
+// What the frames from ring index from on say about the release
+static enum gesture_dir outcome(const struct output_sink *sink, uint64_t from) {
+    uint64_t i;
+
+    for (i = from; i < sink->ring_head; i++) {
+        const struct input_event *ev = &sink->ring[i & (SINK_RING_EVENTS - 1)];
+
+        if (ev->type == EV_KEY && ev->value == 1 &&
+            ev->code >= OUTCOME_KEY && ev->code < OUTCOME_KEY + DIR_COUNT) {
+            return ev->code - OUTCOME_KEY;
+        }
+    }
+    return DIR_COUNT;
+}
+
+static void finish(struct point *p, struct worker *w, struct segment *seg,
+                   enum gesture_dir got, long now) {
+    bool decided_early = got != DIR_TAP && got != DIR_COUNT;
+
+    w->latency[p->segments++] = (decided_early ? seg->settled_ms : now) - seg->press_ms;
+    p->errors += got != seg->label->dir;
+    seg->label = NULL;
+}
+
+static void run_trace(struct point *p, struct worker *w, const struct trace *t) {
+    struct gesture_binding bindings[BINDING_COUNT];
+    struct segment seg = { NULL };
+    int next_label = 0;
+    long now = -1;
+    int i;
+
+    // The worker's sink carries on from the last trace: outcomes are read
+    // from marks into it, never from its start
+    memcpy(bindings, sweep_bindings, sizeof(bindings));
+    timer_wheel_init_manual(&w->timers);
+    gesture_engine_init(&w->engine, &w->sink, bindings, BINDING_COUNT);
+    gesture_engine_set_timers(&w->engine, &w->timers);
+    gesture_engine_set_params(&w->engine, &p->params);
+    if (t->dpi > 0) {
+        gesture_engine_set_dpi(&w->engine, t->dpi);
+    }
+
+    for (i = 0; i < t->event_count; i++) {
+        const struct input_event *ev = &t->events[i];
+        uint64_t mark = w->sink.ring_head;
+
+        if (trace_ms(ev) != now) {
+            now = trace_ms(ev);
+            timer_wheel_advance(&w->timers, now);
+        }
+        gesture_engine_event(&w->engine, ev);
+
+        if (seg.label && ev->type == EV_KEY && ev->code == seg.button && ev->value == 0) {
+            finish(p, w, &seg, outcome(&w->sink, mark), now);
+        } else if (seg.label && ev->type == EV_SYN) {
+            enum gesture_dir pending = gesture_engine_pending(&w->engine, seg.button);
+
+            if (pending != seg.pending) {
+                seg.pending = pending;
+                seg.settled_ms = now;
+            }
+        }
+        if (next_label < t->label_count && t->labels[next_label].event == i) {
+            if (seg.label) {
+                finish(p, w, &seg, DIR_COUNT, now); // overlapping holds: only one is followed
+            }
+            seg.label = &t->labels[next_label++];
+            seg.button = ev->code;
+            seg.press_ms = now;
+            seg.pending = gesture_engine_pending(&w->engine, seg.button);
+            seg.settled_ms = now;
+        }
+    }
+    if (seg.label) {
+        finish(p, w, &seg, DIR_COUNT, now); // never released
+    }
+    gesture_engine_release_all(&w->engine);
+    timer_wheel_destroy(&w->timers);
+}
+
+static void *work(void *arg) {
+    struct worker *w = arg;
+    int i, j;
+
+    while ((i = __atomic_fetch_add(&next_point, 1, __ATOMIC_RELAXED)) < point_count) {
+        struct point *p = &points[i];
+        double sum = 0;
+
+        for (j = 0; j < trace_count; j++) {
+            if (traces[j].label_count > 0 && !traces[j].switcher) {
+                run_trace(p, w, &traces[j]);
+            }
+        }
+        if (p->segments == 0) {
+            continue;
+        }
+        for (j = 0; j < p->segments; j++) {
+            sum += w->latency[j];
+        }
+        qsort(w->latency, p->segments, sizeof(w->latency[0]), compare_long);
+        p->latency_mean = sum / p->segments;
+        p->latency_p95 = w->latency[(p->segments * 95 + 99) / 100 - 1];
+    }
+    return NULL;
+}
+
+static void print_point(const char *prefix, const struct point *p) {
+    printf("%s%6.2f %6.2f %6d %6d  %8d %6d %6.2f%%  %8.1f %8ld\n", prefix,
+           p->params.arm_mm, p->params.cancel_mm, p->params.tap_timeout_ms,
+           p->params.dir_margin_pct, p->segments, p->errors,
+           p->segments ? 100.0 * p->errors / p->segments : 0.0, p->latency_mean, p->latency_p95);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-j JOBS] [-a ARM_MM] [-c CANCEL_MM] [-t TAP_MS] [-m MARGIN_PCT] TRACE...\n", prog);
+    fprintf(stderr, "  values are FROM[:TO[:STEP]]; e.g. -a 0.8:2.0:0.1 -t 150:350:25\n");
+    fprintf(stderr, "  -j  worker threads (default: one per core)\n");
+}
+
+int main(int argc, char *argv[]) {
+    static struct axis arm, cancel, tap, margin;
+    struct gesture_params defaults;
+    struct timespec start, end;
+    const struct point *best = NULL;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int a, c, t, m;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "j:a:c:t:m:h")) != -1) {
+        int err = 0;
+
+        switch (opt) {
+        case 'j':
+            jobs = atol(optarg);
+            break;
+        case 'a':
+            err = parse_axis(&arm, optarg, 0.1);
+            break;
+        case 'c':
+            err = parse_axis(&cancel, optarg, 0.1);
+            break;
+        case 't':
+            err = parse_axis(&tap, optarg, 10);
+            break;
+        case 'm':
+            err = parse_axis(&margin, optarg, 5);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+        if (err < 0) {
+            fprintf(stderr, "Invalid range for -%c: %s\n", opt, optarg);
+            return 1;
+        }
+    }
+    trace_count = argc - optind;
+    if (trace_count == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    gesture_params_default(&defaults);
+    axis_default(&arm, defaults.arm_mm);
+    axis_default(&cancel, defaults.cancel_mm);
+    axis_default(&tap, defaults.tap_timeout_ms);
+    axis_default(&margin, defaults.dir_margin_pct);
+
+    traces = calloc(trace_count, sizeof(*traces));
+    for (i = 0; i < trace_count; i++) {
+        if (trace_load(&traces[i], argv[optind + i]) < 0) {
+            return 1;
+        }
+        if (traces[i].switcher && traces[i].label_count > 0) {
+            fprintf(stderr, "%s: switcher trace, labels ignored\n", traces[i].path);
+        } else {
+            label_total += traces[i].label_count;
+        }
+    }
+    if (label_total == 0) {
+        fprintf(stderr, "No labeled presses in the traces\n");
+        return 1;
+    }
+
+    // Cancelling above the arm distance is clamped to it: skip those points
+    points = calloc((size_t)arm.count * cancel.count * tap.count * margin.count, sizeof(*points));
+    for (a = 0; a < arm.count; a++) {
+        for (c = 0; c < cancel.count; c++) {
+            if (cancel.value[c] > arm.value[a] + 1e-9) {
+                continue;
+            }
+            for (t = 0; t < tap.count; t++) {
+                for (m = 0; m < margin.count; m++) {
+                    struct gesture_params *p = &points[point_count++].params;
+
+                    p->arm_mm = arm.value[a];
+                    p->cancel_mm = cancel.value[c];
+                    p->tap_timeout_ms = (int)(tap.value[t] + 0.5);
+                    p->dir_margin_pct = (int)(margin.value[m] + 0.5);
+                }
+            }
+        }
+    }
+    if (point_count == 0) {
+        fprintf(stderr, "Empty grid: every cancel distance is above every arm distance\n");
+        return 1;
+    }
+
+    if (jobs < 1) {
+        jobs = 1;
+    }
+    if (jobs > MAX_WORKERS) {
+        jobs = MAX_WORKERS;
+    }
+    if (jobs > point_count) {
+        jobs = point_count;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < jobs; i++) {
+        workers[i].latency = malloc(label_total * sizeof(workers[i].latency[0]));
+        if (!workers[i].latency || sink_open(&workers[i].sink, "memory") < 0 ||
+            pthread_create(&workers[i].thread, NULL, work, &workers[i]) != 0) {
+            perror("worker");
+            return 1;
+        }
+    }
+    for (i = 0; i < jobs; i++) {
+        pthread_join(workers[i].thread, NULL);
+        free(workers[i].latency);
+        sink_close(&workers[i].sink);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("#  arm_mm cancel tap_ms margin  segments errors  miss%%  lat_mean  lat_p95\n");
+    for (i = 0; i < point_count; i++) {
+        const struct point *p = &points[i];
+
+        print_point("  ", p);
+        if (!best || p->errors < best->errors ||
+            (p->errors == best->errors && p->latency_mean < best->latency_mean)) {
+            best = p;
+        }
+    }
+    print_point("# best:\n  ", best);
+    printf("# %d points x %d labeled presses, %ld jobs, %.3f s\n", point_count, label_total, jobs,
+           (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+    for (i = 0; i < trace_count; i++) {
+        trace_free(&traces[i]);
+    }
+    free(traces);
+    free(points);
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tdigest.h"
+
+// Scale function k1: a centroid may span one unit of k, which keeps
+// centroids near q = 0 and q = 1 small
+static double k_of_q(double q) {
+    return TDIGEST_COMPRESSION / (2 * M_PI) * asin(2 * q - 1);
+}
+
+static double q_of_k(double k) {
+    if (k >= TDIGEST_COMPRESSION / 4.0) {
+        return 1;
+    }
+    return (sin(k * 2 * M_PI / TDIGEST_COMPRESSION) + 1) / 2;
+}
+
+static int compare_mean(const void *a, const void *b) {
+    double x = ((const struct tdigest_centroid *)a)->mean;
+    double y = ((const struct tdigest_centroid *)b)->mean;
+    return x < y ? -1 : x > y;
+}
+
+// Sort everything and merge neighbours while they fit under the scale
+static void compress(struct tdigest *td) {
+    int count = td->merged + td->buffered;
+    double before = 0;
+    double limit;
+    int out = 0;
+    int i;
+
+    if (td->buffered == 0) {
+        return;
+    }
+    qsort(td->c, count, sizeof(td->c[0]), compare_mean);
+    limit = q_of_k(k_of_q(0) + 1) * td->total;
+    for (i = 1; i < count; i++) {
+        struct tdigest_centroid *cur = &td->c[out];
+        const struct tdigest_centroid *next = &td->c[i];
+
+        if (before + cur->weight + next->weight <= limit) {
+            cur->mean += (next->mean - cur->mean) * next->weight / (cur->weight + next->weight);
+            cur->weight += next->weight;
+        } else {
+            before += cur->weight;
+            limit = q_of_k(k_of_q(before / td->total) + 1) * td->total;
+            td->c[++out] = *next;
+        }
+    }
+    td->merged = out + 1;
+    td->buffered = 0;
+}
+
+static void add_weighted(struct tdigest *td, double mean, double weight) {
+    if (td->merged + td->buffered == TDIGEST_CENTROIDS + TDIGEST_BUFFER) {
+        compress(td);
+    }
+    td->c[td->merged + td->buffered].mean = mean;
+    td->c[td->merged + td->buffered].weight = weight;
+    td->buffered++;
+    td->total += weight;
+}
+
+void tdigest_init(struct tdigest *td) {
+    td->merged = 0;
+    td->buffered = 0;
+    td->total = 0;
+    td->min = INFINITY;
+    td->max = -INFINITY;
+}
+
+void tdigest_add(struct tdigest *td, double x) {
+    if (x < td->min) {
+        td->min = x;
+    }
+    if (x > td->max) {
+        td->max = x;
+    }
+    add_weighted(td, x, 1);
+}
+
+void tdigest_merge(struct tdigest *dst, const struct tdigest *src) {
+    int i;
+
+    if (src->total == 0) {
+        return;
+    }
+    if (src->min < dst->min) {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+    for (i = 0; i < src->merged + src->buffered; i++) {
+        add_weighted(dst, src->c[i].mean, src->c[i].weight);
+    }
+}
+
+// Each centroid's weight sits around its mean: interpolate between the
+// centres of neighbours, and out to min and max past the first and last
+double tdigest_quantile(struct tdigest *td, double q) {
+    double target, seen = 0;
+    int i;
+
+    compress(td);
+    if (td->merged == 0) {
+        return 0;
+    }
+    if (q <= 0) {
+        return td->min;
+    }
+    if (q >= 1) {
+        return td->max;
+    }
+    target = q * td->total;
+    for (i = 0; i < td->merged; i++) {
+        const struct tdigest_centroid *c = &td->c[i];
+        double mid = seen + c->weight / 2;
+
+        if (target < mid) {
+            double left_mean = i > 0 ? td->c[i - 1].mean : td->min;
+            double left_mid = i > 0 ? seen - td->c[i - 1].weight / 2 : 0;
+
+            if (mid == left_mid) {
+                return c->mean;
+            }
+            return left_mean + (c->mean - left_mean) * (target - left_mid) / (mid - left_mid);
+        }
+        seen += c->weight;
+    }
+    {
+        const struct tdigest_centroid *last = &td->c[td->merged - 1];
+        double mid = td->total - last->weight / 2;
+
+        if (td->total == mid) {
+            return td->max;
+        }
+        return last->mean + (td->max - last->mean) * (target - mid) / (td->total - mid);
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef TDIGEST_H
+#define TDIGEST_H
+
+#include <stdint.h>
+
+#define TDIGEST_COMPRESSION 100 // higher: more centroids, tighter quantiles
+#define TDIGEST_CENTROIDS (2 * TDIGEST_COMPRESSION) // bound after compressing
+#define TDIGEST_BUFFER 512      // points added before compressing
+
+struct tdigest_centroid {
+    double mean;
+    double weight;
+};
+
+// Merging t-digest (Dunning): a sorted set of centroids, small near the
+// tails and large in the middle, so extreme quantiles stay accurate in
+// fixed memory. Digests built on different threads merge into one with
+// the same accuracy as if every point had gone to one digest.
+struct tdigest {
+    struct tdigest_centroid c[TDIGEST_CENTROIDS + TDIGEST_BUFFER];
+    int merged;   // compressed centroids at the front of c
+    int buffered; // unsorted ones after them
+    double total; // weight of everything added
+    double min;
+    double max;
+};
+
+void tdigest_init(struct tdigest *td);
+void tdigest_add(struct tdigest *td, double x);
+
+// Fold src into dst; src is left as it was
+void tdigest_merge(struct tdigest *dst, const struct tdigest *src);
+
+// Value below which fraction q (0-1) of the points fall; 0 when empty
+double tdigest_quantile(struct tdigest *td, double q);
+
+static inline uint64_t tdigest_count(const struct tdigest *td) {
+    return (uint64_t)(td->total + 0.5);
+}
+
+#endif
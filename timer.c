@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+#include "timer.h"
+
+static uint64_t current_tick(const struct timer_wheel *w) {
+    struct timespec ts;
+
+    if (w->manual) {
+        return w->clock;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)(ts.tv_sec - w->epoch_sec) * 1000 + (ts.tv_nsec - w->epoch_nsec) / 1000000;
+}
+
+static uint64_t rotate_right(uint64_t bits, int n) {
+    n &= TIMER_SLOTS - 1;
+    return n ? (bits >> n) | (bits << (TIMER_SLOTS - n)) : bits;
+}
+
+static void unlink_timer(struct timer *t) {
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = t->prev = NULL;
+}
+
+// Level: the lowest whose slot for expires is still ahead of now within
+// one lap. Expiry below min_tick is moved up to it.
+static void place(struct timer_wheel *w, struct timer *t, uint64_t min_tick) {
+    struct timer *head;
+    int level, shift = 0, slot;
+
+    if (t->expires < min_tick) {
+        t->expires = min_tick;
+    }
+    for (level = 0; level < TIMER_LEVELS; level++) {
+        shift = level * TIMER_SLOT_BITS;
+        if ((t->expires >> shift) - (w->now >> shift) < TIMER_SLOTS) {
+            break;
+        }
+    }
+    if (level == TIMER_LEVELS) {
+        // Beyond the wheel: park in the farthest slot and fire early
+        level = TIMER_LEVELS - 1;
+        t->expires = ((w->now >> shift) + TIMER_SLOTS - 1) << shift;
+    }
+
+    slot = (t->expires >> shift) & (TIMER_SLOTS - 1);
+    head = &w->slots[level][slot];
+    t->next = head;
+    t->prev = head->prev;
+    head->prev->next = t;
+    head->prev = t;
+    w->occupied[level] |= 1ULL << slot;
+}
+
+// Earliest tick after now with a level-0 slot to fire or a higher slot to
+// cascade; UINT64_MAX if the wheel is empty
+static uint64_t next_tick(const struct timer_wheel *w) {
+    uint64_t best = UINT64_MAX;
+    int level;
+
+    for (level = 0; level < TIMER_LEVELS; level++) {
+        int shift = level * TIMER_SLOT_BITS;
+        uint64_t cur = w->now >> shift;
+        uint64_t bits = rotate_right(w->occupied[level], (int)(cur + 1));
+        uint64_t tick;
+
+        if (!bits) {
+            continue;
+        }
+        tick = (cur + 1 + __builtin_ctzll(bits)) << shift;
+        if (tick < best) {
+            best = tick;
+        }
+    }
+    return best;
+}
+
+static void arm(struct timer_wheel *w) {
+    struct itimerspec its;
+    uint64_t tick = next_tick(w);
+
+    if (w->manual) {
+        w->armed = tick == UINT64_MAX ? 0 : tick;
+        return;
+    }
+    if (tick == w->armed || (tick == UINT64_MAX && w->armed == 0)) {
+        return;
+    }
+    memset(&its, 0, sizeof(its));
+    if (tick != UINT64_MAX) {
+        its.it_value.tv_sec = w->epoch_sec + tick / 1000;
+        its.it_value.tv_nsec = w->epoch_nsec + (long)(tick % 1000) * 1000000;
+        if (its.it_value.tv_nsec >= 1000000000L) {
+            its.it_value.tv_sec++;
+            its.it_value.tv_nsec -= 1000000000L;
+        }
+    }
+    if (timerfd_settime(w->fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        perror("timerfd_settime");
+    }
+    w->armed = tick == UINT64_MAX ? 0 : tick;
+}
+
+static void init_slots(struct timer_wheel *w) {
+    int level, slot;
+
+    for (level = 0; level < TIMER_LEVELS; level++) {
+        for (slot = 0; slot < TIMER_SLOTS; slot++) {
+            w->slots[level][slot].next = w->slots[level][slot].prev = &w->slots[level][slot];
+        }
+    }
+}
+
+int timer_wheel_init(struct timer_wheel *w) {
+    struct timespec ts;
+
+    memset(w, 0, sizeof(*w));
+    w->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (w->fd < 0) {
+        perror("timerfd_create");
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    w->epoch_sec = ts.tv_sec;
+    w->epoch_nsec = ts.tv_nsec;
+    init_slots(w);
+    return 0;
+}
+
+void timer_wheel_init_manual(struct timer_wheel *w) {
+    memset(w, 0, sizeof(*w));
+    w->fd = -1;
+    w->manual = true;
+    init_slots(w);
+}
+
+void timer_wheel_destroy(struct timer_wheel *w) {
+    if (w->fd >= 0) {
+        close(w->fd);
+    }
+    w->fd = -1;
+}
+
+void timer_init(struct timer *t, timer_fn fn, void *ctx) {
+    memset(t, 0, sizeof(*t));
+    t->fn = fn;
+    t->ctx = ctx;
+}
+
+// True if no timer is pending. Clears the bits of slots that cancelling
+// emptied on the way.
+static bool wheel_empty(struct timer_wheel *w) {
+    bool empty = true;
+    int level;
+
+    for (level = 0; level < TIMER_LEVELS; level++) {
+        uint64_t bits = w->occupied[level];
+
+        while (bits) {
+            int slot = __builtin_ctzll(bits);
+            struct timer *head = &w->slots[level][slot];
+
+            bits &= bits - 1;
+            if (head->next == head) {
+                w->occupied[level] &= ~(1ULL << slot);
+            } else {
+                empty = false;
+            }
+        }
+    }
+    return empty;
+}
+
+void timer_add(struct timer_wheel *w, struct timer *t, int delay_ms) {
+    uint64_t tick = current_tick(w);
+
+    if (timer_pending(t)) {
+        timer_cancel(t);
+    }
+    // w->now only moves when the wheel runs, and with every timer
+    // cancelled before it fires that may not be for hours. Levels are
+    // picked against w->now, and past 64^4 ms behind the new timer would
+    // be clamped into the past; with nothing pending it can simply catch up.
+    if (tick - w->now >= TIMER_SLOTS && wheel_empty(w)) {
+        w->now = tick;
+    }
+    // From the clock, not w->now: the wheel may not have run for a while.
+    // The partial current tick rounds up, so a timer never fires early.
+    t->expires = tick + 1 + (delay_ms > 0 ? delay_ms : 0);
+    place(w, t, w->now + 1);
+    if (w->armed == 0 || t->expires < w->armed) {
+        arm(w);
+    }
+}
+
+// Occupancy bits are left alone: a slot emptied by cancelling costs at
+// most one spurious wake-up, after which process() clears its bit
+void timer_cancel(struct timer *t) {
+    if (timer_pending(t)) {
+        unlink_timer(t);
+    }
+}
+
+// Tick T: cascade the higher-level slots whose boundary T is, top down,
+// then fire level 0
+static void process(struct timer_wheel *w, uint64_t tick) {
+    struct timer *head;
+    int level;
+
+    w->now = tick;
+    for (level = TIMER_LEVELS - 1; level >= 1; level--) {
+        int shift = level * TIMER_SLOT_BITS;
+        int slot;
+        struct timer list;
+
+        if (tick & ((1ULL << shift) - 1)) {
+            continue;
+        }
+        slot = (tick >> shift) & (TIMER_SLOTS - 1);
+        head = &w->slots[level][slot];
+        w->occupied[level] &= ~(1ULL << slot);
+        if (head->next == head) {
+            continue;
+        }
+        // Detach the whole slot first: re-placing may land in lower levels only
+        list.next = head->next;
+        list.prev = head->prev;
+        list.next->prev = &list;
+        list.prev->next = &list;
+        head->next = head->prev = head;
+        while (list.next != &list) {
+            struct timer *t = list.next;
+
+            unlink_timer(t);
+            place(w, t, tick);
+        }
+    }
+
+    head = &w->slots[0][tick & (TIMER_SLOTS - 1)];
+    while (head->next != head) {
+        struct timer *t = head->next;
+
+        unlink_timer(t);
+        t->fn(t, t->ctx);
+    }
+    w->occupied[0] &= ~(1ULL << (tick & (TIMER_SLOTS - 1)));
+}
+
+static void run_until(struct timer_wheel *w, uint64_t target) {
+    uint64_t tick;
+
+    while ((tick = next_tick(w)) <= target) {
+        process(w, tick);
+    }
+    if (target > w->now) {
+        w->now = target;
+    }
+    w->armed = 0; // the timerfd has fired or will be re-set below
+    arm(w);
+}
+
+void timer_wheel_run(struct timer_wheel *w) {
+    uint64_t expirations;
+
+    read(w->fd, &expirations, sizeof(expirations));
+    run_until(w, current_tick(w));
+}
+
+void timer_wheel_advance(struct timer_wheel *w, uint64_t tick) {
+    if (tick > w->clock) {
+        w->clock = tick;
+    }
+    run_until(w, w->clock);
+}
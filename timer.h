@@ -0,0 +1,68 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TIMER_LEVELS 4     // delays over 64^4 ms, about 4.6 hours, are clamped
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+
+struct timer;
+
+// Runs from timer_wheel_run(); may add or cancel any timer, itself included
+typedef void (*timer_fn)(struct timer *t, void *ctx);
+
+// Embedded in its owner. Pending timers sit on a doubly linked slot
+// list, so adding and cancelling are both O(1).
+struct timer {
+    struct timer *next;
+    struct timer *prev;
+    uint64_t expires; // wheel tick (ms)
+    timer_fn fn;
+    void *ctx;
+};
+
+// Hierarchical timing wheel with 1 ms ticks: level n has 64 slots of
+// 64^n ticks, and a slot is cascaded into the levels below when the wheel
+// reaches it. One timerfd is armed for the earliest slot that needs
+// attention.
+struct timer_wheel {
+    int fd;            // timerfd; poll it and call timer_wheel_run()
+    uint64_t now;      // last tick processed
+    uint64_t armed;    // tick the timerfd fires at, 0 if disarmed
+    uint64_t occupied[TIMER_LEVELS]; // bit per non-empty slot
+    struct timer slots[TIMER_LEVELS][TIMER_SLOTS]; // list heads
+    long epoch_sec;    // CLOCK_MONOTONIC at tick 0
+    long epoch_nsec;
+    bool manual;       // no timerfd: the clock only moves in timer_wheel_advance()
+    uint64_t clock;    // manual wheel: current tick
+};
+
+int timer_wheel_init(struct timer_wheel *w);
+
+// A wheel on a clock of its own, for replaying recorded input: time moves
+// only as the caller says, so every run fires the same timers at the same
+// points of the input however fast it is fed. fd is -1.
+void timer_wheel_init_manual(struct timer_wheel *w);
+void timer_wheel_destroy(struct timer_wheel *w);
+
+void timer_init(struct timer *t, timer_fn fn, void *ctx);
+
+// (Re)start t to fire delay_ms from now; an already pending t is moved
+void timer_add(struct timer_wheel *w, struct timer *t, int delay_ms);
+
+// Stop t if it is pending
+void timer_cancel(struct timer *t);
+
+static inline bool timer_pending(const struct timer *t) {
+    return t->next != 0;
+}
+
+// Fire everything that is due and re-arm the timerfd
+void timer_wheel_run(struct timer_wheel *w);
+
+// Manual wheel: move the clock forward to tick and fire everything due
+void timer_wheel_advance(struct timer_wheel *w, uint64_t tick);
+
+#endif
@@ -0,0 +1,86 @@
+// Checks for the timer wheel on a manual clock: timers fire on their tick
+// and not before, across cascades, and after the clock has moved on for
+// hours without the wheel running (as it does in the daemon when every
+// tap timer is cancelled before it fires).
+//
+// ./timer_check
+#include <stdio.h>
+
+#include "timer.h"
+
+#define HOUR_MS (3600 * 1000ULL)
+
+static int checks;
+static int failed;
+static struct timer_wheel wheel;
+static int fired;
+static uint64_t fired_at;
+
+static void expect(bool ok, const char *what) {
+    checks++;
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        failed++;
+    }
+}
+
+static void on_fire(struct timer *t, void *ctx) {
+    fired++;
+    fired_at = wheel.clock;
+}
+
+// Add a delay_ms timer now and step the clock up to it one tick at a
+// time. Returns true if it fired exactly on its tick: the current one
+// rounds up, so that is delay_ms + 1 ticks on.
+static bool fires_on_time(struct timer *t, int delay_ms) {
+    uint64_t start = wheel.clock;
+
+    fired = 0;
+    timer_add(&wheel, t, delay_ms);
+    while (wheel.clock < start + delay_ms) {
+        timer_wheel_advance(&wheel, wheel.clock + 1);
+        if (fired) {
+            return false;
+        }
+    }
+    timer_wheel_advance(&wheel, wheel.clock + 1);
+    return fired == 1 && fired_at == start + delay_ms + 1;
+}
+
+// The daemon's clock moves whether or not the wheel runs
+static void jump(uint64_t ms) {
+    wheel.clock += ms;
+}
+
+int main(void) {
+    struct timer tap, other;
+
+    timer_wheel_init_manual(&wheel);
+    timer_init(&tap, on_fire, NULL);
+    timer_init(&other, on_fire, NULL);
+
+    expect(fires_on_time(&tap, 200), "200 ms timer");
+    expect(fires_on_time(&tap, 10000), "10 s timer, cascaded");
+
+    // Hours with nothing pending: the wheel never ran
+    jump(5 * HOUR_MS);
+    expect(fires_on_time(&tap, 200), "200 ms timer after 5 h idle");
+
+    // Same, with the wheel's slots still marked by a cancelled timer
+    timer_add(&wheel, &other, 200);
+    timer_cancel(&other);
+    jump(5 * HOUR_MS);
+    expect(fires_on_time(&tap, 200), "200 ms timer after 5 h with a cancelled one");
+
+    // A pending timer keeps the wheel where it is; both still fire on time
+    timer_add(&wheel, &other, 3000);
+    jump(1000);
+    fired = 0;
+    expect(fires_on_time(&tap, 200) && !timer_pending(&tap), "200 ms timer beside a pending one");
+    fired = 0;
+    timer_wheel_advance(&wheel, wheel.clock + 3000);
+    expect(fired == 1 && !timer_pending(&other), "pending one fires");
+
+    printf("%d timer checks, %d failed\n", checks, failed);
+    return failed ? 1 : 0;
+}
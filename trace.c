@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+#define MAX_LINE 1024
+#define MAX_FRAME_EVENTS 32
+
+struct name {
+    const char *name;
+    int type;
+    int code;
+};
+
+#define KEY(c) { #c, EV_KEY, c }
+#define REL(c) { #c, EV_REL, c }
+
+static const struct name names[] = {
+    KEY(BTN_LEFT), KEY(BTN_RIGHT), KEY(BTN_MIDDLE), KEY(BTN_SIDE), KEY(BTN_EXTRA),
+    KEY(BTN_FORWARD), KEY(BTN_BACK), KEY(BTN_TASK), KEY(BTN_TOUCH),
+    KEY(KEY_LEFTMETA), KEY(KEY_LEFTALT), KEY(KEY_LEFTCTRL), KEY(KEY_LEFTSHIFT),
+    KEY(KEY_TAB), KEY(KEY_LEFT), KEY(KEY_RIGHT), KEY(KEY_LEFTBRACE), KEY(KEY_RIGHTBRACE),
+    KEY(KEY_VOLUMEUP), KEY(KEY_VOLUMEDOWN), KEY(KEY_MUTE),
+    KEY(KEY_F13), KEY(KEY_F14), KEY(KEY_F15), KEY(KEY_F16), KEY(KEY_F17),
+    REL(REL_X), REL(REL_Y), REL(REL_WHEEL), REL(REL_WHEEL_HI_RES),
+    REL(REL_HWHEEL), REL(REL_HWHEEL_HI_RES),
+};
+
+#define NAME_COUNT (sizeof(names) / sizeof(names[0]))
+
+static const char *dir_names[DIR_COUNT + 1] = {
+    [DIR_TAP] = "tap", [DIR_LEFT] = "left", [DIR_RIGHT] = "right",
+    [DIR_UP] = "up", [DIR_DOWN] = "down", [DIR_COUNT] = "none",
+};
+
+static const struct name *find_name(const char *s, size_t len) {
+    size_t i;
+
+    for (i = 0; i < NAME_COUNT; i++) {
+        if (strlen(names[i].name) == len && strncmp(names[i].name, s, len) == 0) {
+            return &names[i];
+        }
+    }
+    return NULL;
+}
+
+static void print_event(FILE *f, const struct input_event *ev) {
+    size_t i;
+
+    for (i = 0; i < NAME_COUNT; i++) {
+        if (names[i].type == ev->type && names[i].code == ev->code) {
+            fprintf(f, " %s=%d", names[i].name, ev->value);
+            return;
+        }
+    }
+    fprintf(f, " %d:%d=%d", ev->type, ev->code, ev->value);
+}
+
+// "NAME=VALUE ..." into ev; returns the number of events or -1
+static int parse_frame(const char *p, struct input_event *ev, int max) {
+    int n = 0;
+
+    for (;;) {
+        const struct name *name;
+        const char *eq;
+        char *end;
+        long value;
+
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (*p == '\0' || *p == '\n' || *p == '\r' || *p == '#') {
+            return n;
+        }
+        eq = strchr(p, '=');
+        if (!eq || n == max || !(name = find_name(p, eq - p))) {
+            return -1;
+        }
+        value = strtol(eq + 1, &end, 10);
+        if (end == eq + 1) {
+            return -1;
+        }
+        memset(&ev[n], 0, sizeof(ev[n]));
+        ev[n].type = name->type;
+        ev[n].code = name->code;
+        ev[n++].value = (int)value;
+        p = end;
+    }
+}
+
+static int parse_dir(const char *p) {
+    char word[16];
+    int dir;
+
+    if (sscanf(p, " %15s", word) != 1) {
+        return -1;
+    }
+    for (dir = 0; dir <= DIR_COUNT; dir++) {
+        if (strcmp(word, dir_names[dir]) == 0) {
+            return dir;
+        }
+    }
+    return -1;
+}
+
+static int parse_option(struct trace *t, const char *p) {
+    if (sscanf(p, " dpi %d", &t->dpi) == 1 && t->dpi > 0) {
+        return 0;
+    }
+    if (strncmp(p, " switcher", 9) == 0) {
+        t->switcher = true;
+        return 0;
+    }
+    if (strncmp(p, " thumbwheel", 11) == 0) {
+        t->thumbwheel = true;
+        return 0;
+    }
+    return -1;
+}
+
+// Append count events to *array, doubling its room as needed
+static int append(struct input_event **array, int *used, int *room,
+                  const struct input_event *ev, int count) {
+    if (*used + count > *room) {
+        int want = *room ? *room : 256;
+        struct input_event *grown;
+
+        while (want < *used + count) {
+            want *= 2;
+        }
+        grown = realloc(*array, want * sizeof(**array));
+        if (!grown) {
+            perror("realloc");
+            return -1;
+        }
+        *array = grown;
+        *room = want;
+    }
+    memcpy(*array + *used, ev, count * sizeof(*ev));
+    *used += count;
+    return 0;
+}
+
+static int add_label(struct trace *t, int *room, int event, int dir) {
+    if (t->label_count == *room) {
+        int want = *room ? *room * 2 : 64;
+        struct trace_label *grown = realloc(t->labels, want * sizeof(*t->labels));
+
+        if (!grown) {
+            perror("realloc");
+            return -1;
+        }
+        t->labels = grown;
+        *room = want;
+    }
+    t->labels[t->label_count].event = event;
+    t->labels[t->label_count++].dir = dir;
+    return 0;
+}
+
+int trace_load(struct trace *t, const char *path) {
+    char line[MAX_LINE];
+    struct input_event frame[MAX_FRAME_EVENTS + 1];
+    int events_room = 0, expected_room = 0, labels_room = 0;
+    size_t text_len;
+    FILE *text;
+    FILE *f = fopen(path, "r");
+    long last_ms = 0;
+    int label = -1; // waiting for the press it describes
+    int lineno = 0;
+    int n = 0, i;
+
+    memset(t, 0, sizeof(*t));
+    t->path = path;
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    text = open_memstream(&t->text, &text_len);
+
+    while (n >= 0 && fgets(line, sizeof(line), f)) {
+        lineno++;
+        if (line[0] == '>') {
+            n = parse_frame(line + 1, frame, MAX_FRAME_EVENTS);
+            if (n >= 0) {
+                memset(&frame[n], 0, sizeof(frame[n]));
+                frame[n].type = EV_SYN;
+                frame[n++].code = SYN_REPORT;
+                n = append(&t->expected, &t->expected_count, &expected_room, frame, n);
+            }
+            continue;
+        }
+
+        fputs(line, text);
+        if (line[0] == '!') {
+            n = t->event_count > 0 ? -1 : parse_option(t, line + 1);
+        } else if (line[0] == '=') {
+            n = label = parse_dir(line + 1);
+        } else if (line[0] == '@') {
+            char *end;
+            long ms = strtol(line + 1, &end, 10);
+
+            n = end == line + 1 || ms < last_ms ? -1 : parse_frame(end, frame, MAX_FRAME_EVENTS);
+            if (n < 0) {
+                continue;
+            }
+            memset(&frame[n], 0, sizeof(frame[n]));
+            frame[n].type = EV_SYN;
+            frame[n++].code = SYN_REPORT;
+            for (i = 0; i < n; i++) {
+                frame[i].time.tv_sec = ms / 1000;
+                frame[i].time.tv_usec = ms % 1000 * 1000;
+                if (label >= 0 && frame[i].type == EV_KEY && frame[i].value == 1) {
+                    add_label(t, &labels_room, t->event_count + i, label);
+                    label = -1;
+                }
+            }
+            n = append(&t->events, &t->event_count, &events_room, frame, n);
+            last_ms = ms;
+        } else if (line[0] != '#' && strspn(line, " \t\r\n") != strlen(line)) {
+            n = -1;
+        }
+    }
+    fclose(f);
+    fclose(text);
+
+    if (n < 0) {
+        fprintf(stderr, "%s:%d: cannot parse: %s", path, lineno, line);
+        trace_free(t);
+        return -1;
+    }
+    return 0;
+}
+
+void trace_free(struct trace *t) {
+    free(t->events);
+    free(t->expected);
+    free(t->labels);
+    free(t->text);
+    t->events = t->expected = NULL;
+    t->labels = NULL;
+    t->text = NULL;
+    t->event_count = t->expected_count = t->label_count = 0;
+}
+
+void trace_print_frames(FILE *f, const struct input_event *ev, int count) {
+    int i;
+    bool open = false;
+
+    for (i = 0; i < count; i++) {
+        if (ev[i].type == EV_SYN && ev[i].code == SYN_REPORT) {
+            fputs(open ? "\n" : ">\n", f);
+            open = false;
+            continue;
+        }
+        if (!open) {
+            fputc('>', f);
+            open = true;
+        }
+        print_event(f, &ev[i]);
+    }
+    if (open) {
+        fputc('\n', f);
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <linux/input.h>
+
+#include "gesture.h"
+
+// A recorded gesture trace in the text form kept under traces/:
+//
+//   # comment
+//   ! dpi 1600            options: dpi N, switcher (the thumb button in
+//   ! switcher            GESTURE_SWITCHER mode), thumbwheel (the -t
+//   ! thumbwheel          tab bindings)
+//   = right               what the next press was meant to do: tap, left,
+//                         right, up, down or none
+//   @0 BTN_FORWARD=1      an input frame at 0 ms; the SYN_REPORT is implied
+//   @40 REL_X=30 REL_Y=-2
+//   @120 BTN_FORWARD=0
+//   > KEY_LEFTMETA=1      the frames the engine must emit, in order
+//   > KEY_LEFTMETA=0
+
+// The intent behind one press
+struct trace_label {
+    int event;            // index of the press in events
+    enum gesture_dir dir; // DIR_COUNT: the hold should send nothing
+};
+
+struct trace {
+    const char *path;
+    int dpi;        // 0 unless given
+    bool switcher;
+    bool thumbwheel;
+
+    struct input_event *events; // every input frame, SYN_REPORT included; times in ms
+    int event_count;
+    struct input_event *expected; // the "> " frames
+    int expected_count;
+    struct trace_label *labels;
+    int label_count;
+    char *text;     // every line but the expectation, for re-recording
+};
+
+// Returns 0, or -1 after saying what could not be read
+int trace_load(struct trace *t, const char *path);
+void trace_free(struct trace *t);
+
+// Milliseconds since the start of the trace
+static inline long trace_ms(const struct input_event *ev) {
+    return ev->time.tv_sec * 1000L + ev->time.tv_usec / 1000;
+}
+
+// One "> NAME=VALUE ..." line per frame
+void trace_print_frames(FILE *f, const struct input_event *ev, int count);
+
+#endif
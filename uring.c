@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "output.h"
+#include "uring.h"
+
+// user_data of everything that is not a read: reads use their source slot,
+// polls UD_POLL plus their watch slot
+#define UD_POLL 0x100
+#define UD_WRITE 0x200
+
+static int enter(struct uring_loop *l, unsigned to_submit, unsigned wait_nr, int timeout_ms) {
+    struct io_uring_getevents_arg arg;
+    unsigned flags = IORING_ENTER_EXT_ARG;
+    int ret;
+
+    memset(&arg, 0, sizeof(arg));
+    if (timeout_ms >= 0) {
+        l->timeout.tv_sec = timeout_ms / 1000;
+        l->timeout.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        arg.ts = (uint64_t)(uintptr_t)&l->timeout;
+    }
+    if (wait_nr) {
+        flags |= IORING_ENTER_GETEVENTS;
+    }
+    ret = (int)syscall(__NR_io_uring_enter, l->fd, to_submit, wait_nr, flags, &arg, sizeof(arg));
+    l->enters++;
+    if (ret >= 0) {
+        l->to_submit -= (unsigned)ret < l->to_submit ? (unsigned)ret : l->to_submit;
+    }
+    return ret;
+}
+
+static struct io_uring_sqe *get_sqe(struct uring_loop *l) {
+    unsigned tail = *l->sq_tail;
+    unsigned head = atomic_load_explicit((_Atomic unsigned *)l->sq_head, memory_order_acquire);
+    struct io_uring_sqe *sqe;
+
+    if (tail - head > l->sq_mask) {
+        return NULL; // submission queue full
+    }
+    sqe = &l->sqes[tail & l->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    l->sq_array[tail & l->sq_mask] = tail & l->sq_mask;
+    atomic_store_explicit((_Atomic unsigned *)l->sq_tail, tail + 1, memory_order_release);
+    l->to_submit++;
+    return sqe;
+}
+
+// Stop the link chain at the last staged write; a link must not run
+// into the next submission
+static void close_chain(struct uring_loop *l) {
+    if (l->last_write) {
+        l->last_write->flags &= ~IOSQE_IO_LINK;
+        l->last_write = NULL;
+    }
+}
+
+int uring_loop_init(struct uring_loop *l) {
+    struct io_uring_params p;
+    size_t sq_size, cq_size;
+    char *ring;
+
+    memset(l, 0, sizeof(*l));
+    memset(&p, 0, sizeof(p));
+    l->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (l->fd < 0) {
+        perror("io_uring_setup");
+        return -1;
+    }
+    // One mmap for both rings (5.4) and timed waits (5.11)
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+        fprintf(stderr, "io_uring too old (features 0x%x)\n", p.features);
+        close(l->fd);
+        return -1;
+    }
+
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    l->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    l->ring_mem = mmap(NULL, l->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       l->fd, IORING_OFF_SQ_RING);
+    if (l->ring_mem == MAP_FAILED) {
+        perror("io_uring mmap");
+        close(l->fd);
+        return -1;
+    }
+    l->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    l->sqes = mmap(NULL, l->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   l->fd, IORING_OFF_SQES);
+    if (l->sqes == MAP_FAILED) {
+        perror("io_uring mmap");
+        munmap(l->ring_mem, l->ring_size);
+        close(l->fd);
+        return -1;
+    }
+
+    ring = l->ring_mem;
+    l->sq_head = (unsigned *)(ring + p.sq_off.head);
+    l->sq_tail = (unsigned *)(ring + p.sq_off.tail);
+    l->sq_mask = *(unsigned *)(ring + p.sq_off.ring_mask);
+    l->sq_array = (unsigned *)(ring + p.sq_off.array);
+    l->cq_head = (unsigned *)(ring + p.cq_off.head);
+    l->cq_tail = (unsigned *)(ring + p.cq_off.tail);
+    l->cq_mask = *(unsigned *)(ring + p.cq_off.ring_mask);
+    l->cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+    return 0;
+}
+
+int uring_loop_add_reader(struct uring_loop *l, int fd, int source) {
+    if (l->count >= MAX_READERS || source != l->count) {
+        return -1;
+    }
+    l->reader_fd[l->count] = fd;
+    l->armed[l->count] = false;
+    l->count++;
+    return 0;
+}
+
+int uring_loop_watch(struct uring_loop *l, int fd) {
+    int slot = l->watch_count;
+
+    if (slot >= URING_MAX_WATCH) {
+        return -1;
+    }
+    l->watch_fd[slot] = fd;
+    l->watch_armed[slot] = false;
+    l->watch_ready[slot] = false;
+    l->watch_count++;
+    return slot;
+}
+
+// Post whatever is not in flight: reads, and the polls on watched fds
+static void arm(struct uring_loop *l) {
+    struct io_uring_sqe *sqe;
+    int i;
+
+    for (i = 0; i < l->count; i++) {
+        if (l->armed[i] || l->reader_fd[i] < 0 || !(sqe = get_sqe(l))) {
+            continue;
+        }
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = l->reader_fd[i];
+        sqe->addr = (uint64_t)(uintptr_t)l->frames[i].events;
+        sqe->len = sizeof(l->frames[i].events);
+        sqe->off = (uint64_t)-1; // current position, so a regular file advances
+        sqe->user_data = i;
+        l->armed[i] = true;
+    }
+    for (i = 0; i < l->watch_count; i++) {
+        if (l->watch_armed[i] || l->watch_fd[i] < 0 || !(sqe = get_sqe(l))) {
+            continue;
+        }
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = l->watch_fd[i];
+        sqe->poll_events = POLLIN;
+        sqe->user_data = UD_POLL + i;
+        l->watch_armed[i] = true;
+    }
+}
+
+// Consume every completion. Finished reads are only noted: their frames
+// go to the handler from uring_loop_wait(), which makes this safe to call
+// from inside the handler too.
+static void reap(struct uring_loop *l) {
+    unsigned head = *l->cq_head;
+    unsigned tail = atomic_load_explicit((_Atomic unsigned *)l->cq_tail, memory_order_acquire);
+
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &l->cqes[head & l->cq_mask];
+        uint64_t ud = cqe->user_data;
+
+        if (ud >= UD_POLL && ud < UD_POLL + (uint64_t)l->watch_count) {
+            l->watch_armed[ud - UD_POLL] = false;
+            l->watch_ready[ud - UD_POLL] = cqe->res > 0;
+        } else if (ud == UD_WRITE) {
+            l->writes_inflight--;
+        } else if (ud < (uint64_t)l->count) {
+            l->completed[ud] = true;
+            l->result[ud] = cqe->res;
+        }
+    }
+    atomic_store_explicit((_Atomic unsigned *)l->cq_head, head, memory_order_release);
+}
+
+int uring_loop_wait(struct uring_loop *l, int timeout_ms, frame_handler handler, void *ctx) {
+    bool waiting = false;
+    int handled = 0;
+    int ret;
+    int i;
+
+    arm(l);
+    close_chain(l);
+    for (i = 0; i < l->watch_count; i++) {
+        l->watch_ready[i] = false;
+    }
+    // Reads reaped while the handler was writing are already waiting
+    for (i = 0; i < l->count; i++) {
+        waiting |= l->completed[i];
+    }
+
+    ret = enter(l, l->to_submit, waiting ? 0 : 1, timeout_ms);
+    if (ret < 0 && errno != ETIME) {
+        return -1;
+    }
+    reap(l);
+
+    for (i = 0; i < l->count; i++) {
+        struct frame *f = &l->frames[i];
+        int res = l->result[i];
+
+        if (!l->completed[i]) {
+            continue;
+        }
+        l->completed[i] = false;
+        l->armed[i] = false;
+        if (res == -EINTR || res == -EAGAIN) {
+            continue; // posted again on the next wait
+        }
+        f->count = res > 0 ? (int)(res / sizeof(struct input_event)) : -1;
+        if (f->count < 0) {
+            l->reader_fd[i] = -1; // device gone, stop reading it
+        }
+        handler(ctx, i, f);
+        handled++;
+    }
+
+    if (l->writes_inflight == 0) {
+        l->out_used = 0;
+    }
+    return handled;
+}
+
+void uring_loop_flush(struct uring_loop *l) {
+    close_chain(l);
+    if (l->to_submit > 0) {
+        enter(l, l->to_submit, 0, -1);
+    }
+}
+
+// Submit the staged writes and wait until every write is done, which
+// frees the whole staging area. Links only order writes within one
+// submission, and io-wq may finish an earlier chain late, so this is what
+// lets a frame go out after them by any other route.
+static void finish_writes(struct uring_loop *l) {
+    uring_loop_flush(l);
+    while (l->writes_inflight > 0) {
+        if (enter(l, 0, 1, -1) < 0 && errno != EINTR) {
+            perror("io_uring_enter");
+            return;
+        }
+        reap(l);
+    }
+    l->out_used = 0;
+}
+
+void uring_loop_write(struct uring_loop *l, int fd, const struct input_event *ev, int count) {
+    struct io_uring_sqe *sqe = NULL;
+
+    if (count > URING_OUT_EVENTS - l->out_used || !(sqe = get_sqe(l))) {
+        // No room to stage it: let everything before it finish first
+        finish_writes(l);
+        sqe = count <= URING_OUT_EVENTS - l->out_used ? get_sqe(l) : NULL;
+    }
+    if (!sqe) {
+        write(fd, ev, count * sizeof(*ev)); // bigger than the staging area
+        return;
+    }
+
+    memcpy(&l->out[l->out_used], ev, count * sizeof(*ev));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)&l->out[l->out_used];
+    sqe->len = count * sizeof(*ev);
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = UD_WRITE;
+    l->out_used += count;
+    l->writes_inflight++;
+    l->last_write = sqe;
+}
+
+static void stage_output(void *ctx, int fd, const struct input_event *ev, int count) {
+    uring_loop_write(ctx, fd, ev, count);
+}
+
+static void flush_output(void *ctx) {
+    uring_loop_flush(ctx);
+}
+
+void uring_loop_take_output(struct uring_loop *l) {
+    output_set_writer(stage_output, flush_output, l);
+}
+
+void uring_loop_exit(struct uring_loop *l) {
+    output_set_writer(NULL, NULL, NULL);
+    munmap(l->sqes, l->sqes_size);
+    munmap(l->ring_mem, l->ring_size);
+    close(l->fd);
+}
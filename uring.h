@@ -0,0 +1,89 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+#include <linux/input.h>
+
+#include "dispatch.h"
+
+#define URING_ENTRIES 64
+#define URING_OUT_EVENTS 256 // staged output events awaiting submission
+#define URING_MAX_WATCH 4     // fds polled for readability
+
+// io_uring event loop, driven through the raw syscalls. Every reader fd
+// always has a read posted straight into its frame; each watched fd has a
+// one-shot poll; output frames are staged as a chain of linked writes.
+// All of it goes to the kernel in one io_uring_enter() per wait, together
+// with the wait's timeout.
+struct uring_loop {
+    int fd;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    void *ring_mem;
+    size_t ring_size;
+    size_t sqes_size;
+    unsigned to_submit;
+
+    struct frame frames[MAX_READERS];
+    int reader_fd[MAX_READERS];
+    bool armed[MAX_READERS];     // read posted, frame not yet handed out
+    bool completed[MAX_READERS]; // reaped, waiting for the handler
+    int result[MAX_READERS];     // its cqe->res
+    int count;
+
+    int watch_fd[URING_MAX_WATCH]; // -1 if unused
+    bool watch_armed[URING_MAX_WATCH];
+    bool watch_ready[URING_MAX_WATCH]; // set by uring_loop_wait() when readable
+    int watch_count;
+
+    struct __kernel_timespec timeout;
+    struct input_event out[URING_OUT_EVENTS];
+    int out_used;
+    int writes_inflight;
+    struct io_uring_sqe *last_write; // end of the link chain
+
+    unsigned long enters; // io_uring_enter() calls
+};
+
+// Returns 0, or -1 if the kernel has no usable io_uring
+int uring_loop_init(struct uring_loop *l);
+
+// Keep a read posted on fd; its frames go to the handler with source.
+// fd must be blocking, or the kernel fails the read with EAGAIN.
+int uring_loop_add_reader(struct uring_loop *l, int fd, int source);
+
+// Report readability of fd through watch_ready[] at the returned slot;
+// the caller does the reads. fd may be -1 to keep a slot unused.
+// Returns the slot or -1 if all URING_MAX_WATCH are taken.
+int uring_loop_watch(struct uring_loop *l, int fd);
+
+// Submit everything staged and wait up to timeout_ms (-1 forever) for
+// at least one completion. Completed reads go to handler and are
+// re-posted. Returns the number of frames handled, 0 on timeout, or -1.
+int uring_loop_wait(struct uring_loop *l, int timeout_ms, frame_handler handler, void *ctx);
+
+// Stage a write of count events to fd, ordered after every write staged
+// before it. With the staging area full, waits for the writes already
+// staged to complete first (and writes inline only a frame too big to stage).
+void uring_loop_write(struct uring_loop *l, int fd, const struct input_event *ev, int count);
+
+// Submit staged writes now, without waiting
+void uring_loop_flush(struct uring_loop *l);
+
+// Route the output.c frame writers (keys, passthrough) through
+// uring_loop_write(); undone by uring_loop_exit()
+void uring_loop_take_output(struct uring_loop *l);
+
+void uring_loop_exit(struct uring_loop *l);
+
+#endif